@@ -0,0 +1,33 @@
+#!/bin/bash
+
+## This checks that the multi-threaded build samples the same chain as the single-threaded one
+## with outside partials (-outside), alone and with the partitions of test_part.txt (-part).
+## With -vout both builds also compare the candidate tables of the node rate move, evaluated
+## together, with one evaluation per table.
+## The argument is the directory of dppdiv and dppdiv-par (../src by default)
+BIN=${1:-../src}
+export OMP_NUM_THREADS=${OMP_NUM_THREADS:-4}
+status=0
+
+check () {
+	for b in dppdiv dppdiv-par; do
+		$BIN/$b -in test_seq.dat -tre test_tre.phy -cal test_fos.cal -tga -n 1000 -sf 50 -pf 50 -s1 5 -s2 7 -out check_$b "$@" > check_$b.log 2>&1
+	done
+	if cmp -s check_dppdiv.p check_dppdiv-par.p && cmp -s check_dppdiv.ant.tre check_dppdiv-par.ant.tre; then
+		echo "same chains in dppdiv and dppdiv-par: $*"
+	else
+		echo "ERROR: the chains of dppdiv and dppdiv-par differ: $*"
+		status=1
+	fi
+	for b in dppdiv dppdiv-par; do
+		d=$(sed -n 's/.*Candidate table check: max |lnL(batched) - lnL| = \([^ ]*\) .*/\1/p' check_$b.log)
+		if [ -z "$d" ] || awk -v d="$d" 'BEGIN { exit !(d > 1e-6) }'; then
+			echo "ERROR: the candidate tables of $b differ by $d: $*"
+			status=1
+		fi
+	done
+}
+
+check -outside -vout
+check -outside -vout -part test_part.txt
+exit $status
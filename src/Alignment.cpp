@@ -35,14 +35,20 @@
 #include <istream>
 #include <vector>
 #include <cstdlib>
+#include <cctype>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace std;
 
-Alignment::Alignment(string fn) {
+Alignment::Alignment(string fn, bool aa) {
 	
 	numTaxa = numChar = numPatterns = 0;
+	numStates = (aa == true ? 20 : 4);
 	matrix = compressedMatrix = NULL;
 	patternCount = NULL;
+	constantStates = NULL;
 	isCompressed = false;
 
 	ifstream seqStream(fn.c_str());
@@ -100,7 +106,7 @@ Alignment::Alignment(string fn) {
 					for (unsigned i=0; i<word.length(); i++)
 						{
 						char site = word.at(i);
-						matrix[taxonNum-1][siteNum++] = nucID(site);
+						matrix[taxonNum-1][siteNum++] = (numStates == 4 ? nucID(site) : aaID(site));
 						}
 					}
 				}
@@ -124,42 +130,161 @@ Alignment::~Alignment(void) {
 		}
 	if (patternCount != NULL)
 		delete [] patternCount;
+	if (constantStates != NULL)
+		delete [] constantStates;
 }
 
-void Alignment::compress(void) {
+/* 64-bit FNV-1a hashes of the columns [begin, end), taxon by taxon so the matrix is read
+ * row by row. */
+static void hashColumns(int **m, int numTaxa, int begin, int end, unsigned long long *h) {
 
-	if (isCompressed == false)
+	for (int i=begin; i<end; i++)
+		h[i] = 14695981039346656037ULL;
+	for (int k=0; k<numTaxa; k++)
 		{
-		int *tempCnt = new int[numChar];
-		for (int i=0; i<numChar; i++)
-			tempCnt[i] = 1;
-		for (int i=0; i<numChar; i++)
+		const int *row = m[k];
+		for (int i=begin; i<end; i++)
+			h[i] = (h[i] ^ (unsigned long long)row[i]) * 1099511628211ULL;
+		}
+}
+
+/* Merge the columns cols with the weights cnts into the distinct columns uniq, kept in the
+ * order of their first occurrence, and their weights uniqCnt. The columns are found in an open
+ * addressing table on their hashes, columns with the same hash are compared taxon by taxon. */
+static void mergeColumns(int **m, int numTaxa, const unsigned long long *h, const vector<int> &cols,
+                         const vector<int> &cnts, vector<int> &uniq, vector<int> &uniqCnt) {
+
+	size_t size = 16;
+	while (size < 2 * cols.size())
+		size *= 2;
+	vector<int> table(size, -1);
+	for (size_t c=0; c<cols.size(); c++)
+		{
+		int i = cols[c];
+		size_t s = (size_t)(h[i] ^ (h[i] >> 29)) & (size - 1);
+		for (;;)
 			{
-			if (tempCnt[i] > 0)
+			int u = table[s];
+			if (u < 0)
 				{
-				numPatterns++;
-				for (int j=i+1; j<numChar; j++)
+				table[s] = (int)uniq.size();
+				uniq.push_back(i);
+				uniqCnt.push_back(cnts[c]);
+				break;
+				}
+			int j = uniq[u];
+			if (h[j] == h[i])
+				{
+				bool isSame = true;
+				for (int k=0; k<numTaxa; k++)
 					{
-					if (tempCnt[j] > 0)
+					if (m[k][i] != m[k][j])
 						{
-						bool isSame = true;
-						for (int k=0; k<numTaxa; k++)
-							{
-							if (matrix[k][i] != matrix[k][j])
-								{
-								isSame = false;
-								break;
-								}
-							}
-						if (isSame == true)
-							{
-							tempCnt[i]++;
-							tempCnt[j] = 0;
-							}
+						isSame = false;
+						break;
 						}
 					}
+				if (isSame == true)
+					{
+					uniqCnt[u] += cnts[c];
+					break;
+					}
 				}
+			s = (s + 1) & (size - 1);
 			}
+		}
+}
+
+/* The distinct columns of [begin, end) are found in linear time from their hashes. With OpenMP
+ * every thread hashes and merges its own chunk of columns, then the chunks are merged in order,
+ * so the patterns are always in the order of their first column and the result does not depend
+ * on the number of threads. */
+void Alignment::compressColumns(int begin, int end, vector<int> &uniq, vector<int> &uniqCnt) {
+
+	int n = end - begin;
+	unsigned long long *hashes = new unsigned long long[numChar];
+	int numChunks = 1;
+#ifdef _OPENMP
+	numChunks = omp_get_max_threads();
+	if (numChunks > n / 1024)
+		numChunks = (n / 1024 > 1 ? n / 1024 : 1);
+#endif
+	vector<vector<int> > chunkCols(numChunks), chunkCnts(numChunks);
+#ifdef _OPENMP
+	#pragma omp parallel for schedule(static, 1) num_threads(numChunks)
+#endif
+	for (int c=0; c<numChunks; c++)
+		{
+		int b = begin + (int)((long)c * n / numChunks);
+		int e = begin + (int)((long)(c + 1) * n / numChunks);
+		hashColumns(matrix, numTaxa, b, e, hashes);
+		vector<int> cols(e - b), cnts(e - b, 1);
+		for (int i=b; i<e; i++)
+			cols[i - b] = i;
+		mergeColumns(matrix, numTaxa, hashes, cols, cnts, chunkCols[c], chunkCnts[c]);
+		}
+
+	vector<int> cols, cnts;
+	for (int c=0; c<numChunks; c++)
+		{
+		cols.insert(cols.end(), chunkCols[c].begin(), chunkCols[c].end());
+		cnts.insert(cnts.end(), chunkCnts[c].begin(), chunkCnts[c].end());
+		}
+	if (numChunks == 1)
+		{
+		uniq.swap(cols);
+		uniqCnt.swap(cnts);
+		}
+	else
+		mergeColumns(matrix, numTaxa, hashes, cols, cnts, uniq, uniqCnt);
+	delete [] hashes;
+}
+
+/* Compress the sites into patterns. The patterns of a partition never merge with those of
+ * another one: the columns are first ordered by partition (keeping their order within it) and
+ * every partition is compressed on its own, so the patterns come partition by partition. */
+void Alignment::compress(void) {
+
+	if (isCompressed == false)
+		{
+		if (partitionNames.empty() == true)
+			{
+			partitionNames.push_back("all");
+			sitePartition.assign(numChar, 0);
+			}
+		int numParts = (int)partitionNames.size();
+		vector<int> firstCol(numParts + 1, 0);
+		for (int j=0; j<numChar; j++)
+			firstCol[sitePartition[j] + 1]++;
+		for (int i=0; i<numParts; i++)
+			firstCol[i + 1] += firstCol[i];
+		if (numParts > 1)
+			{
+			vector<int> next(firstCol.begin(), firstCol.end() - 1);
+			vector<int> order(numChar);
+			for (int j=0; j<numChar; j++)
+				order[next[sitePartition[j]]++] = j;
+			vector<int> row(numChar);
+			for (int k=0; k<numTaxa; k++)
+				{
+				for (int j=0; j<numChar; j++)
+					row[j] = matrix[k][order[j]];
+				for (int j=0; j<numChar; j++)
+					matrix[k][j] = row[j];
+				}
+			}
+
+		vector<int> uniq, uniqCnt;
+		partitionPatterns.assign(1, 0);
+		for (int i=0; i<numParts; i++)
+			{
+			vector<int> u, uc;
+			compressColumns(firstCol[i], firstCol[i + 1], u, uc);
+			uniq.insert(uniq.end(), u.begin(), u.end());
+			uniqCnt.insert(uniqCnt.end(), uc.begin(), uc.end());
+			partitionPatterns.push_back((int)uniq.size());
+			}
+		numPatterns = (int)uniq.size();
 		
 		compressedMatrix = new int*[numTaxa];
 		compressedMatrix[0] = new int[numTaxa * numPatterns];
@@ -167,21 +292,114 @@ void Alignment::compress(void) {
 			compressedMatrix[i] = compressedMatrix[i-1] + numPatterns;
 		patternCount = new int[numPatterns];
 		
-		for (int i=0, j=0; i<numChar; i++)
+		for (int k=0; k<numTaxa; k++)
+			for (int j=0; j<numPatterns; j++)
+				compressedMatrix[k][j] = matrix[k][uniq[j]];
+		for (int j=0; j<numPatterns; j++)
+			patternCount[j] = uniqCnt[j];
+		
+		// the states every taxon of a pattern is compatible with, for the invariant sites model
+		constantStates = new int[numPatterns];
+		for (int j=0; j<numPatterns; j++)
+			constantStates[j] = getAllStates();
+		for (int k=0; k<numTaxa; k++)
+			for (int j=0; j<numPatterns; j++)
+				constantStates[j] &= compressedMatrix[k][j];
+		
+		isCompressed = true;
+		}
+}
+
+/* Read the partitions of the sites from a file with one partition per line, as in RAxML:
+ * an optional data type, the name and the site ranges (counted from 1), e.g.
+ *     DNA, gene1 = 1-500, 901-1000
+ *     gene2 = 501-900
+ * A range a-b\3 takes every third site, for the codon positions. Every site has to be in
+ * exactly one partition. */
+void Alignment::readPartitions(string fn) {
+
+	ifstream partStream(fn.c_str());
+	if (!partStream) 
+		{
+		cerr << "Cannot open file \"" + fn + "\"\n";
+		exit(1);
+		}
+	sitePartition.assign(numChar, -1);
+	partitionNames.clear();
+	string lineString = "";
+	while ( getline(partStream, lineString).good() || lineString.empty() == false )
+		{
+		size_t eq = lineString.find('=');
+		if (eq == string::npos)
 			{
-			if (tempCnt[i] > 0)
+			if (lineString.find_first_not_of(" \t\r") != string::npos)
 				{
-				for (int k=0; k<numTaxa; k++)
-					compressedMatrix[k][j] = matrix[k][i];
-				patternCount[j] = tempCnt[i];
-				j++;
+				cerr << "ERROR: Expected \"name = ranges\" in the partition file, found \"" << lineString << "\"" << endl;
+				exit(1);
 				}
+			lineString = "";
+			continue;
 			}
+		string name = lineString.substr(0, eq);
+		size_t comma = name.rfind(',');
+		if (comma != string::npos)
+			name = name.substr(comma + 1);
+		istringstream nameStream(name);
+		nameStream >> name;
+		int part = (int)partitionNames.size();
+		partitionNames.push_back(name);
 		
-		isCompressed = true;
-		
-		delete[] tempCnt;
+		string ranges = lineString.substr(eq + 1);
+		for (size_t i=0; i<ranges.size(); i++)
+			if (ranges[i] == ',')
+				ranges[i] = ' ';
+		istringstream rangeStream(ranges);
+		string range;
+		while (rangeStream >> range)
+			{
+			int first = 0, last = 0, stride = 1;
+			char c1 = 0, c2 = 0;
+			istringstream r(range);
+			r >> first;
+			last = first;
+			if (r >> c1)
+				{
+				if (c1 == '-')
+					{
+					r >> last;
+					if (r >> c2)
+						r >> stride;
+					}
+				else
+					r >> stride;
+				}
+			if (first < 1 || last > numChar || first > last || stride < 1)
+				{
+				cerr << "ERROR: Invalid site range \"" << range << "\" of partition " << name << " (the alignment has " << numChar << " sites)" << endl;
+				exit(1);
+				}
+			for (int j=first; j<=last; j+=stride)
+				{
+				if (sitePartition[j - 1] >= 0)
+					{
+					cerr << "ERROR: Site " << j << " is in partitions " << partitionNames[sitePartition[j - 1]] << " and " << name << endl;
+					exit(1);
+					}
+				sitePartition[j - 1] = part;
+				}
+			}
+		lineString = "";
 		}
+	partStream.close();
+	for (int j=0; j<numChar; j++)
+		{
+		if (sitePartition[j] < 0)
+			{
+			cerr << "ERROR: Site " << j + 1 << " is not in any partition" << endl;
+			exit(1);
+			}
+		}
+	cout << "   Number of partitions = " << partitionNames.size() << '\n';
 }
 
 int Alignment::getIndexForTaxonNamed(string nm) {
@@ -219,6 +437,18 @@ int Alignment::getNumSitesOfPattern(int i) {
 	return patternCount[i];
 }
 
+/* The code of the states in which pattern i is constant, i.e. the states that all taxa are
+ * compatible with (see getPossibleNucs and aaID), 0 if the pattern is variable. */
+int Alignment::getConstantStates(int i) {
+
+	if (isCompressed == true)
+		return constantStates[i];
+	int s = getAllStates();
+	for (int k=0; k<numTaxa; k++)
+		s &= matrix[k][i];
+	return s;
+}
+
 /*-------------------------------------------------------------------
 |
 |   GetPossibleNucs: 
@@ -484,6 +714,38 @@ int Alignment::nucID(char nuc) {
 		return -1;
 }
 
+/*-------------------------------------------------------------------
+|
+|   AaID: 
+|
+|   Take an amino acid character and return the bit pattern of the
+|   states it is compatible with, bit i being the i-th amino acid of
+|   AA_STATE_ORDER (A R N D C Q E G H I L K M F P S T W Y V). The
+|   ambiguity codes B (N or D), Z (Q or E) and J (I or L) set two
+|   bits, X - ? and * all twenty. Returns -1 for anything else.
+|
+-------------------------------------------------------------------*/
+int Alignment::aaID(char aa) {
+
+	const char *order = AA_STATE_ORDER;
+	char a = (char)toupper(aa);
+	for (int i=0; i<20; i++)
+		{
+		if (a == order[i])
+			return 1 << i;
+		}
+	if (a == 'B')
+		return (1 << 2) | (1 << 3);
+	else if (a == 'Z')
+		return (1 << 5) | (1 << 6);
+	else if (a == 'J')
+		return (1 << 9) | (1 << 10);
+	else if (a == 'X' || a == '-' || a == '?' || a == '*')
+		return (1 << 20) - 1;
+	else
+		return -1;
+}
+
 void Alignment::print(std::ostream & o) const {
 
 	if (isCompressed == false)
@@ -34,34 +34,50 @@
 #include <vector>
 #include <iostream>
 
+// the amino acids in the order of their states (and of the PAML rate matrix files)
+#define AA_STATE_ORDER "ARNDCQEGHILKMFPSTWYV"
 
 class Alignment {
 
 	public:
-									Alignment(std::string fn); 
+									Alignment(std::string fn, bool aa); 
 									~Alignment(void);
 		void						compress(void);
+		void						readPartitions(std::string fn);
 		int							getNumTaxa(void) { return numTaxa; }
 		int							getNumChar(void);
 		std::string					getTaxonName(int i) { return taxonNames[i]; }
 		int							getIndexForTaxonNamed(std::string nm);
 		int							getNucleotide(int i, int j);
 		int							getNumSitesOfPattern(int i);
+		int							getConstantStates(int i);
 		void						getPossibleNucs (int nucCode, int *nuc);
 		bool						isTaxonPresent(std::string nm);
 		void						print(std::ostream &) const;
 		int							getNumPatterns(void) { return numPatterns; }
+		int							getNumStates(void) { return numStates; }
+		int							getAllStates(void) { return (1 << numStates) - 1; }
+		int							getNumPartitions(void) { return (int)partitionNames.size(); }
+		std::string					getPartitionName(int i) { return partitionNames[i]; }
+		int							getFirstPatternOfPartition(int i) { return partitionPatterns[i]; }
 
 	private:
+		void						compressColumns(int begin, int end, std::vector<int> &uniq, std::vector<int> &uniqCnt);
 		int							nucID(char nuc);
+		int							aaID(char aa);
 		int							numTaxa;
 		int							numChar;
+		int							numStates;
 		int							**matrix;
 		int							**compressedMatrix;
 		int							*patternCount;
+		int							*constantStates;
 		int							numPatterns;
 		bool						isCompressed;
 		std::vector<std::string>	taxonNames;
+		std::vector<std::string>	partitionNames;
+		std::vector<int>			sitePartition;			// partition of every site (column)
+		std::vector<int>			partitionPatterns;		// first pattern of every partition, and numPatterns
 };
 
 #endif
@@ -27,7 +27,7 @@
  *
  */
 
-
+#include "Alignment.h"
 #include "MbRandom.h"
 #include "Mcmc.h"
 #include "Model.h"
@@ -38,19 +38,24 @@
 #include "Parameter_rate.h"
 #include "Parameter_tree.h"
 #include "Parameter_shape.h"
+#include "Parameter_pinvar.h"
 #include "Parameter_speciaton.h"
 #include "Parameter_treescale.h"
+#include "SiteLikelihoods.h"
 #include "util.h"
 
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
 #include <ctime>
+#include <vector>
 
 #include <time.h>
 
 using namespace std;
 
-Mcmc::Mcmc(MbRandom *rp, Model *mp, int nc, int pf, int sf, string ofp, bool wdf, bool modUpP) {
+Mcmc::Mcmc(MbRandom *rp, Model *mp, int nc, int pf, int sf, string ofp, bool wdf, bool modUpP, int bi,
+		   bool waic, bool slnl) {
 
 	ranPtr          = rp;
 	modelPtr        = mp;
@@ -61,7 +66,16 @@ Mcmc::Mcmc(MbRandom *rp, Model *mp, int nc, int pf, int sf, string ofp, bool wdf
 	writeInfoFile   = wdf;
 	printratef		= false;
 	modUpdateProbs  = modUpP;
+	burnIn          = bi;
+	estimateWaic    = waic;
+	writeSiteLnLs   = slnl;
+	siteLikelihoods = NULL;
+	if((estimateWaic || writeSiteLnLs) && modelPtr->getRunUnderPrior()){
+		cerr << "ERROR: The site log-likelihoods (-waic, -sitelnl) cannot be used when running under the prior (-rnp)" << endl;
+		exit(1);
+	}
 	runChain();
+	delete siteLikelihoods;
 }
 
 void Mcmc::runChain(void) {
@@ -76,7 +90,22 @@ void Mcmc::runChain(void) {
 	ofstream nOut(ndFile.c_str(), ios::out);
 	ofstream mxOut;
 	ofstream dOut;
+	ofstream sOut;
 	
+	if(writeSiteLnLs){
+		string sFile = fileNamePref + ".sitelnl";
+		sOut.open(sFile.c_str(), ios::out | ios::binary);
+	}
+	if(estimateWaic){
+		// the samples are taken at the first generation and every sampleFrequency
+		int numSamples = numCycles / sampleFrequency - max(burnIn, 0) / sampleFrequency;
+		if(burnIn < 1 && sampleFrequency > 1)
+			numSamples++;
+		vector<int> weights(modelPtr->getNumSitePatterns());
+		for(unsigned i=0; i<weights.size(); i++)
+			weights[i] = modelPtr->getNumSitesOfPattern(i);
+		siteLikelihoods = new SiteLikelihoods(weights, numSamples);
+	}
 	if(writeInfoFile)
 		dOut.open(dFile.c_str(), ios::out);
 	if(printratef)
@@ -136,12 +165,7 @@ void Mcmc::runChain(void) {
 			Tree *t = modelPtr->getActiveTree();
 			Treescale *ts = modelPtr->getActiveTreeScale();
 			t->setTreeScale(ts->getScaleValue());
-			t->flipAllCls();
-			t->flipAllTis();
-			t->upDateAllCls();
-			t->upDateAllTis();
 			modelPtr->upDateRateMatrix();
-			modelPtr->setTiProb();
 		}
 		
 		if(n < 100){ 
@@ -152,6 +176,8 @@ void Mcmc::runChain(void) {
 		// sample chain
 		if ( n % sampleFrequency == 0 || n == 1){
 			sampleChain(n, pOut, fTOut, nOut, oldLnLikelihood);
+			if(estimateWaic || writeSiteLnLs)
+				sampleSiteLnLs(n, sOut);
 			//sampleRtsFChain(n, mxOut);
 		}
 		
@@ -166,8 +192,6 @@ void Mcmc::runChain(void) {
 	
 		if(testLnL){
 			Tree *t = modelPtr->getActiveTree(); 
-			t->flipAllCls();
-			t->flipAllTis();
 			t->upDateAllCls();
 			t->upDateAllTis();
 			modelPtr->upDateRateMatrix();
@@ -179,6 +203,17 @@ void Mcmc::runChain(void) {
 	Tree *t = modelPtr->getActiveTree();
 	int timeEnd = time(NULL);
 	cout << "   Markov chain completed in " << (static_cast<float>(timeEnd - timeSt)) << " seconds" << endl;
+	modelPtr->printPrecisionCheck();
+	modelPtr->printOutsideCheck();
+	modelPtr->printScheduleChoice();
+	if(estimateWaic){
+		string wFile = fileNamePref + ".waic.out";
+		ofstream wOut(wFile.c_str(), ios::out);
+		siteLikelihoods->print(wOut, true);
+		wOut.close();
+		siteLikelihoods->print(cout, false);
+	}
+	sOut.close();
 	pOut.close();
 	fTOut.close();
 	dOut.close();
@@ -186,6 +221,32 @@ void Mcmc::runChain(void) {
 	mxOut.close();
 }
 
+/* The log-likelihoods of the site patterns of the current state go to the WAIC and PSIS-LOO
+ * estimates after the burn-in, and to the .sitelnl file. The file starts with the 8 bytes
+ * "DPPSLNL1", the number of patterns and the number of sites of every pattern (32-bit
+ * integers), then every sample is its generation (32-bit) and the log-likelihood of every
+ * pattern (64-bit floats), all in the byte order of the machine. */
+void Mcmc::sampleSiteLnLs(int gen, ofstream &sOut) {
+
+	vector<double> lnLs;
+	modelPtr->siteLnLikelihoods(lnLs);
+	if(estimateWaic && gen > burnIn)
+		siteLikelihoods->addSample(lnLs);
+	if(writeSiteLnLs == false)
+		return;
+	int numPat = (int)lnLs.size();
+	if(gen == 1){
+		sOut.write("DPPSLNL1", 8);
+		sOut.write((const char *)&numPat, sizeof(int));
+		for(int i=0; i<numPat; i++){
+			int w = modelPtr->getNumSitesOfPattern(i);
+			sOut.write((const char *)&w, sizeof(int));
+		}
+	}
+	sOut.write((const char *)&gen, sizeof(int));
+	sOut.write((const char *)&lnLs[0], numPat * sizeof(double));
+}
+
 double Mcmc::safeExponentiation(double lnX) {
 
 	if (lnX < -300.0)
@@ -211,13 +272,29 @@ void Mcmc::sampleChain(int gen, ofstream &paraOut, ofstream &figTOut,
 	bool expHPCal = modelPtr->getExponCalibHyperParm();
 	bool dpmHPCal = modelPtr->getExponDPMCalibHyperParm();
 	int treePr = modelPtr->getTreeTimePriorNum();
+	int numParts = modelPtr->getNumPartitions();
 	if(expHPCal)
 		hpex = modelPtr->getActiveExpCalib();
 	
 	if(gen == 1){
-		paraOut << "Gen\tlnLikelihood\tf(A)\tf(C)\tf(G)\tf(T)";
-//		paraOut << "\tr(AC)\tr(AG)\tr(AT)\tr(CG)\tr(CT)\tr(GT)\tshape\tave rate\tnum rate groups\tconc param\n";
-		paraOut << "\tr(AC)\tr(AG)\tr(AT)\tr(CG)\tr(CT)\tr(GT)\tshape\n";
+		paraOut << "Gen\tlnLikelihood";
+		// the columns of the substitution parameters of every partition (-part) end in its name
+		for(int q=0; q<numParts; q++){
+			string sfx = (numParts > 1 ? "." + modelPtr->getPartitionName(q) : "");
+			if(f->getNumStates() == 4)
+				paraOut << "\tf(A)" << sfx << "\tf(C)" << sfx << "\tf(G)" << sfx << "\tf(T)" << sfx;
+			else{
+				for(int i=0; i<f->getNumStates(); i++)
+					paraOut << "\tf(" << AA_STATE_ORDER[i] << ")" << sfx;
+			}
+//			paraOut << "\tr(AC)\tr(AG)\tr(AT)\tr(CG)\tr(CT)\tr(GT)\tshape\tave rate\tnum rate groups\tconc param\n";
+			if(e->getIsFixed() == false)
+				paraOut << "\tr(AC)" << sfx << "\tr(AG)" << sfx << "\tr(AT)" << sfx << "\tr(CG)" << sfx << "\tr(CT)" << sfx << "\tr(GT)" << sfx;
+			paraOut << "\tshape" << sfx;
+			if(modelPtr->getUseInvariantSites())
+				paraOut << "\tpinvar" << sfx;
+		}
+		paraOut << "\n";
 		figTOut << "#NEXUS\nbegin trees;\n";
 		nodeOut << "Gen\tlnL";
 		nodeOut << "\tNetDiv(b-d)\tRelativeDeath(d/b)";
@@ -251,11 +328,20 @@ void Mcmc::sampleChain(int gen, ofstream &paraOut, ofstream &figTOut,
 	}
 	// then print stuff
 	paraOut << gen << "\t" << lnl;
-	for(int i=0; i<f->getNumStates(); i++)
-		paraOut << "\t" << f->getFreq(i);
-	for(int i=0; i<6; i++)
-		paraOut << "\t" << e->getRate(i);
-	paraOut << "\t" << sh->getAlphaSh();
+	for(int q=0; q<numParts; q++){
+		f = modelPtr->getActiveBasefreq(q);
+		e = modelPtr->getActiveExchangeability(q);
+		sh = modelPtr->getActiveShape(q);
+		for(int i=0; i<f->getNumStates(); i++)
+			paraOut << "\t" << f->getFreq(i);
+		if(e->getIsFixed() == false){
+			for(int i=0; i<e->getNumRates(); i++)
+				paraOut << "\t" << e->getRate(i);
+		}
+		paraOut << "\t" << sh->getAlphaSh();
+		if(modelPtr->getUseInvariantSites())
+			paraOut << "\t" << modelPtr->getActivePinvar(q)->getPinv();
+	}
 //	paraOut << "\t" << nr->getAverageRate();
 //	paraOut << "\t" << nr->getNumRateGroups();
 //	paraOut << "\t" << nr->getConcenParam();
@@ -320,9 +406,15 @@ void Mcmc::printAllModelParams(ofstream &dOut){
 	
 	dOut << "\n--------------------------------------------------\n";
 	dOut << "Initial: \n";
-	dOut << modelPtr->getActiveBasefreq()->writeParam();
-	dOut << modelPtr->getActiveExchangeability()->writeParam();
-	dOut << modelPtr->getActiveShape()->writeParam();
+	for(int q=0; q<modelPtr->getNumPartitions(); q++){
+		if(modelPtr->getNumPartitions() > 1)
+			dOut << "Partition " << modelPtr->getPartitionName(q) << ":\n";
+		dOut << modelPtr->getActiveBasefreq(q)->writeParam();
+		dOut << modelPtr->getActiveExchangeability(q)->writeParam();
+		dOut << modelPtr->getActiveShape(q)->writeParam();
+		if(modelPtr->getUseInvariantSites())
+			dOut << modelPtr->getActivePinvar(q)->writeParam();
+	}
 	dOut << modelPtr->getActiveNodeRate()->writeParam();
 	dOut << modelPtr->getActiveTree()->writeParam();
 	dOut << "--------------------------------------------------\n\n";
@@ -36,11 +36,12 @@
 
 class MbRandom;
 class Model;
+class SiteLikelihoods;
 class Mcmc {
 
 	public:
 						Mcmc(MbRandom *rp, Model *mp, int nc, int pf, int sf, 
-							 std::string ofp, bool wdf, bool modUpP);
+							 std::string ofp, bool wdf, bool modUpP, int bi, bool waic, bool slnl);
 							
 	private:
 		void			runChain(void);
@@ -48,6 +49,7 @@ class Mcmc {
 		void			sampleChain(int gen, std::ofstream &paraOut, 
 									std::ofstream &figTOut, std::ofstream &nodeOut, double lnl);
 		void			sampleRtsFChain(int gen, std::ofstream &rOut);
+		void			sampleSiteLnLs(int gen, std::ofstream &sOut);
 		void			printAllModelParams(std::ofstream &dOut);
 		void			writeCalibrationTree();
 		int				numCycles;
@@ -59,6 +61,10 @@ class Mcmc {
 		bool			writeInfoFile;
 		bool			printratef;
 		bool			modUpdateProbs;
+		int				burnIn;
+		bool			estimateWaic;		// -waic
+		bool			writeSiteLnLs;		// -sitelnl
+		SiteLikelihoods	*siteLikelihoods;
 };
 
 #endif
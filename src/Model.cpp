@@ -32,12 +32,15 @@
 #include "MbRandom.h"
 #include "MbTransitionMatrix.h"
 #include "Model.h"
+#include "Model_arena.h"
+#include "Model_kernels.h"
 #include "Parameter.h"
 #include "Parameter_basefreq.h"
 #include "Parameter_exchangeability.h"
 #include "Parameter_expcalib.h"
 #include "Parameter_rate.h"
 #include "Parameter_shape.h"
+#include "Parameter_pinvar.h"
 #include "Parameter_speciaton.h"
 #include "Parameter_tree.h"
 #include "Parameter_cphyperp.h"
@@ -46,8 +49,12 @@
 #include "util.h"
 #include <string>
 #include <vector>
+#include <map>
+#include <algorithm>
 #include <fstream>
 #include <cstring>
+#include <cstdlib>
+#include <unistd.h>
 
 using namespace std;
 
@@ -55,14 +62,17 @@ Model::Model(MbRandom *rp, Alignment *ap, string ts, double pm, double ra, doubl
 			 double hal, double hbe, bool ubl, bool alnm, int offmv, bool rndNo, 
 			 string clfn, int nodpr, double bdr, double bda, double bds, double fxclkrt, bool roofix,
 			 bool sfb, bool ehpc, bool dphpc, int dphpng, bool gamhp, int rmod, bool fxmod,
-			 bool ihp, string tipdfn, bool fxtr) {
+			 bool ihp, string tipdfn, bool fxtr, string kern, bool soa,
+			 string prec, bool vprec, int cblk, bool srep, int ncat, bool inv,
+			 string rmfn, bool hugep, bool pin, double clmem, string clfile, int clscr,
+			 bool ptask, bool outside, int adapt, bool rnp, bool vout) {
 
 	// remember pointers to important objects...
 	ranPtr       = rp;
 	alignmentPtr = ap;
 	priorMeanN   = pm;
 	ranPtr->getSeed(startS1, startS2);
-	runUnderPrior = false;
+	runUnderPrior = rnp;
 	treeTimePrior = nodpr;
 	myCurLnL = 0.0;
 	lnLGood = false;
@@ -104,8 +114,152 @@ Model::Model(MbRandom *rp, Alignment *ap, string ts, double pm, double ra, doubl
 	cout << "\nStarting with seeds: { " << startS1 << " , " << startS2 << " } \n\n";
 	
 	// ...and initialize some important variables
-	numGammaCats = 4;
+	numGammaCats = ncat;
+	if (IS_KERNEL_CAT_COUNT(numGammaCats) == false)
+		{
+		cerr << "ERROR: The number of gamma categories (-ncat) must be 1, 2, 4 or 8" << endl;
+		exit(1);
+		}
 	numPatterns  = alignmentPtr->getNumChar();
+	numStates    = alignmentPtr->getNumStates();
+	numPartitions = alignmentPtr->getNumPartitions();
+	numPaddedCats = ((numGammaCats + MAX_CAT_GROUP - 1) / MAX_CAT_GROUP) * MAX_CAT_GROUP;
+	if (prec == "double")
+		clPrecision = CL_DOUBLE;
+	else if (prec == "single")
+		clPrecision = CL_SINGLE;
+	else if (prec == "mixed")
+		clPrecision = CL_MIXED;
+	else
+		{
+		cerr << "ERROR: Unknown precision \"" << prec << "\" (use double, single or mixed)" << endl;
+		exit(1);
+		}
+	if (clPrecision != CL_DOUBLE && soa == true)
+		{
+		cerr << "ERROR: The pattern-interleaved layout (-soa) is only available in double precision" << endl;
+		exit(1);
+		}
+	if (srep == true && soa == true)
+		{
+		cerr << "ERROR: Site repeats (-srep) cannot be used with the pattern-interleaved layout (-soa)" << endl;
+		exit(1);
+		}
+	if (srep == true && ptask == true)
+		{
+		cerr << "ERROR: Site repeats (-srep) cannot be used with the task-parallel traversal (-ptask)" << endl;
+		exit(1);
+		}
+	if (srep == true && numPartitions > 1)
+		{
+		cerr << "ERROR: Site repeats (-srep) cannot be used with partitions (-part)" << endl;
+		exit(1);
+		}
+	if (outside == true && (srep == true || clmem > 0.0))
+		{
+		cerr << "ERROR: Outside partials (-outside) cannot be used with site repeats (-srep) or a memory cap (-clmem)" << endl;
+		exit(1);
+		}
+	if (numStates != 4 && (soa == true || clPrecision != CL_DOUBLE))
+		{
+		cerr << "ERROR: Amino acid data (-aa) can only be used with the pattern-major layout in double precision" << endl;
+		exit(1);
+		}
+	useSiteRepeats = srep;
+	useInvariantSites = inv;
+	validatePrecision = (vprec == true && clPrecision != CL_DOUBLE && runUnderPrior == false);
+	cacheBlockPatterns = cblk;
+	useTaskGraph = ptask;
+	clMemoryCap = clmem;
+	clFileName = clfile;
+	numClScratch = clscr;
+	useOutside = outside;
+	overwroteCommitted = false;
+	// the blocks of a file-backed arena would touch a few rows of every node on the dirty path,
+	// the nodes are read faster one after the other
+	if (clFileName.empty() == false && cacheBlockPatterns < 0)
+		cacheBlockPatterns = 0;
+	if (cacheBlockPatterns > 0 && cacheBlockPatterns % PATTERN_SLICE_GRAIN != 0)
+		cacheBlockPatterns += PATTERN_SLICE_GRAIN - cacheBlockPatterns % PATTERN_SLICE_GRAIN;
+	long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	l2CacheBytes = (l2 > 0 ? (size_t)l2 : 256 * 1024);
+	if (cacheBlockPatterns < 0)
+		cout << "Cache blocking: from the L2 cache size (" << l2CacheBytes / 1024 << " KB)" << endl;
+	else if (cacheBlockPatterns > 0)
+		cout << "Cache blocking: " << cacheBlockPatterns << " patterns per block" << endl;
+	if (useTaskGraph == true)
+		cout << "Likelihood traversal: task graph of the nodes and chunks of patterns" << endl;
+	if (useOutside == true)
+		cout << "Outside partials: kept for the node age and node rate moves" << endl;
+	// -adapt tries the calling thread alone, and pattern slices and tasks on 2, 4, 8 ... threads
+	// up to the cap
+	adaptiveThreads = (runUnderPrior == true ? -1 : adapt);
+	if (adaptiveThreads >= 0)
+		{
+		int maxThreads = ModelArena::getMaxThreads();
+		int cap = (adaptiveThreads > 0 && adaptiveThreads < maxThreads ? adaptiveThreads : maxThreads);
+		KernelSchedule one = { 1, false, true };
+		scheduleChoices.push_back(one);
+		for (int nt=2; nt<2*cap; nt*=2)
+			{
+			int n = min(nt, cap);
+			KernelSchedule slices = { n, false, true };
+			scheduleChoices.push_back(slices);
+			if (useSiteRepeats == false)
+				{
+				KernelSchedule tasks = { n, true, true };
+				scheduleChoices.push_back(tasks);
+				}
+			}
+		cout << "Parallel schedule: adaptive, up to " << cap << " threads, " << scheduleChoices.size()
+		     << " candidate schedules" << endl;
+		}
+	maxPrecisionDiff = 0.0;
+	numPrecisionChecks = 0;
+	if (vout == true && useOutside == false)
+		{
+		cerr << "ERROR: The check of the candidate tables (-vout) needs the outside partials (-outside)" << endl;
+		exit(1);
+		}
+	validateOutside = (vout == true && runUnderPrior == false);
+	maxOutsideDiff = 0.0;
+	numOutsideChecks = 0;
+	const KernelSet *ks = selectLikelihoodKernels(kern, numGammaCats);
+	if (numStates == AA_STATES)
+		kernels = ks->aminoAcid;
+	else
+		kernels = (soa == true ? ks->interleaved : ks->patternMajor);
+	singleKernels = ks->single;
+	mixedKernels = ks->mixed;
+	if (clPrecision == CL_SINGLE)
+		cout << "Likelihood kernels: " << ks->name << "-" << singleKernels->name << endl;
+	else if (clPrecision == CL_MIXED)
+		cout << "Likelihood kernels: " << ks->name << "-" << mixedKernels->name << endl;
+	else
+		cout << "Likelihood kernels: " << kernels->name << endl;
+	// the interleaved kernels work on whole blocks of patterns, so every partition starts a new
+	// block and the padding patterns get weight 0
+	partBegin.assign(1, 0);
+	patternOfRow.clear();
+	for (int q=0; q<numPartitions; q++)
+		{
+		int first = alignmentPtr->getFirstPatternOfPartition(q);
+		int last = alignmentPtr->getFirstPatternOfPartition(q + 1);
+		for (int c=first; c<last; c++)
+			patternOfRow.push_back(c);
+		while (patternOfRow.size() % kernels->patternBlock != 0)
+			patternOfRow.push_back(-1);
+		partBegin.push_back((int)patternOfRow.size());
+		}
+	numPaddedPatterns = partBegin[numPartitions];
+	patternWeights = new int[numPaddedPatterns];
+	for (int i=0; i<numPaddedPatterns; i++)
+		patternWeights[i] = (patternOfRow[i] >= 0 ? alignmentPtr->getNumSitesOfPattern(patternOfRow[i]) : 0);
+	partClDirty.assign(numPartitions, false);
+	partTiDirty.assign(numPartitions, false);
+	siteLnLOut = NULL;
+	if (numPartitions > 1)
+		cout << "Partitions: " << numPartitions << ", each with its own base frequencies, exchangeabilities and gamma shape" << endl;
 	
 	cpfix = false;
 	if(turnedOffMove == 5)
@@ -124,8 +278,9 @@ Model::Model(MbRandom *rp, Alignment *ap, string ts, double pm, double ra, doubl
 	ExpCalib *excal = new ExpCalib(ranPtr, this, dphpc, dphpng, initRootH, gamhp, runIndCalHP);
 	NodeRate *nr = new NodeRate(ranPtr, this, nn, ra, rb, conp->getCurrentCP(), fxclkrt, rmod);
 	for (int i=0; i<2; i++){ 
-		parms[i].push_back( new Basefreq(ranPtr, this, 4, fxmod) );					// base frequency parameter
-		parms[i].push_back( new Exchangeability(ranPtr, this) );				// rate parameters of the GTR model
+		parms[i].push_back( new Basefreq(ranPtr, this, numStates, fxmod) );			// base frequency parameter
+		parms[i].push_back( new Exchangeability(ranPtr, this, numStates, 
+												numStates != 4 || rmfn.empty() == false, rmfn) );	// rate parameters of the GTR model
 		parms[i].push_back( new Shape(ranPtr, this, numGammaCats, 2.0, fxmod) );		// gamma shape parameter for rate variation across sites
 		parms[i].push_back( new Tree(ranPtr, this, alignmentPtr, ts, ubl, alnm, rndNo, 
 									 calibrs, initRootH, sfb, ehpc, excal, tipDates) );    // rooted phylogenetic tree
@@ -134,6 +289,19 @@ Model::Model(MbRandom *rp, Alignment *ap, string ts, double pm, double ra, doubl
 		parms[i].push_back( new Treescale(ranPtr, this, initRootH, rHtY, rHtO, tsPrDist, rtCalib, ehpc) ); // the tree scale prior
 		parms[i].push_back( new Speciation(ranPtr, this, bdr, bda, bds, initRootH) );												// hyper prior on diversification for cBDP speciation
 		parms[i].push_back( excal );											// hyper prior exponential node calibration parameters
+		if (useInvariantSites == true)
+			parms[i].push_back( new Pinvar(ranPtr, this, 0.1, fxmod) );			// proportion of invariant sites
+		// the substitution parameters of the other partitions (-part) follow the shared ones
+		for (int q=1; q<numPartitions; q++){
+			parms[i].push_back( new Basefreq(ranPtr, this, numStates, fxmod) );
+			parms[i].push_back( new Exchangeability(ranPtr, this, numStates, 
+													numStates != 4 || rmfn.empty() == false, rmfn) );
+			parms[i].push_back( new Shape(ranPtr, this, numGammaCats, 2.0, fxmod) );
+			if (useInvariantSites == true)
+				parms[i].push_back( new Pinvar(ranPtr, this, 0.1, fxmod) );
+			for (unsigned j=parms[i].size()-(useInvariantSites == true ? 4 : 3); j<parms[i].size(); j++)
+				parms[i][j]->setPartition(q);
+		}
 	}
 	numParms = (int)parms[0].size();
 	activeParm = 0;
@@ -149,39 +317,85 @@ Model::Model(MbRandom *rp, Alignment *ap, string ts, double pm, double ra, doubl
 	if(ehpc)
 		excal->getAllExpHPCalibratedNodes();
 		
-	// allocate and initialize conditional likelihoods
-	initializeConditionalLikelihoods();
+	// under the prior (-rnp) the likelihood is 0 and nothing reads the tip states, conditional
+	// likelihoods or P-matrices, so neither they nor the rate matrices are set up
+	arena = NULL;
+	tipCodes = NULL;
+	tipStates = NULL;
+	clPtr = NULL;
+	scPtr = NULL;
+	clPtrSP = NULL;
+	scPtrSP = NULL;
+	tis = NULL;
+	identityTis = NULL;
+	rateTis = NULL;
+	if (runUnderPrior == true)
+		{
+		cout << "Running under the prior: no conditional likelihoods or transition probabilities allocated" << endl;
+		myCurLnL = lnLikelihood();
+		cout << "lnL = " << myCurLnL << endl;
+		updateAccepted();
+		return;
+		}
+
+	// initialize the tip states and find the site patterns that repeat within the subtrees
+	initializeTipStates();
+	if (useSiteRepeats == true)
+		initializeSiteRepeats();
 	
-	// allocate the transition probability matrices
-	initializeTransitionProbabilityMatrices();
+	// allocate the conditional likelihoods and transition probability matrices, on the NUMA
+	// nodes of the threads that compute them
+	if (pin == true)
+		ModelArena::pinThreads();
+	initializeArena(hugep);
+	if (useInvariantSites == true)
+		initializeInvariantSites();
 	
-	// instantiate the transition probability calculator
-	tiCalculator = new MbTransitionMatrix( getActiveExchangeability()->getRate(), getActiveBasefreq()->getFreq(), true );
+	// instantiate the transition probability calculators of the partitions
+	for (int q=0; q<numPartitions; q++)
+		tiCalculators.push_back( new MbTransitionMatrix( getActiveExchangeability(q)->getRate(), getActiveBasefreq(q)->getFreq(), true ) );
 	
 	setTiProb();
 	myCurLnL = lnLikelihood();
 	cout << "lnL = " << myCurLnL << endl;
+	// both copies of the parameters start from the evaluated state and its slots
+	updateAccepted();
 	
 
 }
 
 Model::~Model(void) {
 
-	delete [] cls;
-	delete tiCalculator;
-	for (int i=0; i<2; i++){
-		delete [] clPtr[i];
-		delete [] tis[i][0];
-		delete [] tis[i];
-	}
+	delete arena;
+	delete [] tipCodes;
+	delete [] tipStates;
+	delete [] patternWeights;
+	for (unsigned q=0; q<tiCalculators.size(); q++)
+		delete tiCalculators[q];
+	delete [] clPtr;
+	delete [] scPtr;
+	delete [] clPtrSP;
+	delete [] scPtrSP;
+	if (tis != NULL)
+		delete [] tis[0];
+	delete [] tis;
+	delete [] identityTis;
+	delete [] rateTis;
 }
 
 Basefreq* Model::getActiveBasefreq(void) {
 
+	return getActiveBasefreq(0);
+}
+
+/* The substitution parameters of partition part (-part), those of the other partitions follow
+ * the shared ones in parms. */
+Basefreq* Model::getActiveBasefreq(int part) {
+
 	for (int i=0; i<numParms; i++){
 		Parameter *p = parms[activeParm][i];
 		Basefreq *derivedPtr = dynamic_cast<Basefreq *>(p);
-		if ( derivedPtr != 0 )
+		if ( derivedPtr != 0 && p->getPartition() == part )
 			return derivedPtr;
 	}
 	return NULL;
@@ -212,10 +426,15 @@ Treescale* Model::getActiveTreeScale(void) {
 
 Exchangeability* Model::getActiveExchangeability(void) {
 
+	return getActiveExchangeability(0);
+}
+
+Exchangeability* Model::getActiveExchangeability(int part) {
+
 	for (int i=0; i<numParms; i++){
 		Parameter *p = parms[activeParm][i];
 		Exchangeability *derivedPtr = dynamic_cast<Exchangeability *>(p);
-		if ( derivedPtr != 0 )
+		if ( derivedPtr != 0 && p->getPartition() == part )
 			return derivedPtr;
 	}
 	return NULL;
@@ -223,10 +442,15 @@ Exchangeability* Model::getActiveExchangeability(void) {
 
 Shape* Model::getActiveShape(void) {
 
+	return getActiveShape(0);
+}
+
+Shape* Model::getActiveShape(int part) {
+
 	for (int i=0; i<numParms; i++){
 		Parameter *p = parms[activeParm][i];
 		Shape *derivedPtr = dynamic_cast<Shape *>(p);
-		if ( derivedPtr != 0 )
+		if ( derivedPtr != 0 && p->getPartition() == part )
 			return derivedPtr;
 	}
 	return NULL;
@@ -265,6 +489,22 @@ Cphyperp* Model::getActiveCphyperp(void) {
 	return NULL;
 }
 
+Pinvar* Model::getActivePinvar(void) {
+
+	return getActivePinvar(0);
+}
+
+Pinvar* Model::getActivePinvar(int part) {
+
+	for (int i=0; i<numParms; i++){
+		Parameter *p = parms[activeParm][i];
+		Pinvar *derivedPtr = dynamic_cast<Pinvar *>(p);
+		if ( derivedPtr != 0 && p->getPartition() == part )
+			return derivedPtr;
+	}
+	return NULL;
+}
+
 ExpCalib* Model::getActiveExpCalib(void) {
 	
 	for (int i=0; i<numParms; i++){
@@ -277,63 +517,474 @@ ExpCalib* Model::getActiveExpCalib(void) {
 }
 
 
-void Model::initializeConditionalLikelihoods(void) {
+void Model::initializeTipStates(void) {
 
-	// allocate conditional likelihoods
-	int nNodes = 2*alignmentPtr->getNumTaxa()-1;
-	int nChar  = alignmentPtr->getNumChar();
-	int sizeOneNode = nChar * numGammaCats * 4;
-	int sizeOneSpace = nNodes * sizeOneNode;
-	cls = new double[2 * sizeOneSpace];
-	for (int i=0; i<2*sizeOneSpace; i++)
-		cls[i] = 0.0;
-	for (int i=0; i<2; i++)
+	// initialize the tip states, one tip code per pattern. For nucleotides the code is the
+	// nucleotide code (see Alignment::getPossibleNucs), other data types number the bit patterns
+	// of the states that occur in the alignment
+	int nTaxa = alignmentPtr->getNumTaxa();
+	int nChar = numPaddedPatterns;
+	int allStates = alignmentPtr->getAllStates();
+	tipCodeStates.clear();
+	if (numStates == 4)
 		{
-		clPtr[i] = new double*[nNodes];
-		for (int j=0; j<nNodes; j++)
-			clPtr[i][j] = &cls[ i * sizeOneSpace + j * sizeOneNode ];
+		for (int s=0; s<16; s++)
+			tipCodeStates.push_back(s);
 		}
-		
-	// initialize the tip conditional likelihoods
-	for (int i=0; i<alignmentPtr->getNumTaxa(); i++)
+	tipCodes = new unsigned char[nTaxa * nChar];
+	tipStates = new unsigned char*[nTaxa];
+	for (int i=0; i<nTaxa; i++)
 		{
-		double *cl0 = clPtr[0][i];
-		double *cl1 = clPtr[1][i];
-		for (int j=0; j<alignmentPtr->getNumChar(); j++)
+		tipStates[i] = &tipCodes[i * nChar];
+		for (int j=0; j<nChar; j++)
 			{
-			int nucCode = alignmentPtr->getNucleotide(i, j);
-			int possibleNucs[4];
-			alignmentPtr->getPossibleNucs(nucCode, possibleNucs);
-			for (int k=0; k<numGammaCats; k++)
+			int code = (patternOfRow[j] >= 0 ? alignmentPtr->getNucleotide(i, patternOfRow[j]) : allStates);
+			if (code < 1 || code > allStates)
+				code = allStates;
+			if (numStates == 4)
+				{
+				tipStates[i][j] = (unsigned char)code;
+				continue;
+				}
+			unsigned s = 0;
+			while (s < tipCodeStates.size() && tipCodeStates[s] != code)
+				s++;
+			if (s == tipCodeStates.size())
+				tipCodeStates.push_back(code);
+			if (s > 255)
+				{
+				cerr << "ERROR: More than 256 different ambiguous states in the alignment" << endl;
+				exit(1);
+				}
+			tipStates[i][j] = (unsigned char)s;
+			}
+		}
+
+	// the P-matrices (or tip lookup tables) of the branches updated in one likelihood evaluation
+	// are copied to tiBuf in the layout of the kernels, padded to whole category groups
+	if (numStates == 4)
+		{
+		tipTableSize = 64;
+		tiMatrixSize = 16;
+		}
+	else
+		{
+		tipTableSize = (int)tipCodeStates.size() * PADDED_STATES(numStates);
+		tiMatrixSize = numStates * PADDED_STATES(numStates);
+		}
+}
+
+/* Reserve one buffer of conditional likelihoods and scaler counts of nChar rows, in double
+ * and/or float, the threads write the first sliceRows rows first. */
+static void reserveClBuffer(ModelArena *arena, int nChar, int sliceRows, size_t rowValues, bool useDouble, bool useFloat,
+                            size_t *cl, size_t *sc, size_t *clSP, size_t *scSP) {
+
+	if (useDouble == true)
+		{
+		*cl = arena->reserveRows(nChar, rowValues * sizeof(double), sliceRows);
+		*sc = arena->reserveRows(nChar, sizeof(int), sliceRows);
+		}
+	if (useFloat == true)
+		{
+		*clSP = arena->reserveRows(nChar, rowValues * sizeof(float), sliceRows);
+		*scSP = arena->reserveRows(nChar, sizeof(int), sliceRows);
+		}
+}
+
+/* Choose the internal nodes that keep their conditional likelihoods within the memory cap of
+ * -clmem, the arena needs fixedBytes besides them and every buffer takes bufferBytes: one for
+ * every stored node and the scratch slots of the pool (at most one per stored node). The other
+ * nodes are recomputed whenever their parent is updated, so the nodes with the smallest
+ * subtrees, whose parents are updated the least often, are dropped first; the root is always
+ * kept. A recomputed node only lives from its own update to that of its parent, so the nodes
+ * share scratch buffers: in the post order of the updates a node takes a free slot and gives the
+ * slots of its children back, and as the topology is fixed this assignment holds for every
+ * subset of the updates. Returns the number of these buffers. */
+int Model::planRecomputation(size_t bufferBytes, size_t fixedBytes, vector<int> &slot) {
+
+	Tree *t = getActiveTree();
+	int nNodes = t->getNumNodes();
+	isClStored.assign(nNodes, true);
+	slot.assign(nNodes, -1);
+	int numInternal = nNodes - t->getNumTaxa();
+	if (clMemoryCap <= 0.0)
+		{
+		numClScratch = min(numClScratch, numInternal);
+		return 0;
+		}
+
+	// the internal nodes below the root, by decreasing number of tips
+	vector<int> tips(nNodes, 1);
+	vector<pair<int, int> > order;
+	for (int n=0; n<nNodes; n++)
+		{
+		Node *p = t->getDownPassNode(n);
+		if (p->getLft() == NULL || p->getRht() == NULL)
+			continue;
+		tips[p->getIdx()] = tips[p->getLft()->getIdx()] + tips[p->getRht()->getIdx()];
+		if (p != t->getRoot())
+			order.push_back(make_pair(-tips[p->getIdx()], p->getIdx()));
+		}
+	sort(order.begin(), order.end());
+
+	size_t cap = (size_t)(clMemoryCap * 1048576.0);
+	int numStored = (int)order.size();
+	if (cap < fixedBytes + 2 * bufferBytes)
+		numStored = 0;
+	else if ((cap - fixedBytes) / bufferBytes - 2 < (size_t)numStored)
+		numStored = (int)((cap - fixedBytes) / bufferBytes) - 2;
+	size_t needBytes = 0;
+	for (; numStored>=0; numStored--)
+		{
+		for (unsigned i=0; i<order.size(); i++)
+			isClStored[order[i].second] = ((int)i < numStored);
+		vector<int> freeSlots;
+		int numSlots = 0;
+		for (int n=0; n<nNodes; n++)
+			{
+			Node *p = t->getDownPassNode(n);
+			if (p->getLft() == NULL || p->getRht() == NULL)
+				continue;
+			if (isClStored[p->getIdx()] == false)
 				{
-				for (int s=0; s<4; s++)
+				if (freeSlots.empty() == true)
+					slot[p->getIdx()] = numSlots++;
+				else
 					{
-					cl0[s] = (double)possibleNucs[s];
-					cl1[s] = (double)possibleNucs[s];
+					slot[p->getIdx()] = freeSlots.back();
+					freeSlots.pop_back();
 					}
-				cl0 += 4;
-				cl1 += 4;
 				}
+			Node *ch[2] = { p->getLft(), p->getRht() };
+			for (int c=0; c<2; c++)
+				if (isClStored[ch[c]->getIdx()] == false)
+					freeSlots.push_back(slot[ch[c]->getIdx()]);
+			}
+		int numScratch = min(numClScratch, numStored + 1);
+		needBytes = fixedBytes + (numStored + 1 + numScratch + numSlots) * bufferBytes;
+		if (needBytes <= cap)
+			{
+			numClScratch = numScratch;
+			cout << "Conditional likelihoods: kept at " << numStored + 1 << " of " << order.size() + 1
+			     << " internal nodes, the others are recomputed in " << numSlots << " scratch buffers" << endl;
+			return numSlots;
 			}
 		}
+	cerr << "ERROR: The likelihood arena does not fit in " << clMemoryCap << " MB (-clmem), it needs at least "
+	     << needBytes / 1048576.0 << " MB" << endl;
+	exit(1);
 }
 
-void Model::initializeTransitionProbabilityMatrices(void) {
+/* All conditional likelihoods, scaler counts and transition probabilities live in one arena.
+ * They are kept in pools of slots: every internal node that stores its conditional likelihoods
+ * and every branch owns the slot of its committed state, and a proposal borrows scratch slots
+ * for the nodes it updates (see takeSlot). The committed slots are laid out node by node, the
+ * conditional likelihoods and scalers of an internal node, in the precisions in use, followed
+ * by the P-matrices of the branch below it. The scratch slots, the buffers of the recomputed
+ * nodes, those of the outside partials (-outside) and the buffer for the P-matrices in the
+ * layout of the kernels come last. The tips are
+ * stored as tip codes (see initializeTipStates). With partitions (-part) every partition has
+ * its own rows of the conditional likelihood buffers, so the partitions share the buffers but
+ * take their slots on their own, and its own pool of P-matrices. */
+void Model::initializeArena(bool hugePages) {
+
+	int nTaxa  = alignmentPtr->getNumTaxa();
+	int nNodes = 2*nTaxa-1;
+	int nChar  = numPaddedPatterns;
+	// the double conditional likelihoods are also needed to validate the float ones
+	bool useDouble = (clPrecision == CL_DOUBLE || validatePrecision == true);
+	bool useFloat = (clPrecision != CL_DOUBLE);
+	size_t clRowValues = (size_t)numGammaCats * numStates;
+	size_t tiValues = (size_t)numGammaCats * numStates * numStates;
+	size_t tiBufValues = ((size_t)nTaxa * tipTableSize + (size_t)(nTaxa - 1) * tiMatrixSize) * numPaddedCats * numPartitions;
+	// an update of the outside partials reads a child and a branch with outside partials
+	if (useOutside == true)
+		tiBufValues += (size_t)(nNodes + RATE_BUFFERS) * (tipTableSize + tiMatrixSize) * numPaddedCats * numPartitions;
+	Tree *t = getActiveTree();
 
-	int nNodes = 2*alignmentPtr->getNumTaxa()-1;
-	for (int i=0; i<2; i++)
+	// by default the scratch slots suffice for a move of a node age, which updates the two
+	// children of the node and the path to the root; a rejected move of the whole tree (shape,
+	// base frequencies) then recomputes all nodes (see updateRejected)
+	if (numClScratch < 0)
+		{
+		vector<int> height(nNodes, 0);
+		numClScratch = 0;
+		for (int n=nNodes-1; n>=0; n--)
+			{
+			Node *p = t->getDownPassNode(n);
+			if (p->getLft() == NULL || p->getRht() == NULL)
+				continue;
+			height[p->getIdx()] = (p->getAnc() == NULL ? 1 : height[p->getAnc()->getIdx()] + 1);
+			numClScratch = max(numClScratch, height[p->getIdx()] + 2);
+			}
+		}
+
+	arena = new ModelArena;
+	arena->setPartitions(partBegin);
+	size_t bufferBytes = 0;
+	if (useDouble == true)
+		bufferBytes += ModelArena::blockBytes(nChar * clRowValues * sizeof(double)) + ModelArena::blockBytes(nChar * sizeof(int));
+	if (useFloat == true)
+		bufferBytes += ModelArena::blockBytes(nChar * clRowValues * sizeof(float)) + ModelArena::blockBytes(nChar * sizeof(int));
+	size_t fixedBytes = 2 * nNodes * numPartitions * ModelArena::blockBytes(tiValues * sizeof(double)) + ModelArena::blockBytes(tiBufValues * sizeof(double));
+	vector<int> recompSlot;
+	int numRecompSlots = planRecomputation(bufferBytes, fixedBytes, recompSlot);
+
+	// the committed slots in post order, the order in which the traversal reads them
+	vector<int> clSlot(nNodes, -1);
+	int numStoredSlots = 0;
+	for (int i=0; i<nNodes; i++)
+		{
+		int n = t->getDownPassNode(i)->getIdx();
+		if (n >= nTaxa && isClStored[n] == true)
+			clSlot[n] = numStoredSlots++;
+		}
+	numClSlots = numStoredSlots + numClScratch;
+	numTiSlots = 2 * nNodes;
+	int numBuffers = numClSlots + numRecompSlots;
+	// the outside partials of every node (the result of lnLikelihoodAt for the root), the ones,
+	// and the results of lnLikelihoodsAt
+	outsideBase = numBuffers;
+	if (useOutside == true)
+		{
+		numBuffers += nNodes + 1 + RATE_BUFFERS;
+		outsideValid.assign(numPartitions * nNodes, false);
+		}
+	vector<size_t> clOffset(numBuffers, 0), scOffset(numBuffers, 0), clOffsetSP(numBuffers, 0), scOffsetSP(numBuffers, 0);
+	vector<size_t> tiOffset(numTiSlots * numPartitions, 0);
+	for (int i=0; i<nNodes; i++)
+		{
+		int n = t->getDownPassNode(i)->getIdx();
+		// the threads compute the rows of the site repeats of a node with -srep
+		int rows = (useSiteRepeats == true && n >= nTaxa ? siteRepRows[n] : nChar);
+		int s = clSlot[n];
+		if (s >= 0)
+			reserveClBuffer(arena, nChar, rows, clRowValues, useDouble, useFloat, &clOffset[s], &scOffset[s], &clOffsetSP[s], &scOffsetSP[s]);
+		for (int q=0; q<numPartitions; q++)
+			tiOffset[q * numTiSlots + n] = arena->reserve(tiValues * sizeof(double));
+		}
+	for (int s=numStoredSlots; s<numBuffers; s++)
+		reserveClBuffer(arena, nChar, nChar, clRowValues, useDouble, useFloat, &clOffset[s], &scOffset[s], &clOffsetSP[s], &scOffsetSP[s]);
+	for (int q=0; q<numPartitions; q++)
+		for (int s=nNodes; s<numTiSlots; s++)
+			tiOffset[q * numTiSlots + s] = arena->reserve(tiValues * sizeof(double));
+	size_t clBytes = numBuffers * nChar * clRowValues * ((useDouble == true ? sizeof(double) : 0) + (useFloat == true ? sizeof(float) : 0));
+	size_t scBytes = numBuffers * nChar * sizeof(int) * ((useDouble == true ? 1 : 0) + (useFloat == true ? 1 : 0));
+	size_t tiBytes = numTiSlots * numPartitions * tiValues * sizeof(double);
+	size_t tiBufOffset = arena->reserve(tiBufValues * sizeof(double));
+	tiBytes += tiBufValues * sizeof(double);
+	size_t identityOffset = 0, rateTiOffset = 0;
+	if (useOutside == true)
+		{
+		identityOffset = arena->reserve(tiValues * sizeof(double));
+		rateTiOffset = arena->reserve(RATE_BUFFERS * numPartitions * tiValues * sizeof(double));
+		tiBytes += (1 + RATE_BUFFERS * numPartitions) * tiValues * sizeof(double);
+		}
+	arena->allocate(hugePages, clFileName);
+
+	clPtr = NULL;
+	scPtr = NULL;
+	clPtrSP = NULL;
+	scPtrSP = NULL;
+	if (useDouble == true)
+		{
+		clPtr = new double*[numBuffers];
+		scPtr = new int*[numBuffers];
+		for (int s=0; s<numBuffers; s++)
+			{
+			clPtr[s] = (double *)arena->getBlock(clOffset[s]);
+			scPtr[s] = (int *)arena->getBlock(scOffset[s]);
+			}
+		}
+	if (useFloat == true)
 		{
-		tis[i] = new MbMatrix<double>*[nNodes];
-		tis[i][0] = new MbMatrix<double>[numGammaCats*nNodes];
-		for (int j=1; j<nNodes; j++)
-			tis[i][j] = tis[i][j-1] + numGammaCats;
+		clPtrSP = new float*[numBuffers];
+		scPtrSP = new int*[numBuffers];
+		for (int s=0; s<numBuffers; s++)
+			{
+			clPtrSP[s] = (float *)arena->getBlock(clOffsetSP[s]);
+			scPtrSP[s] = (int *)arena->getBlock(scOffsetSP[s]);
+			}
 		}
+
+	// the P-matrices of the gamma categories of a slot are views of the arena
+	int numTis = numTiSlots * numPartitions;
+	tis = new MbMatrix<double>*[numTis];
+	tis[0] = new MbMatrix<double>[numGammaCats*numTis];
+	for (int s=1; s<numTis; s++)
+		tis[s] = tis[s-1] + numGammaCats;
+	for (int s=0; s<numTis; s++)
+		{
+		double *ti = (double *)arena->getBlock(tiOffset[s]);
+		for (int k=0; k<numGammaCats; k++)
+			tis[s][k] = MbMatrix<double>(numStates, numStates, ti + k * numStates * numStates);
+		}
+	tiBuf = (double *)arena->getBlock(tiBufOffset);
+
+	identityTis = NULL;
+	rateTis = NULL;
+	if (useOutside == true)
+		{
+		int ones = outsideBase + nNodes;
+		for (size_t i=0; i<nChar*clRowValues; i++)
+			{
+			if (useDouble == true)
+				clPtr[ones][i] = 1.0;
+			if (useFloat == true)
+				clPtrSP[ones][i] = 1.0f;
+			}
+		for (int i=0; i<nChar; i++)
+			{
+			if (useDouble == true)
+				scPtr[ones][i] = 0;
+			if (useFloat == true)
+				scPtrSP[ones][i] = 0;
+			}
+		double *ti = (double *)arena->getBlock(identityOffset);
+		identityTis = new MbMatrix<double>[numGammaCats];
+		for (int k=0; k<numGammaCats; k++)
+			{
+			identityTis[k] = MbMatrix<double>(numStates, numStates, ti + k * numStates * numStates);
+			for (int i=0; i<numStates; i++)
+				for (int j=0; j<numStates; j++)
+					identityTis[k][i][j] = (i == j ? 1.0 : 0.0);
+			}
+		double *rti = (double *)arena->getBlock(rateTiOffset);
+		rateTis = new MbMatrix<double>[RATE_BUFFERS * numPartitions * numGammaCats];
+		for (int k=0; k<RATE_BUFFERS*numPartitions*numGammaCats; k++)
+			rateTis[k] = MbMatrix<double>(numStates, numStates, rti + k * numStates * numStates);
+		}
+
+	// both copies of the tree start from the committed slots, the recomputed nodes always use
+	// their buffer
 	for (int i=0; i<2; i++)
-		for (int j=0; j<nNodes; j++)
-			for (int k=0; k<numGammaCats; k++)
-				tis[i][j][k] = MbMatrix<double>(4,4);
+		{
+		Tree *ti = (i == activeParm ? t : getCommittedTree());
+		for (int n=0; n<nNodes; n++)
+			{
+			Node *p = ti->getNodeByIndex(n);
+			p->setNumPartitions(numPartitions);
+			for (int q=0; q<numPartitions; q++)
+				{
+				p->setActiveCl(q, clSlot[n] >= 0 || n < nTaxa ? clSlot[n] : numClSlots + recompSlot[n]);
+				p->setActiveTi(q, q * numTiSlots + n);
+				}
+			}
+		}
+	freeClSlots.assign(numPartitions, vector<int>());
+	freeTiSlots.assign(numPartitions, vector<int>());
+	for (int q=0; q<numPartitions; q++)
+		{
+		for (int s=numClSlots-1; s>=numStoredSlots; s--)
+			freeClSlots[q].push_back(s);
+		for (int s=numTiSlots-1; s>=nNodes; s--)
+			freeTiSlots[q].push_back(q * numTiSlots + s);
+		}
+
+	cout << "Likelihood arena: " << arena->getSize() / 1048576.0 << " MB, " << ARENA_ALIGNMENT << "-byte aligned"
+	     << (arena->getUsesHugePages() == true ? ", huge pages" : "")
+	     << (arena->getIsInFile() == true ? ", in " + clFileName : "") << " (conditional likelihoods "
+	     << clBytes / 1048576.0 << " MB, scalers " << scBytes / 1048576.0 << " MB, transition probabilities "
+	     << tiBytes / 1048576.0 << " MB)" << endl;
+	cout << "Conditional likelihood pool: " << numStoredSlots << " committed and " << numClScratch
+	     << " scratch slots" << endl;
+	arena->printPlacement();
 }
 
+/* Two patterns are repeats at a node if they are identical at all tips below it. As the
+ * topology is fixed, the repeat classes are found once in post order: the class of a pattern
+ * at a node is given by the pair of the classes at its children (the tip code at a tip), and every class becomes one row of the conditional likelihoods of the node. The
+ * children are ordered as in Model::lnLikelihoodWith, a single tip child is the left one. */
+void Model::initializeSiteRepeats(void) {
+
+	Tree *t = getActiveTree();
+	int nNodes = t->getNumNodes();
+	int nChar = numPaddedPatterns;
+	vector<int> classes(nNodes * nChar);
+	siteRepRows.assign(nNodes, 0);
+	for (int s=0; s<2; s++)
+		{
+		siteRepIx[s].assign(nNodes, vector<int>());
+		siteRepStates[s].assign(nNodes, vector<unsigned char>());
+		}
+	long numRows = 0, numNodePatterns = 0;
+	for (int n=0; n<nNodes; n++)
+		{
+		Node *p = t->getDownPassNode(n);
+		int *cp = &classes[p->getIdx() * nChar];
+		if (p->getLft() == NULL || p->getRht() == NULL)
+			{
+			for (int c=0; c<nChar; c++)
+				cp[c] = tipStates[p->getIdx()][c];
+			continue;
+			}
+		Node *ch[2] = { p->getLft(), p->getRht() };
+		if (ch[0]->getIsLeaf() == false && ch[1]->getIsLeaf() == true)
+			{
+			ch[0] = p->getRht();
+			ch[1] = p->getLft();
+			}
+		const int *cl = &classes[ch[0]->getIdx() * nChar];
+		const int *cr = &classes[ch[1]->getIdx() * nChar];
+		long numRight = (ch[1]->getIsLeaf() == true ? (long)tipCodeStates.size() : siteRepRows[ch[1]->getIdx()]);
+		map<long, int> rowOf;
+		for (int c=0; c<nChar; c++)
+			{
+			long key = cl[c] * numRight + cr[c];
+			map<long, int>::iterator it = rowOf.find(key);
+			if (it != rowOf.end())
+				{
+				cp[c] = it->second;
+				continue;
+				}
+			int row = (int)rowOf.size();
+			rowOf.insert(make_pair(key, row));
+			cp[c] = row;
+			for (int s=0; s<2; s++)
+				{
+				int cc = (s == 0 ? cl[c] : cr[c]);
+				if (ch[s]->getIsLeaf() == true)
+					siteRepStates[s][p->getIdx()].push_back((unsigned char)cc);
+				else
+					siteRepIx[s][p->getIdx()].push_back(cc);
+				}
+			}
+		siteRepRows[p->getIdx()] = (int)rowOf.size();
+		numRows += rowOf.size();
+		numNodePatterns += nChar;
+		}
+
+	// the root reduction runs over the rows of the root with the weights of their patterns
+	int rootIdx = t->getRoot()->getIdx();
+	siteRepWeights.assign(siteRepRows[rootIdx], 0);
+	siteRepRootRows.assign(classes.begin() + rootIdx * nChar, classes.begin() + (rootIdx + 1) * nChar);
+	for (int c=0; c<nChar; c++)
+		siteRepWeights[siteRepRootRows[c]] += patternWeights[c];
+	cout << "Site repeats: " << numRows << " of " << numNodePatterns << " node patterns are unique ("
+	     << (100.0 * numRows) / numNodePatterns << "%)" << endl;
+}
+/* The invariant sites model needs the states in which every row of the root is constant, the
+ * rows are the site patterns or, with site repeats, the unique patterns at the root. */
+void Model::initializeInvariantSites(void) {
+
+	int numRows = numPaddedPatterns;
+	if (useSiteRepeats == true)
+		numRows = siteRepRows[getActiveTree()->getRoot()->getIdx()];
+	invStates.assign(numRows, 0);
+	invProbs.assign(numRows, 0.0);
+	int numConstant = 0, numSites = 0;
+	for (int c=0; c<numPaddedPatterns; c++)
+		{
+		if (patternOfRow[c] < 0)
+			continue;
+		int row = (useSiteRepeats == true ? siteRepRootRows[c] : c);
+		invStates[row] = alignmentPtr->getConstantStates(patternOfRow[c]);
+		if (invStates[row] != 0)
+			numConstant += patternWeights[c];
+		numSites += patternWeights[c];
+		}
+	cout << "Invariant sites: " << numConstant << " of " << numSites << " sites are constant" << endl;
+}
 
 Parameter* Model::pickParmToUpdate(void) {
 
@@ -354,20 +1005,16 @@ Parameter* Model::pickParmToUpdate(void) {
 
 void Model::printTis(std::ostream & o) const {
 
-	int nNodes = 2*alignmentPtr->getNumTaxa()-1;
-	for (int j=0; j<nNodes; j++)
+	for (int j=0; j<numTiSlots*numPartitions; j++)
 		{
-		o << "Node " << j << endl;
-		for (int a=0; a<4; a++)
+		o << "Slot " << j << endl;
+		for (int a=0; a<numStates; a++)
 			{
-			for (int i=0; i<2; i++)
+			for (int k=0; k<numGammaCats; k++)
 				{
-				for (int k=0; k<numGammaCats; k++)
+				for (int b=0; b<numStates; b++)
 					{
-					for (int b=0; b<4; b++)
-						{
-						o << fixed << setprecision(10) << tis[i][j][k][a][b] << " ";
-						}
+					o << fixed << setprecision(10) << tis[j][k][a][b] << " ";
 					}
 				}
 			o << '\n';
@@ -388,17 +1035,36 @@ double Model::safeExponentiation(double lnX) {
 
 void Model::setTiProb(void) {
 
+	setTiProbExcept(NULL);
+}
+
+/* setTiProb for all branches but that of skip, which stays dirty (see lnLikelihoodsAt). */
+void Model::setTiProbExcept(Node *skip) {
+
+	if (runUnderPrior == true)
+		return;
 	Tree *t     = getActiveTree();
-	Shape *s    = getActiveShape();
 	NodeRate *r = getActiveNodeRate();
+	vector<bool> changed(t->getNumNodes());
+	for (int q=0; q<numPartitions; q++)
+		{
+		Shape *s = getActiveShape(q);
+		for (int n=0; n<t->getNumNodes(); n++)
+			{
+			Node *p = t->getDownPassNode(n);
+			changed[p->getIdx()] = (p->getAnc() != NULL && p != skip && (p->getIsTiDirty() == true || partTiDirty[q] == true));
+			if (changed[p->getIdx()] == true)
+				setTiProb(p, q, s, r);
+			}
+		partTiDirty[q] = false;
+		if (useOutside == true)
+			invalidateOutside(q, changed);
+		}
 	for (int n=0; n<t->getNumNodes(); n++)
 		{
 		Node *p = t->getDownPassNode(n);
-		if (p->getAnc() != NULL && p->getIsTiDirty() == true) 
-			{
-			setTiProb(p, s, r);
+		if (p->getAnc() != NULL && p != skip)
 			p->setIsTiDirty(false);
-			}
 		}
 	// TAH root rate debug. This stuff below is stupid anyway
 #	if ASSIGN_ROOT
@@ -407,14 +1073,10 @@ void Model::setTiProb(void) {
 #	endif
 }
 
-void Model::setTiProb(Node *p, Shape *s, NodeRate *r) {
+void Model::setTiProb(Node *p, int part, Shape *s, NodeRate *r) {
 
-	int activeTi = p->getActiveTi();
-	int idx      = p->getIdx();
-	Treescale *ts     = getActiveTreeScale();
-	double sv = 1.0; //ts->getScaleValue();  // FIXPARM
-	if(estAbsRts) sv = ts->getScaleValue();
-	double branchProportion =  (p->getAnc()->getNodeDepth() - p->getNodeDepth()) * sv;
+	int activeTi = takeSlot(p, false, part);
+	double branchProportion = getBranchTime(p);
 	double rP = r->getRateForNodeIndexed(p->getIdx());
 #	if 0
 	double rA = r->getRateForNodeIndexed(p->getAnc()->getIdx());
@@ -430,29 +1092,24 @@ void Model::setTiProb(Node *p, Shape *s, NodeRate *r) {
 		exit(1);
 	}
 	
-#	if 0
-	for (int k=0; k<4; k++){
+	for (int k=0; k<numGammaCats; k++){
 		double rt = s->getRate(k);
-		tis[activeTi][idx][k] = tiCalculator->tiProbs( v*rt, tis[activeTi][idx][k] );
+		tis[activeTi][k] = tiCalculators[part]->tiProbs( v*rt, tis[activeTi][k] );
 	}
-#	else
-	double rt = s->getRate(0);
-	tis[activeTi][idx][0] = tiCalculator->tiProbs( v*rt, tis[activeTi][idx][0] );
-	
-	rt = s->getRate(1);
-	tis[activeTi][idx][1] = tiCalculator->tiProbs( v*rt, tis[activeTi][idx][1] );
-	
-	rt = s->getRate(2);
-	tis[activeTi][idx][2] = tiCalculator->tiProbs( v*rt, tis[activeTi][idx][2] );
-	
-	rt = s->getRate(3);
-	tis[activeTi][idx][3] = tiCalculator->tiProbs( v*rt, tis[activeTi][idx][3] );
-#	endif
 	// set node info for printing
 	//p->setBranchTime(branchProportion);
 	//p->setRtGrpVal(rP);
 }
 
+// the length of the branch of p in time, the node rate is not applied
+double Model::getBranchTime(Node *p) {
+
+	Treescale *ts     = getActiveTreeScale();
+	double sv = 1.0; //ts->getScaleValue();  // FIXPARM
+	if(estAbsRts) sv = ts->getScaleValue();
+	return (p->getAnc()->getNodeDepth() - p->getNodeDepth()) * sv;
+}
+
 void Model::setNodeRateGrpIndxs(void) {
 	
 	Tree *t     = getActiveTree();
@@ -484,6 +1141,7 @@ void Model::updateAccepted(void) {
 		to = 0;
 	for (int i=0; i<numParms; i++)
 		*parms[to][i] = *parms[from][i];
+	overwroteCommitted = false;
 }
 
 void Model::updateRejected(void) {
@@ -495,13 +1153,117 @@ void Model::updateRejected(void) {
 		from = 0;
 	for (int i=0; i<numParms; i++)
 		*parms[to][i] = *parms[from][i];
+	// the outside partials are kept for the active state only
+	outsideValid.assign(outsideValid.size(), false);
+	// the pool ran out during the proposal and some committed slots hold its values now
+	if (overwroteCommitted == true)
+		{
+		for (int i=0; i<2; i++)
+			{
+			Tree *t = (i == activeParm ? getActiveTree() : getCommittedTree());
+			t->upDateAllCls();
+			t->upDateAllTis();
+			}
+		overwroteCommitted = false;
+		}
+}
+
+Tree* Model::getCommittedTree(void) {
+
+	for (int i=0; i<numParms; i++){
+		Tree *derivedPtr = dynamic_cast<Tree *>(parms[activeParm == 0 ? 1 : 0][i]);
+		if ( derivedPtr != 0 )
+			return derivedPtr;
+	}
+	return NULL;
+}
 
+/* The slot that node p of the active tree writes its conditional likelihoods (isCl true) or
+ * P-matrices of partition part to. The committed copy of the tree, the state of the last accepted proposal,
+ * keeps its slots untouched: the first write of a proposal to a node takes a free slot, and the
+ * node keeps it for the rest of the proposal. Accepting or rejecting the proposal copies the
+ * slot indices with the tree (Tree::clone), the slots only the other copy refers to become free
+ * again (see collectSlots). If the pool has run out the node overwrites its committed slot, and
+ * a rejection then recomputes everything. */
+int Model::takeSlot(Node *p, bool isCl, int part) {
+
+	int s = (isCl == true ? p->getActiveCl(part) : p->getActiveTi(part));
+	Node *q = getCommittedTree()->getNodeByIndex(p->getIdx());
+	if (s != (isCl == true ? q->getActiveCl(part) : q->getActiveTi(part)))
+		return s;
+	vector<int> &freeSlots = (isCl == true ? freeClSlots[part] : freeTiSlots[part]);
+	if (freeSlots.empty() == true)
+		collectSlots(isCl, part);
+	if (freeSlots.empty() == true)
+		{
+		overwroteCommitted = true;
+		return s;
+		}
+	s = freeSlots.back();
+	freeSlots.pop_back();
+	if (isCl == true)
+		p->setActiveCl(part, s);
+	else
+		p->setActiveTi(part, s);
+	return s;
+}
+
+/* Refill the free list of partition part with the slots of the pool that neither copy of the
+ * tree refers to, the lowest ones are taken first. The P-matrix slots of the partition are
+ * numbered from part * numTiSlots. */
+void Model::collectSlots(bool isCl, int part) {
+
+	int numSlots = (isCl == true ? numClSlots : numTiSlots);
+	int first = (isCl == true ? 0 : part * numTiSlots);
+	vector<bool> used(numSlots, false);
+	Tree *t[2] = { getActiveTree(), getCommittedTree() };
+	for (int i=0; i<2; i++)
+		{
+		for (int n=0; n<t[i]->getNumNodes(); n++)
+			{
+			Node *p = t[i]->getNodeByIndex(n);
+			int s = (isCl == true ? p->getActiveCl(part) : p->getActiveTi(part)) - first;
+			if (s >= 0 && s < numSlots)
+				used[s] = true;
+			}
+		}
+	vector<int> &freeSlots = (isCl == true ? freeClSlots[part] : freeTiSlots[part]);
+	freeSlots.clear();
+	for (int s=numSlots-1; s>=0; s--)
+		if (used[s] == false)
+			freeSlots.push_back(first + s);
 }
 
 
 void Model::upDateRateMatrix(void) {
 
-	tiCalculator->updateQ( getActiveExchangeability()->getRate(), getActiveBasefreq()->getFreq() );
+	for (int q=0; q<numPartitions; q++)
+		upDateRateMatrix(q);
+}
+
+void Model::upDateRateMatrix(int part) {
+
+	if (runUnderPrior == true)
+		return;
+	tiCalculators[part]->updateQ( getActiveExchangeability(part)->getRate(), getActiveBasefreq(part)->getFreq() );
+}
+
+/* A substitution parameter of partition part changed: all its conditional likelihoods and
+ * P-matrices are recomputed, those of the other partitions are kept. */
+void Model::upDatePartition(int part) {
+
+	partClDirty[part] = true;
+	partTiDirty[part] = true;
+}
+
+string Model::getPartitionName(int part) {
+
+	return alignmentPtr->getPartitionName(part);
+}
+
+int Model::getNumSitesOfPattern(int i) {
+
+	return alignmentPtr->getNumSitesOfPattern(i);
 }
 
 void Model::writeUnifTreetoFile(void) {
@@ -679,11 +1441,12 @@ Calibration* Model::getRootCalibration(void) {
 
 void Model::setUpdateProbabilities(bool initial) {
 
-	double bfp, srp, shp, ntp, dpp, cpa, tsp, spp, ehp, fcp;
+	double bfp, srp, shp, ntp, dpp, cpa, tsp, spp, ehp, fcp, pip;
 	if(initial){
 		bfp = 0.3;
 		srp = 0.3;
 		shp = 0.3;
+		pip = 0.3;
 		ntp = 0.6;
 		dpp = 0.5;
 		cpa = 0.3;
@@ -696,6 +1459,7 @@ void Model::setUpdateProbabilities(bool initial) {
 		bfp = 0.2;
 		srp = 0.2;
 		shp = 0.2;
+		pip = 0.2;
 		ntp = 0.4;
 		dpp = 0.5;
 		cpa = 0.3;
@@ -739,9 +1503,12 @@ void Model::setUpdateProbabilities(bool initial) {
 		else
 			ehp = 0.4;
 	}
+	if(getActiveExchangeability()->getIsFixed())
+		srp = 0.0;
 	if(fixSomeModParams){
 		bfp = 0.0;
 		shp = 0.0;
+		pip = 0.0;
 	}
 	
 	if(treeTimePrior > 3) // might want to change this
@@ -764,6 +1531,11 @@ void Model::setUpdateProbabilities(bool initial) {
 		//ntp = 0.0;
 	}
 	
+	// the moves of the substitution parameters are shared out among the partitions
+	bfp /= numPartitions;
+	srp /= numPartitions;
+	shp /= numPartitions;
+	pip /= numPartitions;
 	updateProb.clear();
 	updateProb.push_back(bfp); // 1 basefreq
 	updateProb.push_back(srp); // 2 sub rates
@@ -774,6 +1546,15 @@ void Model::setUpdateProbabilities(bool initial) {
 	updateProb.push_back(tsp); // 7 tree scale parameter
 	updateProb.push_back(spp); // 8 speciation parameters
 	updateProb.push_back(ehp); // 9 exponential calibration hyper priors
+	if(useInvariantSites)
+		updateProb.push_back(pip); // 10 proportion of invariant sites
+	for (int q=1; q<numPartitions; q++){
+		updateProb.push_back(bfp);
+		updateProb.push_back(srp);
+		updateProb.push_back(shp);
+		if(useInvariantSites)
+			updateProb.push_back(pip);
+	}
 	double sum = 0.0;
 	for (unsigned i=0; i<updateProb.size(); i++)
 		sum += updateProb[i];
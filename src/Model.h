@@ -30,10 +30,13 @@
 #ifndef MODEL_H
 #define MODEL_H
 #define ASSIGN_ROOT 0
+#define SCHEDULE_TRIALS 4	// runs of every candidate schedule before -adapt picks one
+#define RATE_BUFFERS 8		// rates of a branch evaluated together by Model::lnLikelihoodsAt
 
 #include <string>
 #include <vector>
 #include "MbMatrix.h"
+#include "Model_kernels.h"
 
 class Calibration;
 class Alignment;
@@ -41,8 +44,10 @@ class Basefreq;
 class Exchangeability;
 class MbRandom;
 class MbTransitionMatrix;
+class ModelArena;
 class Node;
 class NodeRate;
+class Pinvar;
 class Parameter;
 class Shape;
 class Speciation;
@@ -65,32 +70,51 @@ class Model {
 											  bool alnm, int offmv, bool rndNo, std::string clfn, int nodpr, 
 											  double bdr, double bda, double bds, double fxclkrt, bool roofix,
 											  bool sfb, bool ehpc, bool dphpc, int dphpng, bool gamhp, int rmod,
-											  bool fxmod, bool ihp, std::string tipdfn, bool fxtr); 
+											  bool fxmod, bool ihp, std::string tipdfn, bool fxtr, std::string kern, bool soa,
+											  std::string prec, bool vprec, int cblk, bool srep, int ncat, bool inv,
+											  std::string rmfn, bool hugep, bool pin, double clmem, std::string clfile, int clscr,
+											  bool ptask, bool outside, int adapt, bool rnp, bool vout); 
 										~Model(void);
 		double							lnLikelihood(void);
+		double							lnLikelihoodAt(Node *p);
+		void							lnLikelihoodsAt(Node *p, const std::vector<double> &rates, std::vector<double> &lnLs);
+		void							siteLnLikelihoods(std::vector<double> &lnLs);
+		int								getNumSitePatterns(void) { return numPatterns; }
+		int								getNumSitesOfPattern(int i);
+		bool							getUseOutsidePartials(void) { return useOutside; }
 		double							getPriorMeanV(void) { return priorMeanN; }
 		Basefreq*						getActiveBasefreq(void);
+		Basefreq*						getActiveBasefreq(int part);
 		Tree*							getActiveTree(void);
 		Treescale*						getActiveTreeScale(void);
 		Exchangeability*				getActiveExchangeability(void);
+		Exchangeability*				getActiveExchangeability(int part);
 		Shape*							getActiveShape(void);
+		Shape*							getActiveShape(int part);
 		NodeRate*						getActiveNodeRate(void);
 		Speciation*						getActiveSpeciation(void);
 		Cphyperp*						getActiveCphyperp(void);
 		ExpCalib*						getActiveExpCalib(void);
+		Pinvar*							getActivePinvar(void);
+		Pinvar*							getActivePinvar(int part);
+		bool							getUseInvariantSites(void) { return useInvariantSites; }
+		int								getNumPartitions(void) { return numPartitions; }
+		std::string						getPartitionName(int part);
 		Parameter*						pickParmToUpdate(void);
 		void							printTis(std::ostream &) const;
 		void							setTiProb(void);
-		void							setTiProb(Node *p, Shape *s, NodeRate *r);
+		void							setTiProb(Node *p, int part, Shape *s, NodeRate *r);
 		void							setNodeRateGrpIndxs(void);
 		void							upDateRateMatrix(void);
+		void							upDateRateMatrix(int part);
+		void							upDatePartition(int part);
 		void							updateAccepted(void);
 		void							updateRejected(void);
 		double							safeExponentiation(double lnX);
 		void							switchActiveParm(void) { (activeParm == 0 ? activeParm = 1 : activeParm = 0); }
 		seedType						getStartingSeed1() { return startS1; }
 		seedType						getStartingSeed2() { return startS2; }
-		void							setRunUnderPrior(bool b) { runUnderPrior = b; }
+		bool							getRunUnderPrior(void) { return runUnderPrior; }
 		void							writeUnifTreetoFile();
 		void							setLnLGood(bool b) { lnLGood = b; }
 		double							getMyCurrLnL(void);
@@ -103,25 +127,135 @@ class Model {
 		void							setEstAbsRates(bool b) { estAbsRts = b; }
 		void							setFixTestRun(bool b) { fixTestRun = b; }
 		bool							getFixTestRun(void) { return fixTestRun; }
+		void							printPrecisionCheck(void);
+		bool							getValidateOutside(void) { return validateOutside; }
+		void							checkOutside(double batchLnL, double lnL);
+		void							printOutsideCheck(void);
+		void							printScheduleChoice(void);
 		
 	private:
-		void							initializeConditionalLikelihoods(void);
-		void							initializeTransitionProbabilityMatrices(void);
+		void							initializeTipStates(void);
+		void							initializeArena(bool hugePages);
+		int								planRecomputation(size_t bufferBytes, size_t fixedBytes, std::vector<int> &slot);
+		Tree*							getCommittedTree(void);
+		int								takeSlot(Node *p, bool isCl, int part);
+		void							collectSlots(bool isCl, int part);
+		void							setClUpdates(void);
+		void							initializeSiteRepeats(void);
+		void							initializeInvariantSites(void);
 		double							readCalibFile();
+		void							setTiProbExcept(Node *skip);
+		double							getBranchTime(Node *p);
+		void							setRateTiProbs(Node *p, const double *rates, int num);
+		void							collectUpdatesAt(Node *p, std::vector<std::vector<std::pair<Node *, bool> > > &steps);
+		void							collectLowerUpdates(Node *p, int part, std::vector<std::pair<Node *, bool> > &steps, std::vector<bool> &done);
+		void							collectOutsideUpdates(Node *p, int part, std::vector<std::pair<Node *, bool> > &steps, std::vector<bool> &done);
+		void							invalidateOutside(int part, const std::vector<bool> &changed);
+		void							checkPrecision(double lnL, double refLnL);
+		int								getCacheBlock(size_t numOps, size_t clValueBytes);
+		template<typename ClReal, typename TiReal>
+		void							setOpBranch(const LikelihoodKernelsT<ClReal, TiReal> *k, KernelOpT<ClReal, TiReal> &o, bool isLeft,
+											const unsigned char *st, ClReal **cl, int **sc, int slot, MbMatrix<double> *t, TiReal *&buf);
+		template<typename ClReal, typename TiReal>
+		KernelOpT<ClReal, TiReal>		newNodeOp(const LikelihoodKernelsT<ClReal, TiReal> *k, Node *p, int q, ClReal **cl, int **sc, TiReal *&buf);
+		template<typename ClReal, typename TiReal>
+		void							setKernelPartition(KernelPartitionT<ClReal, TiReal> &pt, int q, const ClReal *clRoot, const int *scRoot,
+											std::vector<double> &freqs);
+		template<typename ClReal, typename TiReal>
+		void							addStepOps(const LikelihoodKernelsT<ClReal, TiReal> *k, const std::vector<std::pair<Node *, bool> > &steps,
+											int q, ClReal **cl, int **sc, TiReal *&buf, std::vector<KernelOpT<ClReal, TiReal> > &ops);
+		template<typename ClReal, typename TiReal>
+		KernelOpT<ClReal, TiReal>		newBranchOp(const LikelihoodKernelsT<ClReal, TiReal> *k, Node *p, int q, ClReal **cl, int **sc, int slot,
+											MbMatrix<double> *t, TiReal *&buf);
+		template<typename ClReal, typename TiReal>
+		double							evaluateOps(const LikelihoodKernelsT<ClReal, TiReal> *k, std::vector<KernelOpT<ClReal, TiReal> > &ops,
+											std::vector<KernelPartitionT<ClReal, TiReal> > &parts, double *partLnL = NULL);
+		template<typename ClReal, typename TiReal>
+		double							lnLikelihoodWith(const LikelihoodKernelsT<ClReal, TiReal> *k, ClReal **cl, int **sc, bool clearDirty);
+		template<typename ClReal, typename TiReal>
+		double							lnLikelihoodAtWith(const LikelihoodKernelsT<ClReal, TiReal> *k, ClReal **cl, int **sc,
+											const std::vector<std::vector<std::pair<Node *, bool> > > &steps, Node *p);
+		template<typename ClReal, typename TiReal>
+		void							lnLikelihoodsAtWith(const LikelihoodKernelsT<ClReal, TiReal> *k, ClReal **cl, int **sc,
+											const std::vector<std::vector<std::pair<Node *, bool> > > &steps, Node *p,
+											const std::vector<double> &rates, double *lnLs);
 		Calibration*					getRootCalibration();
 		
 		MbRandom						*ranPtr;
 		Alignment						*alignmentPtr;
 		int								numGammaCats;
+		int								numStates;				// 4 for nucleotides, AA_STATES for amino acids
 		std::vector<Parameter *>		parms[2];
-		double							*cls;
-		double							**clPtr[2];
-		MbTransitionMatrix				*tiCalculator;
+		ModelArena						*arena;					// storage of the conditional likelihoods, scalers and P-matrices
+		double							**clPtr;				// conditional likelihoods of every slot of the pool
+		int								**scPtr;
+		float							**clPtrSP;				// float conditional likelihoods (-prec single or mixed)
+		int								**scPtrSP;
+		int								numClSlots;
+		int								numClScratch;			// slots beyond one per stored node (-clscratch), -1 = from the tree height
+		int								numTiSlots;
+		std::vector<std::vector<int> >	freeClSlots;			// slots of every partition referenced by neither copy of the tree
+		std::vector<std::vector<int> >	freeTiSlots;
+		bool							overwroteCommitted;		// the pool ran out and the proposal wrote a committed slot
+		std::vector<bool>				clUpdate;				// nodes updated by the next evaluation, [partition][node]
+		int								numPartitions;			// -part, 1 without
+		double							*siteLnLOut;			// log-likelihood of every row of the root reductions, or NULL
+		std::vector<int>				partBegin;				// first row of every partition, and numPaddedPatterns
+		std::vector<int>				patternOfRow;			// site pattern of every row, -1 for padding
+		std::vector<bool>				partClDirty;			// a parameter of the partition changed
+		std::vector<bool>				partTiDirty;
+		ClPrecision						clPrecision;
+		bool							validatePrecision;		// also compute the double lnL and compare
+		double							maxPrecisionDiff;
+		int								numPrecisionChecks;
+		bool							validateOutside;		// also evaluate every candidate table of lnLikelihoodsAt alone (-vout)
+		double							maxOutsideDiff;
+		int								numOutsideChecks;
+		unsigned char					*tipCodes;
+		unsigned char					**tipStates;
+		std::vector<int>				tipCodeStates;			// the states (bit pattern) of every tip code
+		int								tipTableSize;			// entries of a tip lookup table per category
+		int								tiMatrixSize;			// entries of a P-matrix per category
+		double							*tiBuf;
+		int								*patternWeights;
+		const LikelihoodKernels			*kernels;
+		const SingleLikelihoodKernels	*singleKernels;
+		const MixedLikelihoodKernels	*mixedKernels;
+		std::vector<MbTransitionMatrix *>	tiCalculators;		// one per partition
 		int								activeParm;
 		std::vector<double>				updateProb;
 		int								numParms;
 		int								numPatterns;
-		MbMatrix<double>				**tis[2];
+		int								numPaddedPatterns;		// the rows of all partitions, each rounded up to the kernels' pattern block
+		int								numPaddedCats;			// numGammaCats rounded up to MAX_CAT_GROUP
+		int								cacheBlockPatterns;		// patterns per block of the traversal, -1 = from the L2 size
+		bool							useTaskGraph;			// schedule the updates as tasks (-ptask)
+		int								adaptiveThreads;		// thread cap of the adaptive schedule (-adapt), -1 = off
+		std::vector<KernelSchedule>		scheduleChoices;		// candidate schedules of -adapt
+		std::vector<int>				scheduleChosen;			// the schedule of every bucket, -1 while measuring
+		std::vector<std::vector<double> >	scheduleBest;		// fastest run per pattern update of each candidate
+		std::vector<std::vector<int> >	scheduleTrials;
+		int								pickSchedule(int bucket);
+		void							recordSchedule(int bucket, int c, double seconds);
+		size_t							l2CacheBytes;
+		double							clMemoryCap;			// MB for the likelihood arena (-clmem), 0 = no cap
+		std::string						clFileName;				// file backing the likelihood arena (-clfile), or empty
+		std::vector<bool>				isClStored;				// false for the nodes that are recomputed to meet the cap
+		bool							useOutside;				// keep outside partials for lnLikelihoodAt (-outside)
+		int								outsideBase;			// buffer of the outside partials of node 0, then ones
+		std::vector<bool>				outsideValid;			// [partition][node]
+		MbMatrix<double>				*identityTis;			// identity P-matrices of the gamma categories
+		MbMatrix<double>				*rateTis;				// P-matrices of the rates of lnLikelihoodsAt
+		bool							useSiteRepeats;			// -srep
+		std::vector<int>				siteRepRows;			// unique rows of each internal node
+		std::vector<std::vector<int> >	siteRepIx[2];			// child row of each row, left and right internal child
+		std::vector<std::vector<unsigned char> >	siteRepStates[2];	// tip state of each row, left and right tip child
+		std::vector<int>				siteRepWeights;			// summed pattern weights of the rows of the root
+		std::vector<int>				siteRepRootRows;		// row of the root of each pattern
+		bool							useInvariantSites;		// -inv
+		std::vector<int>				invStates;				// constant states of each row of the root
+		std::vector<double>				invProbs;				// their summed base frequencies
+		MbMatrix<double>				**tis;					// P-matrices of the gamma categories of every slot, numTiSlots per partition
 		double							priorMeanN;
 		seedType						startS1, startS2;
 		bool							runUnderPrior;
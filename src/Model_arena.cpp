@@ -0,0 +1,313 @@
+/* 
+ * DPPDiv version 1.1b source code (https://github.com/trayc7/FDPPDIV)
+ * Copyright 2009-2013
+ * Tracy Heath(1,2,3) 
+ * Mark Holder(1)
+ * John Huelsenbeck(2)
+ *
+ * (1) Department of Ecology and Evolutionary Biology, University of Kansas, Lawrence, KS 66045
+ * (2) Integrative Biology, University of California, Berkeley, CA 94720-3140
+ * (3) email: tracyh@berkeley.edu
+ *
+ * Also: T Stadler, D Darriba, AJ Aberer, T Flouri, F Izquierdo-Carrasco, and A Stamatakis
+ *
+ * DPPDiv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License (the file gpl.txt included with this
+ * distribution or http://www.gnu.org/licenses/gpl.txt for more
+ * details.
+ *
+ * Some of this code is from publicly available source by John Huelsenbeck and Fredrik Ronquist
+ *
+ */
+
+
+#include "Model_arena.h"
+#include "Model_kernels.h"
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+// huge pages are 2 MB on x86-64, the mapping is rounded up to whole huge pages
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+static bool threadsPinned = false;
+
+ModelArena::ModelArena(void) {
+
+	base = NULL;
+	size = 0;
+	mappedSize = 0;
+	usesHugePages = false;
+	inFile = false;
+}
+
+ModelArena::~ModelArena(void) {
+
+	if (base != NULL)
+		munmap(base, mappedSize);
+}
+
+/* Reserve a block of the given size and return its offset in the arena. */
+size_t ModelArena::reserve(size_t bytes) {
+
+	if (base != NULL)
+		{
+		cerr << "ERROR: Cannot reserve memory in an allocated arena" << endl;
+		exit(1);
+		}
+	size_t offset = size;
+	size += blockBytes(bytes);
+	return offset;
+}
+
+/* Reserve a block of numRows rows of rowBytes bytes, the first sliceRows of them are written
+ * first by the threads that compute them (see firstTouch). */
+size_t ModelArena::reserveRows(int numRows, size_t rowBytes, int sliceRows) {
+
+	RowBlock b;
+	b.offset = reserve((size_t)numRows * rowBytes);
+	b.rowBytes = rowBytes;
+	b.sliceRows = sliceRows;
+	rowBlocks.push_back(b);
+	return b.offset;
+}
+
+/* Map the arena, anonymous memory or, with a file name, the file, which is created (or
+ * truncated) and removed again once it is mapped. A file-backed arena is written back and read
+ * in by the kernel as needed, so it may be larger than the memory. */
+void ModelArena::allocate(bool hugePages, const string &fileName) {
+
+	mappedSize = (size > 0 ? size : ARENA_ALIGNMENT);
+	if (fileName.empty() == false)
+		{
+		mapFile(fileName);
+		return;
+		}
+	bool useHuge = false;
+#ifdef MADV_HUGEPAGE
+	useHuge = (hugePages == true && mappedSize >= HUGE_PAGE_SIZE);
+#endif
+	// huge pages need a 2 MB aligned start, so map one huge page more and unmap the ends
+	size_t extra = 0;
+	if (useHuge == true)
+		{
+		mappedSize = ((mappedSize + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE) * HUGE_PAGE_SIZE;
+		extra = HUGE_PAGE_SIZE;
+		}
+	void *mem = mmap(NULL, mappedSize + extra, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED)
+		{
+		cerr << "ERROR: Could not allocate " << mappedSize / 1048576.0 << " MB for the likelihood arena" << endl;
+		exit(1);
+		}
+	base = (char *)mem;
+	if (useHuge == true)
+		{
+		size_t head = (HUGE_PAGE_SIZE - (size_t)base % HUGE_PAGE_SIZE) % HUGE_PAGE_SIZE;
+		if (head > 0)
+			munmap(base, head);
+		if (extra - head > 0)
+			munmap(base + head + mappedSize, extra - head);
+		base += head;
+		}
+#ifdef MADV_HUGEPAGE
+	// a failing madvise only means the arena is backed by normal pages
+	if (useHuge == true)
+		usesHugePages = (madvise(base, mappedSize, MADV_HUGEPAGE) == 0);
+#endif
+	firstTouch();
+}
+
+/* The file is sparse, so the pages are only written to the disk once they are used, and they
+ * are not touched in advance by the threads. */
+void ModelArena::mapFile(const string &fileName) {
+
+	int fd = open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		{
+		cerr << "ERROR: Could not create the file " << fileName << " for the likelihood arena" << endl;
+		exit(1);
+		}
+	if (ftruncate(fd, (off_t)mappedSize) != 0)
+		{
+		cerr << "ERROR: Could not extend the file " << fileName << " to " << mappedSize / 1048576.0 << " MB" << endl;
+		exit(1);
+		}
+	void *mem = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mem == MAP_FAILED)
+		{
+		cerr << "ERROR: Could not map the file " << fileName << " for the likelihood arena" << endl;
+		exit(1);
+		}
+	close(fd);
+	unlink(fileName.c_str());
+	base = (char *)mem;
+	inFile = true;
+}
+
+/* Every thread zeroes its slice of the rows of every row block, so the pages of the slice are
+ * placed on its NUMA node. The single-threaded build leaves the pages to the first use. */
+void ModelArena::firstTouch(void) {
+
+#ifdef _OPENMP
+	int numParts = (int)partitionRows.size() - 1;
+	vector<int> sameCost(numParts > 0 ? numParts : 1, 1);
+	#pragma omp parallel
+	{
+		int t = omp_get_thread_num();
+		int nt = omp_get_num_threads();
+		for (size_t i=0; i<rowBlocks.size(); i++)
+			{
+			const RowBlock &b = rowBlocks[i];
+			int begin, end;
+			if (numParts > 1)
+				{
+				for (int p=0; p<numParts; p++)
+					{
+					partitionSlice(&partitionRows[0], &partitionRows[1], &sameCost[0], numParts, p, t, nt, &begin, &end);
+					if (end > begin)
+						memset(base + b.offset + begin * b.rowBytes, 0, (end - begin) * b.rowBytes);
+					}
+				continue;
+				}
+			patternSlice(b.sliceRows, t, nt, &begin, &end);
+			if (end > begin)
+				memset(base + b.offset + begin * b.rowBytes, 0, (end - begin) * b.rowBytes);
+			}
+	}
+#endif
+}
+
+static void pinThread(const vector<int> &cpus, int t) {
+
+	cpu_set_t one;
+	CPU_ZERO(&one);
+	CPU_SET(cpus[t % cpus.size()], &one);
+	if (sched_setaffinity(0, sizeof(one), &one) != 0)
+		{
+		cerr << "ERROR: Could not pin thread " << t << " to processor " << cpus[t % cpus.size()] << endl;
+		exit(1);
+		}
+}
+
+/* Pin the t-th thread to the t-th processor the process may run on (see taskset), so every
+ * thread stays next to the memory of its slice of the patterns. This must be called before the
+ * arena is allocated. */
+void ModelArena::pinThreads(void) {
+
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+		{
+		cerr << "ERROR: Could not read the processors available to the process" << endl;
+		exit(1);
+		}
+	vector<int> cpus;
+	for (int c=0; c<CPU_SETSIZE; c++)
+		if (CPU_ISSET(c, &allowed))
+			cpus.push_back(c);
+#ifdef _OPENMP
+	#pragma omp parallel
+	pinThread(cpus, omp_get_thread_num());
+#else
+	pinThread(cpus, 0);
+#endif
+	threadsPinned = true;
+}
+
+// the threads of a parallel region, 1 in the single-threaded build
+int ModelArena::getMaxThreads(void) {
+
+#ifdef _OPENMP
+	return omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
+
+static void getLocation(int *cpu, int *node) {
+
+	unsigned c = 0, n = 0;
+	*cpu = *node = -1;
+#ifdef SYS_getcpu
+	if (syscall(SYS_getcpu, &c, &n, NULL) == 0)
+		{
+		*cpu = (int)c;
+		*node = (int)n;
+		}
+#endif
+}
+
+/* Print the processor and NUMA node of every thread and the NUMA nodes of the pages of the
+ * arena, pages not written yet are counted as unused. */
+void ModelArena::printPlacement(void) {
+
+#ifdef _OPENMP
+	int nt = omp_get_max_threads();
+	vector<int> cpu(nt, -1), node(nt, -1);
+	#pragma omp parallel
+	{
+		int t = omp_get_thread_num();
+		if (t < nt)
+			getLocation(&cpu[t], &node[t]);
+	}
+	cout << "Threads: " << nt << (threadsPinned == true ? ", pinned" : "") << ", processor (NUMA node):";
+	for (int t=0; t<nt; t++)
+		cout << " " << cpu[t] << " (" << node[t] << ")";
+	cout << endl;
+#else
+	if (threadsPinned == false)
+		return;
+	int cpu, node;
+	getLocation(&cpu, &node);
+	cout << "Pinned to processor " << cpu << " (NUMA node " << node << ")" << endl;
+#endif
+
+#ifdef SYS_move_pages
+	size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+	size_t numPages = (size + pageSize - 1) / pageSize;
+	if (base == NULL || numPages == 0)
+		return;
+	vector<void *> pages(numPages);
+	vector<int> status(numPages, -1);
+	for (size_t i=0; i<numPages; i++)
+		pages[i] = base + i * pageSize;
+	// without a node list move_pages only reports the node of every page
+	if (syscall(SYS_move_pages, 0, numPages, &pages[0], NULL, &status[0], 0) != 0)
+		return;
+	map<int, size_t> pagesOnNode;
+	for (size_t i=0; i<numPages; i++)
+		pagesOnNode[status[i] >= 0 ? status[i] : -1]++;
+	ostringstream line;
+	line << "Likelihood arena pages:" << fixed << setprecision(1);
+	for (map<int, size_t>::iterator it=pagesOnNode.begin(); it!=pagesOnNode.end(); it++)
+		{
+		if (it->first >= 0)
+			line << " node " << it->first;
+		else
+			line << " unused";
+		line << " " << (100.0 * it->second) / numPages << "%";
+		}
+	cout << line.str() << endl;
+#endif
+}
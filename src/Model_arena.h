@@ -0,0 +1,94 @@
+/* 
+ * DPPDiv version 1.1b source code (https://github.com/trayc7/FDPPDIV)
+ * Copyright 2009-2013
+ * Tracy Heath(1,2,3) 
+ * Mark Holder(1)
+ * John Huelsenbeck(2)
+ *
+ * (1) Department of Ecology and Evolutionary Biology, University of Kansas, Lawrence, KS 66045
+ * (2) Integrative Biology, University of California, Berkeley, CA 94720-3140
+ * (3) email: tracyh@berkeley.edu
+ *
+ * Also: T Stadler, D Darriba, AJ Aberer, T Flouri, F Izquierdo-Carrasco, and A Stamatakis
+ *
+ * DPPDiv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License (the file gpl.txt included with this
+ * distribution or http://www.gnu.org/licenses/gpl.txt for more
+ * details.
+ *
+ * Some of this code is from publicly available source by John Huelsenbeck and Fredrik Ronquist
+ *
+ */
+
+
+#ifndef MODEL_ARENA_H
+#define MODEL_ARENA_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// every block of the arena starts on a cache line
+#define ARENA_ALIGNMENT 64
+
+/*
+ * One contiguous block of memory for the conditional likelihoods, scaler counts and transition
+ * probabilities of a Model. The blocks are reserved first, which only records their offsets,
+ * then the arena is mapped in one piece with mmap, asking for transparent huge pages if the
+ * system has them, and the blocks are found from their offsets. The memory is zero until it is
+ * written.
+ *
+ * A page is placed on the NUMA node of the thread that first writes it. The blocks reserved
+ * with reserveRows hold one row per site pattern; in the OpenMP build every thread writes its
+ * slice of the rows in use (the site repeats of a node with -srep) right after the mapping.
+ * These are the slices of patternSlice, or of partitionSlice over the partitions given with
+ * setPartitions, which a thread computes in every evaluation on all threads that updates the
+ * same nodes in all partitions, so the kernels read local memory. An evaluation of only some
+ * partitions is balanced by its cost instead. The other blocks are placed by whoever uses
+ * them first.
+ *
+ * The arena can also be a mapping of a file (-clfile), then the kernel pages it in and out.
+ */
+class ModelArena {
+
+	public:
+								ModelArena(void);
+								~ModelArena(void);
+		static size_t			blockBytes(size_t bytes) { return ((bytes + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT) * ARENA_ALIGNMENT; }
+		size_t					reserve(size_t bytes);
+		size_t					reserveRows(int numRows, size_t rowBytes, int sliceRows);
+		void					setPartitions(const std::vector<int> &partBegin) { partitionRows = partBegin; }
+		void					allocate(bool hugePages, const std::string &fileName);
+		void*					getBlock(size_t offset) { return base + offset; }
+		size_t					getSize(void) { return size; }
+		bool					getUsesHugePages(void) { return usesHugePages; }
+		bool					getIsInFile(void) { return inFile; }
+		void					printPlacement(void);
+		static void				pinThreads(void);
+		static int				getMaxThreads(void);
+
+	private:
+		struct RowBlock {
+			size_t				offset;
+			size_t				rowBytes;
+			int					sliceRows;
+		};
+		void					firstTouch(void);
+		void					mapFile(const std::string &fileName);
+		std::vector<RowBlock>	rowBlocks;
+		std::vector<int>		partitionRows;	// first row of every partition and the end, with -part
+		char					*base;
+		size_t					size;
+		size_t					mappedSize;
+		bool					usesHugePages;
+		bool					inFile;
+};
+
+#endif
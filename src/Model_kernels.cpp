@@ -0,0 +1,1866 @@
+/* 
+ * DPPDiv version 1.1b source code (https://github.com/trayc7/FDPPDIV)
+ * Copyright 2009-2013
+ * Tracy Heath(1,2,3) 
+ * Mark Holder(1)
+ * John Huelsenbeck(2)
+ *
+ * (1) Department of Ecology and Evolutionary Biology, University of Kansas, Lawrence, KS 66045
+ * (2) Integrative Biology, University of California, Berkeley, CA 94720-3140
+ * (3) email: tracyh@berkeley.edu
+ *
+ * Also: T Stadler, D Darriba, AJ Aberer, T Flouri, F Izquierdo-Carrasco, and A Stamatakis
+ *
+ * DPPDiv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License (the file gpl.txt included with this
+ * distribution or http://www.gnu.org/licenses/gpl.txt for more
+ * details.
+ *
+ * Some of this code is from publicly available source by John Huelsenbeck and Fredrik Ronquist
+ *
+ */
+
+
+/*
+ * This file is compiled once per instruction set (seq, SSE3, AVX, AVX2+FMA, AVX-512), see the Makefile.
+ * Only plain C headers may be included here: inline functions from C++ headers compiled with
+ * -mavx2 could otherwise be picked up by the linker for the baseline code.
+ */
+
+#include "cpuspec.h"
+#include "Model_kernels.h"
+#include <math.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* Rescale the n conditional likelihoods of one pattern if all of them are below the
+ * threshold. Returns the number of scaling events (0 or 1). */
+static inline int rescalePattern(double *cl, int n) {
+
+#ifdef _TOM_AVX512
+        __m512d
+                mx = _mm512_maskz_loadu_pd ( n >= 8 ? 0xFF : 0x0F, cl );
+        for (int i=8; i<n; i+=8)
+                mx = _mm512_max_pd ( mx, _mm512_maskz_loadu_pd ( n - i >= 8 ? 0xFF : 0x0F, cl + i ) );
+        if ( _mm512_reduce_max_pd ( mx ) < SCALE_THRESHOLD ) {
+                __m512d
+                        sf = _mm512_set1_pd ( SCALE_FACTOR );
+                for (int i=0; i<n; i+=8) {
+                        __mmask8
+                                m = ( n - i >= 8 ? 0xFF : 0x0F );
+                        _mm512_mask_storeu_pd ( cl + i, m, _mm512_mul_pd ( _mm512_maskz_loadu_pd ( m, cl + i ), sf ) );
+                }
+                return 1;
+        }
+#elif _TOM_SSE3
+        __m128d
+                mx = _mm_load_pd ( cl );
+        for (int i=2; i<n; i+=2)
+                mx = _mm_max_pd ( mx, _mm_load_pd ( cl + i ) );
+        mx = _mm_max_pd ( mx, _mm_unpackhi_pd ( mx, mx ) );
+        if ( _mm_cvtsd_f64 ( mx ) < SCALE_THRESHOLD ) {
+                __m128d
+                        sf = _mm_set1_pd ( SCALE_FACTOR );
+                for (int i=0; i<n; i+=2)
+                        _mm_store_pd ( cl + i, _mm_mul_pd ( _mm_load_pd ( cl + i ), sf ) );
+                return 1;
+        }
+#elif _TOM_AVX
+        __m256d
+                mx = _mm256_load_pd ( cl );
+        for (int i=4; i<n; i+=4)
+                mx = _mm256_max_pd ( mx, _mm256_load_pd ( cl + i ) );
+        __m128d
+                mh = _mm_max_pd ( _mm256_castpd256_pd128 ( mx ), _mm256_extractf128_pd ( mx, 1 ) );
+        mh = _mm_max_pd ( mh, _mm_unpackhi_pd ( mh, mh ) );
+        if ( _mm_cvtsd_f64 ( mh ) < SCALE_THRESHOLD ) {
+                __m256d
+                        sf = _mm256_set1_pd ( SCALE_FACTOR );
+                for (int i=0; i<n; i+=4)
+                        _mm256_store_pd ( cl + i, _mm256_mul_pd ( _mm256_load_pd ( cl + i ), sf ) );
+                return 1;
+        }
+#else
+        double mx = cl[0];
+        for (int i=1; i<n; i++)
+                if (cl[i] > mx)
+                        mx = cl[i];
+        if (mx < SCALE_THRESHOLD) {
+                for (int i=0; i<n; i++)
+                        cl[i] *= SCALE_FACTOR;
+                return 1;
+        }
+#endif
+        return 0;
+}
+
+/* The log-likelihood of a pattern from the probability siteProb of its gamma part, scaled by
+ * exp(-lnScale). With invariant sites (invProbs not NULL) it is mixed with the probability
+ * invProbs[c] of a constant pattern in the proportion pInv, in log space since siteProb may be
+ * scaled far below the double range. */
+static inline double patternLnL(double siteProb, double lnScale, const double *invProbs, double pInv, int c) {
+
+        if ( invProbs == NULL )
+                return log ( siteProb ) - lnScale;
+        double lnG = log ( ( 1.0 - pInv ) * siteProb ) - lnScale;
+        if ( invProbs[c] == 0.0 )
+                return lnG;
+        double lnI = log ( pInv * invProbs[c] );
+        return ( lnG > lnI ? lnG + log1p ( exp ( lnI - lnG ) ) : lnI + log1p ( exp ( lnG - lnI ) ) );
+}
+
+/* Both children are internal nodes: full 4x4 matrix-vector products on both sides. With site
+ * repeats ixL and ixR give the row of each child that row c of this node is computed from,
+ * NULL means the same row. */
+template<int NCAT>
+static void innerInner(double *clP, int *scP, const double *clL, const int *scL,
+                       const double *clR, const int *scR, const double *tiL, const double *tiR,
+                       const int *ixL, const int *ixR, int, int begin, int end) {
+
+        const int numCats = NCAT;
+        const int clStride = numCats * 4;
+
+// parallelisation
+        for (int c=begin; c<end; c++) {
+// parallelisation
+                int iL = ( ixL == NULL ? c : ixL[c] );
+                int iR = ( ixR == NULL ? c : ixR[c] );
+                double *cP = clP + c * clStride;
+                const double *cL = clL + iL * clStride;
+                const double *cR = clR + iR * clStride;
+                int p = 0;
+#ifdef _TOM_AVX512
+                /* Two gamma categories (8 doubles) per zmm register, so the 4 categories of a
+                 * pattern are done in two passes. The P-matrix columns of both categories of
+                 * a pair are stored next to each other, and the conditional likelihoods of
+                 * the child are broadcast within each 256-bit lane. An odd last category is
+                 * handled with a masked load and store. */
+                for (int k=0; k<numCats; k+=2) {
+
+                        const double *tL = tiL + k * 16;
+                        const double *tR = tiR + k * 16;
+                        __mmask8
+                                m = ( k + 1 < numCats ? 0xFF : 0x0F );
+                        __m512d
+                                cll, clr,
+                                sl, sr;
+
+                        cll = _mm512_maskz_loadu_pd ( m, cL + p );
+                        clr = _mm512_maskz_loadu_pd ( m, cR + p );
+
+                        sl = _mm512_mul_pd ( _mm512_load_pd ( tL + 0 ), _mm512_permutex_pd ( cll, 0x00 ) );
+                        sl = _mm512_fmadd_pd ( _mm512_load_pd ( tL + 8 ), _mm512_permutex_pd ( cll, 0x55 ), sl );
+                        sl = _mm512_fmadd_pd ( _mm512_load_pd ( tL + 16 ), _mm512_permutex_pd ( cll, 0xAA ), sl );
+                        sl = _mm512_fmadd_pd ( _mm512_load_pd ( tL + 24 ), _mm512_permutex_pd ( cll, 0xFF ), sl );
+
+                        sr = _mm512_mul_pd ( _mm512_load_pd ( tR + 0 ), _mm512_permutex_pd ( clr, 0x00 ) );
+                        sr = _mm512_fmadd_pd ( _mm512_load_pd ( tR + 8 ), _mm512_permutex_pd ( clr, 0x55 ), sr );
+                        sr = _mm512_fmadd_pd ( _mm512_load_pd ( tR + 16 ), _mm512_permutex_pd ( clr, 0xAA ), sr );
+                        sr = _mm512_fmadd_pd ( _mm512_load_pd ( tR + 24 ), _mm512_permutex_pd ( clr, 0xFF ), sr );
+
+                        _mm512_mask_storeu_pd ( cP + p, m, _mm512_mul_pd ( sl, sr ) );
+                        p += 8;
+                }
+#else
+                for (int k=0; k<numCats; k++) {
+
+                        const double *tL = tiL + k * 16;
+                        const double *tR = tiR + k * 16;
+#ifdef _TOM_AVX2
+                        #ifdef _ASM_DEBUG
+                        __asm__ ( "int $0x3" );
+                        #endif
+                        /* the P-matrices are transposed, so each step adds a column of P times
+                         * one broadcast conditional likelihood of the child */
+                        __m256d
+                                sl, sr;
+
+                        sl = _mm256_mul_pd ( _mm256_load_pd ( tL + 0 ), _mm256_broadcast_sd ( cL + p + 0 ) );
+                        sl = _mm256_fmadd_pd ( _mm256_load_pd ( tL + 4 ), _mm256_broadcast_sd ( cL + p + 1 ), sl );
+                        sl = _mm256_fmadd_pd ( _mm256_load_pd ( tL + 8 ), _mm256_broadcast_sd ( cL + p + 2 ), sl );
+                        sl = _mm256_fmadd_pd ( _mm256_load_pd ( tL + 12 ), _mm256_broadcast_sd ( cL + p + 3 ), sl );
+
+                        sr = _mm256_mul_pd ( _mm256_load_pd ( tR + 0 ), _mm256_broadcast_sd ( cR + p + 0 ) );
+                        sr = _mm256_fmadd_pd ( _mm256_load_pd ( tR + 4 ), _mm256_broadcast_sd ( cR + p + 1 ), sr );
+                        sr = _mm256_fmadd_pd ( _mm256_load_pd ( tR + 8 ), _mm256_broadcast_sd ( cR + p + 2 ), sr );
+                        sr = _mm256_fmadd_pd ( _mm256_load_pd ( tR + 12 ), _mm256_broadcast_sd ( cR + p + 3 ), sr );
+
+                        _mm256_store_pd ( cP + p, _mm256_mul_pd ( sl, sr ) );
+                        #ifdef _ASM_DEBUG
+                        __asm__ ( "int $0x3" );
+                        #endif
+
+#elif _TOM_SSE3
+                        #ifdef _ASM_DEBUG
+                        __asm__ ( "int $0x3" );
+                        #endif
+                        __m128d
+                                cll0, clr0,
+                                cll2, clr2,
+                                p1, p2,
+                                s1, s2,
+                                sr, sl;
+
+                        cll0 = _mm_load_pd ( cL + p );
+                        clr0 = _mm_load_pd ( cR + p );
+                        cll2 = _mm_load_pd ( cL + p + 2 );
+                        clr2 = _mm_load_pd ( cR + p + 2 );
+
+                        /* Compute cP[p + 0] and cP[p + 1] */
+                        p1 = _mm_mul_pd ( _mm_load_pd ( tL + 0 ), cll0 );       // tL[0][0] * cL[p + 0], tL[0][1] * cL[p + 1]
+                        p2 = _mm_mul_pd ( _mm_load_pd ( tL + 4 ), cll0 );       // tL[1][0] * cL[p + 0], tL[1][1] * cL[p + 1]
+                        s1 = _mm_hadd_pd ( p1, p2 );                            // tL[0][0] * cL[p + 0] + tL[0][1] * cL[p + 1], tL[1][0] * cL[p + 0] + tL[1][1] * cL[p + 1]
+
+                        p1 = _mm_mul_pd ( _mm_load_pd ( tL + 2 ), cll2 );       // tL[0][2] * cL[p + 2], tL[0][3] * cL[p + 3]
+                        p2 = _mm_mul_pd ( _mm_load_pd ( tL + 6 ), cll2 );       // tL[1][2] * cL[p + 2], tL[1][3] * cL[p + 3]
+                        s2 = _mm_hadd_pd ( p1, p2 );                            // tL[0][2] * cL[p + 2] + tL[0][3] * cL[p + 3], tL[1][2] * cL[p + 2] + tL[1][3] * cL[p + 3]
+
+                        /*  tL[0][0] * cL[p + 0] + tL[0][1] * cL[p + 1] + tL[0][2] * cL[p + 2] + tL[0][3] * cL[p + 3],
+                         *  tL[1][0] * cL[p + 0] + tL[1][1] * cL[p + 1] + tL[1][2] * cL[p + 2] + tL[1][3] * cL[p + 3]
+                         */
+                        sl = _mm_add_pd ( s1, s2 );
+
+                        p1 = _mm_mul_pd ( _mm_load_pd ( tR + 0 ), clr0 );
+                        p2 = _mm_mul_pd ( _mm_load_pd ( tR + 4 ), clr0 );
+                        s1 = _mm_hadd_pd ( p1, p2 );
+
+                        p1 = _mm_mul_pd ( _mm_load_pd ( tR + 2 ), clr2 );
+                        p2 = _mm_mul_pd ( _mm_load_pd ( tR + 6 ), clr2 );
+                        s2 = _mm_hadd_pd ( p1, p2 );
+
+                        sr = _mm_add_pd ( s1, s2 );
+
+                        _mm_store_pd ( cP + p, _mm_mul_pd ( sl, sr ) );
+
+                        /* Compute cP[p + 2] and cP[p + 3] */
+                        p1 = _mm_mul_pd ( _mm_load_pd ( tL + 8 ), cll0 );
+                        p2 = _mm_mul_pd ( _mm_load_pd ( tL + 12 ), cll0 );
+                        s1 = _mm_hadd_pd ( p1, p2 );
+
+                        p1 = _mm_mul_pd ( _mm_load_pd ( tL + 10 ), cll2 );
+                        p2 = _mm_mul_pd ( _mm_load_pd ( tL + 14 ), cll2 );
+                        s2 = _mm_hadd_pd ( p1, p2 );
+
+                        sl = _mm_add_pd ( s1, s2 );
+
+                        p1 = _mm_mul_pd ( _mm_load_pd ( tR + 8 ), clr0 );
+                        p2 = _mm_mul_pd ( _mm_load_pd ( tR + 12 ), clr0 );
+                        s1 = _mm_hadd_pd ( p1, p2 );
+
+                        p1 = _mm_mul_pd ( _mm_load_pd ( tR + 10 ), clr2 );
+                        p2 = _mm_mul_pd ( _mm_load_pd ( tR + 14 ), clr2 );
+                        s2 = _mm_hadd_pd ( p1, p2 );
+
+                        sr = _mm_add_pd ( s1, s2 );
+
+                        _mm_store_pd ( cP + p + 2, _mm_mul_pd ( sl, sr ) );
+                        #ifdef _ASM_DEBUG
+                        __asm__ ( "int $0x3" );
+                        #endif
+
+#elif _TOM_AVX
+                        #ifdef _ASM_DEBUG
+                        __asm__ ( "int $0x3" );
+                        #endif
+                        __m256d
+                                cll,
+                                clr,
+                                r1, r2, r3, r4, r12, r34, r1234,
+                                l1, l2, l3, l4, l12, l34, l1234,
+                                r, perm, blnd;
+
+                        cll = _mm256_load_pd ( cL + p );
+                        clr = _mm256_load_pd ( cR + p );
+
+                        // Compute sumL rows
+
+                        l1 = _mm256_mul_pd ( _mm256_load_pd ( tL + 0 ), cll );
+                        l2 = _mm256_mul_pd ( _mm256_load_pd ( tL + 4 ), cll );
+                        l3 = _mm256_mul_pd ( _mm256_load_pd ( tL + 8 ), cll );
+                        l4 = _mm256_mul_pd ( _mm256_load_pd ( tL + 12 ), cll );
+
+                        l12 = _mm256_hadd_pd ( l1, l2 );
+                        l34 = _mm256_hadd_pd ( l3, l4 );
+
+                        blnd = _mm256_blend_pd ( l12, l34, 0b1100 );
+                        perm = _mm256_permute2f128_pd ( l12, l34, 0x21 );
+                        l1234 = _mm256_add_pd ( perm, blnd );
+
+                        // Compute sumR rows
+
+                        r1 = _mm256_mul_pd ( _mm256_load_pd ( tR + 0 ), clr );
+                        r2 = _mm256_mul_pd ( _mm256_load_pd ( tR + 4 ), clr );
+                        r3 = _mm256_mul_pd ( _mm256_load_pd ( tR + 8 ), clr );
+                        r4 = _mm256_mul_pd ( _mm256_load_pd ( tR + 12 ), clr );
+
+                        r12 = _mm256_hadd_pd ( r1, r2 );
+                        r34 = _mm256_hadd_pd ( r3, r4 );
+
+                        blnd = _mm256_blend_pd ( r12, r34, 0b1100 );
+                        perm = _mm256_permute2f128_pd ( r12, r34, 0x21 );
+                        r1234 = _mm256_add_pd ( perm, blnd );
+
+                        r = _mm256_mul_pd ( l1234, r1234 );
+
+                        _mm256_store_pd ( cP + p, r );
+                        #ifdef _ASM_DEBUG
+                        __asm__ ( "int $0x3" );
+                        #endif
+#else
+                        #ifdef _ASM_DEBUG
+                        __asm__ ( "int $0x3" );
+                        #endif
+                        double sumL, sumR;
+                        sumL = tL[0] * cL[p + 0] + tL[1] * cL[p + 1] + tL[2] * cL[p + 2] + tL[3] * cL[p + 3];
+                        sumR = tR[0] * cR[p + 0] + tR[1] * cR[p + 1] + tR[2] * cR[p + 2] + tR[3] * cR[p + 3];
+                        cP[p + 0] = sumL * sumR;
+
+                        sumL = tL[4] * cL[p + 0] + tL[5] * cL[p + 1] + tL[6] * cL[p + 2] + tL[7] * cL[p + 3];
+                        sumR = tR[4] * cR[p + 0] + tR[5] * cR[p + 1] + tR[6] * cR[p + 2] + tR[7] * cR[p + 3];
+                        cP[p + 1] = sumL * sumR;
+
+                        sumL = tL[8] * cL[p + 0] + tL[9] * cL[p + 1] + tL[10] * cL[p + 2] + tL[11] * cL[p + 3];
+                        sumR = tR[8] * cR[p + 0] + tR[9] * cR[p + 1] + tR[10] * cR[p + 2] + tR[11] * cR[p + 3];
+                        cP[p + 2] = sumL * sumR;
+
+                        sumL = tL[12] * cL[p + 0] + tL[13] * cL[p + 1] + tL[14] * cL[p + 2] + tL[15] * cL[p + 3];
+                        sumR = tR[12] * cR[p + 0] + tR[13] * cR[p + 1] + tR[14] * cR[p + 2] + tR[15] * cR[p + 3];
+                        cP[p + 3] = sumL * sumR;
+                        #ifdef _ASM_DEBUG
+                        __asm__ ( "int $0x3" );
+                        #endif
+#endif
+// parallelisation
+                        p += 4;
+                }
+#endif
+
+                /* rescale this pattern if every conditional likelihood dropped below the threshold */
+                scP[c] = scL[iL] + scR[iR] + rescalePattern ( cP, clStride );
+        }
+}
+
+/* The left child is a tip: its side of the product is read from the lookup table lkL,
+ * indexed by the tip's nucleotide code. */
+template<int NCAT>
+static void tipInner(double *clP, int *scP, const unsigned char *stL, const double *lkL,
+                     const double *clR, const int *scR, const double *tiR,
+                     const int *ixR, int, int begin, int end) {
+
+        const int numCats = NCAT;
+        const int clStride = numCats * 4;
+
+        for (int c=begin; c<end; c++) {
+                int iR = ( ixR == NULL ? c : ixR[c] );
+                double *cP = clP + c * clStride;
+                const double *cR = clR + iR * clStride;
+                int p = 0;
+#ifdef _TOM_AVX512
+                /* the tip table holds the entries of both categories of a pair next to each other */
+                const double *lL = lkL + stL[c] * 8;
+                for (int k=0; k<numCats; k+=2) {
+
+                        const double *tR = tiR + k * 16;
+                        __mmask8
+                                m = ( k + 1 < numCats ? 0xFF : 0x0F );
+                        __m512d
+                                clr, ll,
+                                sr;
+
+                        clr = _mm512_maskz_loadu_pd ( m, cR + p );
+                        ll = _mm512_maskz_load_pd ( m, lL );
+
+                        sr = _mm512_mul_pd ( _mm512_load_pd ( tR + 0 ), _mm512_permutex_pd ( clr, 0x00 ) );
+                        sr = _mm512_fmadd_pd ( _mm512_load_pd ( tR + 8 ), _mm512_permutex_pd ( clr, 0x55 ), sr );
+                        sr = _mm512_fmadd_pd ( _mm512_load_pd ( tR + 16 ), _mm512_permutex_pd ( clr, 0xAA ), sr );
+                        sr = _mm512_fmadd_pd ( _mm512_load_pd ( tR + 24 ), _mm512_permutex_pd ( clr, 0xFF ), sr );
+
+                        _mm512_mask_storeu_pd ( cP + p, m, _mm512_mul_pd ( ll, sr ) );
+                        p += 8;
+                        lL += 128;
+                }
+#else
+                const double *lL = lkL + stL[c] * 4;
+                for (int k=0; k<numCats; k++) {
+
+                        const double *tR = tiR + k * 16;
+#ifdef _TOM_AVX2
+                        __m256d
+                                sr;
+
+                        sr = _mm256_mul_pd ( _mm256_load_pd ( tR + 0 ), _mm256_broadcast_sd ( cR + p + 0 ) );
+                        sr = _mm256_fmadd_pd ( _mm256_load_pd ( tR + 4 ), _mm256_broadcast_sd ( cR + p + 1 ), sr );
+                        sr = _mm256_fmadd_pd ( _mm256_load_pd ( tR + 8 ), _mm256_broadcast_sd ( cR + p + 2 ), sr );
+                        sr = _mm256_fmadd_pd ( _mm256_load_pd ( tR + 12 ), _mm256_broadcast_sd ( cR + p + 3 ), sr );
+
+                        _mm256_store_pd ( cP + p, _mm256_mul_pd ( _mm256_load_pd ( lL ), sr ) );
+
+#elif _TOM_SSE3
+                        __m128d
+                                clr0, clr2,
+                                p1, p2,
+                                s1, s2,
+                                sr;
+
+                        clr0 = _mm_load_pd ( cR + p );
+                        clr2 = _mm_load_pd ( cR + p + 2 );
+
+                        /* Compute cP[p + 0] and cP[p + 1] */
+                        p1 = _mm_mul_pd ( _mm_load_pd ( tR + 0 ), clr0 );
+                        p2 = _mm_mul_pd ( _mm_load_pd ( tR + 4 ), clr0 );
+                        s1 = _mm_hadd_pd ( p1, p2 );
+
+                        p1 = _mm_mul_pd ( _mm_load_pd ( tR + 2 ), clr2 );
+                        p2 = _mm_mul_pd ( _mm_load_pd ( tR + 6 ), clr2 );
+                        s2 = _mm_hadd_pd ( p1, p2 );
+
+                        sr = _mm_add_pd ( s1, s2 );
+
+                        _mm_store_pd ( cP + p, _mm_mul_pd ( _mm_load_pd ( lL ), sr ) );
+
+                        /* Compute cP[p + 2] and cP[p + 3] */
+                        p1 = _mm_mul_pd ( _mm_load_pd ( tR + 8 ), clr0 );
+                        p2 = _mm_mul_pd ( _mm_load_pd ( tR + 12 ), clr0 );
+                        s1 = _mm_hadd_pd ( p1, p2 );
+
+                        p1 = _mm_mul_pd ( _mm_load_pd ( tR + 10 ), clr2 );
+                        p2 = _mm_mul_pd ( _mm_load_pd ( tR + 14 ), clr2 );
+                        s2 = _mm_hadd_pd ( p1, p2 );
+
+                        sr = _mm_add_pd ( s1, s2 );
+
+                        _mm_store_pd ( cP + p + 2, _mm_mul_pd ( _mm_load_pd ( lL + 2 ), sr ) );
+
+#elif _TOM_AVX
+                        __m256d
+                                clr,
+                                r1, r2, r3, r4, r12, r34, r1234,
+                                perm, blnd;
+
+                        clr = _mm256_load_pd ( cR + p );
+
+                        r1 = _mm256_mul_pd ( _mm256_load_pd ( tR + 0 ), clr );
+                        r2 = _mm256_mul_pd ( _mm256_load_pd ( tR + 4 ), clr );
+                        r3 = _mm256_mul_pd ( _mm256_load_pd ( tR + 8 ), clr );
+                        r4 = _mm256_mul_pd ( _mm256_load_pd ( tR + 12 ), clr );
+
+                        r12 = _mm256_hadd_pd ( r1, r2 );
+                        r34 = _mm256_hadd_pd ( r3, r4 );
+
+                        blnd = _mm256_blend_pd ( r12, r34, 0b1100 );
+                        perm = _mm256_permute2f128_pd ( r12, r34, 0x21 );
+                        r1234 = _mm256_add_pd ( perm, blnd );
+
+                        _mm256_store_pd ( cP + p, _mm256_mul_pd ( _mm256_load_pd ( lL ), r1234 ) );
+#else
+                        cP[p + 0] = lL[0] * (tR[0] * cR[p + 0] + tR[1] * cR[p + 1] + tR[2] * cR[p + 2] + tR[3] * cR[p + 3]);
+                        cP[p + 1] = lL[1] * (tR[4] * cR[p + 0] + tR[5] * cR[p + 1] + tR[6] * cR[p + 2] + tR[7] * cR[p + 3]);
+                        cP[p + 2] = lL[2] * (tR[8] * cR[p + 0] + tR[9] * cR[p + 1] + tR[10] * cR[p + 2] + tR[11] * cR[p + 3]);
+                        cP[p + 3] = lL[3] * (tR[12] * cR[p + 0] + tR[13] * cR[p + 1] + tR[14] * cR[p + 2] + tR[15] * cR[p + 3]);
+#endif
+                        p += 4;
+                        lL += 64;
+                }
+#endif
+
+                scP[c] = scR[iR] + rescalePattern ( cP, clStride );
+        }
+}
+
+/* Both children are tips: the conditional likelihoods are products of two table entries.
+ * These are products of two transition probabilities, so no rescaling is needed. */
+template<int NCAT>
+static void tipTip(double *clP, int *scP, const unsigned char *stL, const double *lkL,
+                   const unsigned char *stR, const double *lkR, int, int begin, int end) {
+
+        const int numCats = NCAT;
+        const int clStride = numCats * 4;
+
+        for (int c=begin; c<end; c++) {
+                int p = c * clStride;
+#ifdef _TOM_AVX512
+                const double *lL = lkL + stL[c] * 8;
+                const double *lR = lkR + stR[c] * 8;
+                for (int k=0; k<numCats; k+=2) {
+                        __mmask8
+                                m = ( k + 1 < numCats ? 0xFF : 0x0F );
+                        _mm512_mask_storeu_pd ( clP + p, m, _mm512_mul_pd ( _mm512_maskz_load_pd ( m, lL ), _mm512_maskz_load_pd ( m, lR ) ) );
+                        p += 8;
+                        lL += 128;
+                        lR += 128;
+                }
+#else
+                const double *lL = lkL + stL[c] * 4;
+                const double *lR = lkR + stR[c] * 4;
+                for (int k=0; k<numCats; k++) {
+#ifdef _TOM_SSE3
+                        _mm_store_pd ( clP + p, _mm_mul_pd ( _mm_load_pd ( lL ), _mm_load_pd ( lR ) ) );
+                        _mm_store_pd ( clP + p + 2, _mm_mul_pd ( _mm_load_pd ( lL + 2 ), _mm_load_pd ( lR + 2 ) ) );
+#elif _TOM_AVX
+                        _mm256_store_pd ( clP + p, _mm256_mul_pd ( _mm256_load_pd ( lL ), _mm256_load_pd ( lR ) ) );
+#else
+                        clP[p + 0] = lL[0] * lR[0];
+                        clP[p + 1] = lL[1] * lR[1];
+                        clP[p + 2] = lL[2] * lR[2];
+                        clP[p + 3] = lL[3] * lR[3];
+#endif
+                        p += 4;
+                        lL += 64;
+                        lR += 64;
+                }
+#endif
+                scP[c] = 0;
+        }
+}
+
+/* Sum the root conditional likelihoods over states and gamma categories and return the
+ * weighted log-likelihood of the patterns, including the scaling factors. The SSE3, AVX and
+ * scalar sums are unrolled by hand for 4 categories, other counts use a loop over NCAT. */
+template<int NCAT>
+static double rootLnL(const double *clP, const int *scP, const double *f,
+                      const int *weights, const double *invProbs, double pInv, int, int begin, int end, double *siteLnL) {
+
+        const int numCats = NCAT;
+	double catProb = 1.0 / numCats;
+	double lnL = 0.0;
+	for (int c=begin; c<end; c++){
+                int p = c * numCats * 4;
+		double siteProb = 0.0;
+                #if defined(_TOM_AVX) && !defined(_TOM_AVX2)
+                ALIGNED ( double siteProbTmp[4] );
+                #endif
+
+#ifdef _TOM_AVX512
+                /* two gamma categories per zmm register, with a masked odd last category */
+                __m512d
+                        m, v;
+
+                m = _mm512_castpd256_pd512 ( _mm256_set_pd ( f[3], f[2], f[1], f[0] ) );
+                m = _mm512_insertf64x4 ( m, _mm512_castpd512_pd256 ( m ), 1 );
+
+                v = _mm512_setzero_pd ( );
+                for (int k=0; k<numCats; k+=2)
+                        v = _mm512_fmadd_pd ( _mm512_maskz_loadu_pd ( k + 1 < numCats ? 0xFF : 0x0F, clP + p + k * 4 ), m, v );
+
+                siteProb = _mm512_reduce_add_pd ( v );
+
+#elif _TOM_AVX2
+                __m256d
+                        m, v;
+                __m128d
+                        h;
+
+                m = _mm256_set_pd ( f[3], f[2], f[1], f[0] );
+
+                v = _mm256_mul_pd ( _mm256_load_pd ( clP + p ), m );
+                for (int k=1; k<numCats; k++)
+                        v = _mm256_fmadd_pd ( _mm256_load_pd ( clP + p + k * 4 ), m, v );
+
+                h = _mm_add_pd ( _mm256_castpd256_pd128 ( v ), _mm256_extractf128_pd ( v, 1 ) );
+                h = _mm_add_pd ( h, _mm_unpackhi_pd ( h, h ) );
+                siteProb = _mm_cvtsd_f64 ( h );
+
+#elif _TOM_SSE3
+                                        #ifdef _ASM_DEBUG
+                                        __asm__ ( "int $0x3" );
+                                        #endif
+                __m128d
+                        p1,
+                        p2,
+                        v1,
+                        v2,
+                        v3,
+                        v4,
+                        m1,
+                        m2;
+
+                m1 = _mm_set_pd ( f[1], f[0] );
+                m2 = _mm_set_pd ( f[3], f[2] );
+                if ( numCats == 4 ) {
+                        p1 = _mm_mul_pd ( _mm_load_pd ( clP + p + 0 ), m1 );           // clP[p+0] * f[0], clP[p+1] * f[1]
+                        p2 = _mm_mul_pd ( _mm_load_pd ( clP + p + 2 ), m2 );           // clP[p+2] * f[2], clP[p+3] * f[3]
+                        v1 = _mm_hadd_pd ( p1, p2 );                                                      // clP[p+0] * f[0] + clP[p+2] * f[2], clP[p+1] * f[1] + clP[p + 3] * f[3]
+
+                        p += 4;
+
+                        p1 = _mm_mul_pd ( _mm_load_pd ( clP + p + 0 ), m1 );
+                        p2 = _mm_mul_pd ( _mm_load_pd ( clP + p + 2 ), m2 );           // clP[p+2] * f[2], clP[p+3] * f[3]
+                        v2 = _mm_hadd_pd ( p1, p2 );                                                      // clP[p+0] * f[0] + clP[p+2] * f[2], clP[p+1] * f[1] + clP[p + 3] * f[3]
+
+                        p += 4;
+
+                        p1 = _mm_mul_pd ( _mm_load_pd ( clP + p + 0 ), m1 );
+                        p2 = _mm_mul_pd ( _mm_load_pd ( clP + p + 2 ), m2 );           // clP[p+2] * f[2], clP[p+3] * f[3]
+                        v3 = _mm_hadd_pd ( p1, p2 );                                                      // clP[p+0] * f[0] + clP[p+2] * f[2], clP[p+1] * f[1] + clP[p + 3] * f[3]
+
+                        p += 4;
+
+                        p1 = _mm_mul_pd ( _mm_load_pd ( clP + p + 0 ), m1 );
+                        p2 = _mm_mul_pd ( _mm_load_pd ( clP + p + 2 ), m2 );           // clP[p+2] * f[2], clP[p+3] * f[3]
+                        v4 = _mm_hadd_pd ( p1, p2 );                                                      // clP[p+0] * f[0] + clP[p+2] * f[2], clP[p+1] * f[1] + clP[p + 3] * f[3]
+
+                        p += 4;
+
+                        p1 = _mm_hadd_pd ( v1, v2 );
+                        p2 = _mm_hadd_pd ( v3, v4 );
+
+                        v1 = _mm_hadd_pd ( p1, p2 );
+                        _mm_storel_pd ( &siteProb, _mm_hadd_pd ( v1, v1 ) );
+                } else {
+                        v1 = _mm_setzero_pd ( );
+                        for (int k=0; k<numCats; k++) {
+                                p1 = _mm_mul_pd ( _mm_load_pd ( clP + p + k * 4 + 0 ), m1 );
+                                p2 = _mm_mul_pd ( _mm_load_pd ( clP + p + k * 4 + 2 ), m2 );
+                                v1 = _mm_add_pd ( v1, _mm_hadd_pd ( p1, p2 ) );
+                        }
+                        _mm_storel_pd ( &siteProb, _mm_hadd_pd ( v1, v1 ) );
+                }
+                                        #ifdef _ASM_DEBUG
+                                        __asm__ ( "int $0x3" );
+                                        #endif
+
+#elif _TOM_AVX
+                                        #ifdef _ASM_DEBUG
+                                        __asm__ ( "int $0x3" );
+                                        #endif
+                __m256d
+                        m,
+                        p1, p2, p3, p4;
+
+                m = _mm256_set_pd ( f[3], f[2], f[1], f[0] );
+                
+                if ( numCats == 4 ) {
+                        p1 = _mm256_mul_pd ( _mm256_load_pd ( clP + p ), m );
+                        p2 = _mm256_mul_pd ( _mm256_load_pd ( clP + p + 4 ), m );
+                        p3 = _mm256_mul_pd ( _mm256_load_pd ( clP + p + 8 ), m );
+                        p4 = _mm256_mul_pd ( _mm256_load_pd ( clP + p + 12 ), m );
+                        p += 16;
+
+                        p1 = _mm256_hadd_pd ( p1, p2 );
+                        p2 = _mm256_hadd_pd ( p3, p4 );
+
+                        p1 = _mm256_hadd_pd ( p1, p2 );
+
+                        p1 = _mm256_add_pd ( p1, _mm256_permute2f128_pd ( p1 , p1 , 1)  );
+
+                        p1 = _mm256_hadd_pd ( p1, p1 );
+
+                        //_mm_storel_pd ( &siteProb, _mm256_extractf128_pd ( p1, 0 ) );
+                        _mm256_store_pd ( siteProbTmp, p1 );
+
+                        siteProb = siteProbTmp[0];
+                } else {
+                        __m128d
+                                h;
+
+                        p1 = _mm256_mul_pd ( _mm256_load_pd ( clP + p ), m );
+                        for (int k=1; k<numCats; k++)
+                                p1 = _mm256_add_pd ( p1, _mm256_mul_pd ( _mm256_load_pd ( clP + p + k * 4 ), m ) );
+
+                        h = _mm_add_pd ( _mm256_castpd256_pd128 ( p1 ), _mm256_extractf128_pd ( p1, 1 ) );
+                        h = _mm_hadd_pd ( h, h );
+                        siteProb = _mm_cvtsd_f64 ( h );
+                }
+                                        #ifdef _ASM_DEBUG
+                                        __asm__ ( "int $0x3" );
+                                        #endif
+
+#else
+                                        #ifdef _ASM_DEBUG
+                                        __asm__ ( "int $0x3" );
+                                        #endif
+
+                if ( numCats == 4 ) {
+                        siteProb += clP[p + 0] * f[0] + clP[p + 1] * f[1] + clP[p + 2] * f[2] + clP[p + 3] * f[3] ;
+                        p += 4;
+                        //clP += 4;
+                        siteProb += clP[p + 0] * f[0] + clP[p + 1] * f[1] + clP[p + 2] * f[2] + clP[p + 3] * f[3] ;
+                        p += 4;
+                        //clP += 4;
+                        siteProb += clP[p + 0] * f[0] + clP[p + 1] * f[1] + clP[p + 2] * f[2] + clP[p + 3] * f[3] ;
+                        //clP += 4;
+                        p += 4;
+                        siteProb += clP[p + 0] * f[0] + clP[p + 1] * f[1] + clP[p + 2] * f[2] + clP[p + 3] * f[3] ;
+                        //clP += 4;
+                        p += 4;
+                } else {
+                        for (int k=0; k<numCats; k++)
+                                siteProb += clP[p + k * 4 + 0] * f[0] + clP[p + k * 4 + 1] * f[1] + clP[p + k * 4 + 2] * f[2] + clP[p + k * 4 + 3] * f[3];
+                }
+                                        #ifdef _ASM_DEBUG
+                                        __asm__ ( "int $0x3" );
+                                        #endif
+#endif
+//#		endif
+		siteProb *= catProb;
+		double l = patternLnL(siteProb, scP[c] * LN_SCALE_FACTOR, invProbs, pInv, c);
+		if (siteLnL != NULL)
+			siteLnL[c] = l;
+		lnL += weights[c] * l;
+	}
+	return lnL;
+}
+
+/*
+ * Pattern-interleaved kernels. The conditional likelihoods are stored in blocks of
+ * SOA_WIDTH patterns laid out as [category][state][pattern], so every SIMD lane holds a
+ * different pattern: the 4x4 products become vertical multiply-adds with broadcast
+ * P-matrix entries and no horizontal adds are needed. All pattern ranges are multiples of
+ * SOA_WIDTH, the padding patterns have weight 0. Site repeats are not supported here, the
+ * row indices are always NULL.
+ */
+#ifdef _TOM_AVX512
+#define SOA_WIDTH 8
+#else
+#define SOA_WIDTH 4
+#endif
+
+/* Rescale, per lane, the patterns of a block whose n conditional likelihoods are all below
+ * the threshold and count the scaling events in sc. */
+static inline void rescaleBlock(double *cl, int *sc, int n) {
+
+#ifdef _TOM_AVX512
+        __m512d
+                mx = _mm512_load_pd ( cl );
+        for (int v=1; v<n; v++)
+                mx = _mm512_max_pd ( mx, _mm512_load_pd ( cl + v * SOA_WIDTH ) );
+        __mmask8
+                m = _mm512_cmp_pd_mask ( mx, _mm512_set1_pd ( SCALE_THRESHOLD ), _CMP_LT_OQ );
+        if ( m != 0 ) {
+                __m512d
+                        sf = _mm512_set1_pd ( SCALE_FACTOR );
+                for (int v=0; v<n; v++) {
+                        __m512d
+                                x = _mm512_load_pd ( cl + v * SOA_WIDTH );
+                        _mm512_store_pd ( cl + v * SOA_WIDTH, _mm512_mask_mul_pd ( x, m, x, sf ) );
+                }
+                for (int l=0; l<SOA_WIDTH; l++)
+                        sc[l] += ( m >> l ) & 1;
+        }
+#elif _TOM_AVX2
+        __m256d
+                mx = _mm256_load_pd ( cl );
+        for (int v=1; v<n; v++)
+                mx = _mm256_max_pd ( mx, _mm256_load_pd ( cl + v * SOA_WIDTH ) );
+        __m256d
+                lt = _mm256_cmp_pd ( mx, _mm256_set1_pd ( SCALE_THRESHOLD ), _CMP_LT_OQ );
+        int
+                m = _mm256_movemask_pd ( lt );
+        if ( m != 0 ) {
+                __m256d
+                        sf = _mm256_blendv_pd ( _mm256_set1_pd ( 1.0 ), _mm256_set1_pd ( SCALE_FACTOR ), lt );
+                for (int v=0; v<n; v++)
+                        _mm256_store_pd ( cl + v * SOA_WIDTH, _mm256_mul_pd ( _mm256_load_pd ( cl + v * SOA_WIDTH ), sf ) );
+                for (int l=0; l<SOA_WIDTH; l++)
+                        sc[l] += ( m >> l ) & 1;
+        }
+#else
+        for (int l=0; l<SOA_WIDTH; l++) {
+                double mx = cl[l];
+                for (int v=1; v<n; v++)
+                        if ( cl[v * SOA_WIDTH + l] > mx )
+                                mx = cl[v * SOA_WIDTH + l];
+                if ( mx < SCALE_THRESHOLD ) {
+                        for (int v=0; v<n; v++)
+                                cl[v * SOA_WIDTH + l] *= SCALE_FACTOR;
+                        sc[l]++;
+                }
+        }
+#endif
+}
+
+template<int NCAT>
+static void innerInnerSoA(double *clP, int *scP, const double *clL, const int *scL,
+                          const double *clR, const int *scR, const double *tiL, const double *tiR,
+                          const int *, const int *, int, int begin, int end) {
+
+        const int numCats = NCAT;
+        const int blockStride = numCats * 4 * SOA_WIDTH;
+
+        for (int b=begin/SOA_WIDTH; b<end/SOA_WIDTH; b++) {
+                int p = b * blockStride;
+                for (int k=0; k<numCats; k++) {
+
+                        const double *tL = tiL + k * 16;
+                        const double *tR = tiR + k * 16;
+                        const double *cL = clL + p;
+                        const double *cR = clR + p;
+#ifdef _TOM_AVX512
+                        __m512d
+                                l0 = _mm512_load_pd ( cL ),
+                                l1 = _mm512_load_pd ( cL + 8 ),
+                                l2 = _mm512_load_pd ( cL + 16 ),
+                                l3 = _mm512_load_pd ( cL + 24 ),
+                                r0 = _mm512_load_pd ( cR ),
+                                r1 = _mm512_load_pd ( cR + 8 ),
+                                r2 = _mm512_load_pd ( cR + 16 ),
+                                r3 = _mm512_load_pd ( cR + 24 );
+                        for (int i=0; i<4; i++) {
+                                __m512d
+                                        sl, sr;
+                                sl = _mm512_mul_pd ( _mm512_set1_pd ( tL[i * 4 + 0] ), l0 );
+                                sl = _mm512_fmadd_pd ( _mm512_set1_pd ( tL[i * 4 + 1] ), l1, sl );
+                                sl = _mm512_fmadd_pd ( _mm512_set1_pd ( tL[i * 4 + 2] ), l2, sl );
+                                sl = _mm512_fmadd_pd ( _mm512_set1_pd ( tL[i * 4 + 3] ), l3, sl );
+                                sr = _mm512_mul_pd ( _mm512_set1_pd ( tR[i * 4 + 0] ), r0 );
+                                sr = _mm512_fmadd_pd ( _mm512_set1_pd ( tR[i * 4 + 1] ), r1, sr );
+                                sr = _mm512_fmadd_pd ( _mm512_set1_pd ( tR[i * 4 + 2] ), r2, sr );
+                                sr = _mm512_fmadd_pd ( _mm512_set1_pd ( tR[i * 4 + 3] ), r3, sr );
+                                _mm512_store_pd ( clP + p + i * SOA_WIDTH, _mm512_mul_pd ( sl, sr ) );
+                        }
+#elif _TOM_AVX2
+                        __m256d
+                                l0 = _mm256_load_pd ( cL ),
+                                l1 = _mm256_load_pd ( cL + 4 ),
+                                l2 = _mm256_load_pd ( cL + 8 ),
+                                l3 = _mm256_load_pd ( cL + 12 ),
+                                r0 = _mm256_load_pd ( cR ),
+                                r1 = _mm256_load_pd ( cR + 4 ),
+                                r2 = _mm256_load_pd ( cR + 8 ),
+                                r3 = _mm256_load_pd ( cR + 12 );
+                        for (int i=0; i<4; i++) {
+                                __m256d
+                                        sl, sr;
+                                sl = _mm256_mul_pd ( _mm256_broadcast_sd ( tL + i * 4 + 0 ), l0 );
+                                sl = _mm256_fmadd_pd ( _mm256_broadcast_sd ( tL + i * 4 + 1 ), l1, sl );
+                                sl = _mm256_fmadd_pd ( _mm256_broadcast_sd ( tL + i * 4 + 2 ), l2, sl );
+                                sl = _mm256_fmadd_pd ( _mm256_broadcast_sd ( tL + i * 4 + 3 ), l3, sl );
+                                sr = _mm256_mul_pd ( _mm256_broadcast_sd ( tR + i * 4 + 0 ), r0 );
+                                sr = _mm256_fmadd_pd ( _mm256_broadcast_sd ( tR + i * 4 + 1 ), r1, sr );
+                                sr = _mm256_fmadd_pd ( _mm256_broadcast_sd ( tR + i * 4 + 2 ), r2, sr );
+                                sr = _mm256_fmadd_pd ( _mm256_broadcast_sd ( tR + i * 4 + 3 ), r3, sr );
+                                _mm256_store_pd ( clP + p + i * SOA_WIDTH, _mm256_mul_pd ( sl, sr ) );
+                        }
+#else
+                        for (int i=0; i<4; i++)
+                                for (int l=0; l<SOA_WIDTH; l++) {
+                                        double sl = tL[i * 4 + 0] * cL[l] + tL[i * 4 + 1] * cL[SOA_WIDTH + l] +
+                                                    tL[i * 4 + 2] * cL[2 * SOA_WIDTH + l] + tL[i * 4 + 3] * cL[3 * SOA_WIDTH + l];
+                                        double sr = tR[i * 4 + 0] * cR[l] + tR[i * 4 + 1] * cR[SOA_WIDTH + l] +
+                                                    tR[i * 4 + 2] * cR[2 * SOA_WIDTH + l] + tR[i * 4 + 3] * cR[3 * SOA_WIDTH + l];
+                                        clP[p + i * SOA_WIDTH + l] = sl * sr;
+                                }
+#endif
+                        p += 4 * SOA_WIDTH;
+                }
+
+                int c = b * SOA_WIDTH;
+                for (int l=0; l<SOA_WIDTH; l++)
+                        scP[c + l] = scL[c + l] + scR[c + l];
+                rescaleBlock ( clP + b * blockStride, scP + c, numCats * 4 );
+        }
+}
+
+template<int NCAT>
+static void tipInnerSoA(double *clP, int *scP, const unsigned char *stL, const double *lkL,
+                        const double *clR, const int *scR, const double *tiR,
+                        const int *, int, int begin, int end) {
+
+        const int numCats = NCAT;
+        const int blockStride = numCats * 4 * SOA_WIDTH;
+
+        for (int b=begin/SOA_WIDTH; b<end/SOA_WIDTH; b++) {
+                int p = b * blockStride;
+                int c = b * SOA_WIDTH;
+#ifdef _TOM_AVX512
+                __m256i
+                        idx = _mm256_slli_epi32 ( _mm256_cvtepu8_epi32 ( _mm_loadl_epi64 ( (const __m128i *)( stL + c ) ) ), 2 );
+#elif _TOM_AVX2
+                __m128i
+                        idx = _mm_set_epi32 ( stL[c + 3] * 4, stL[c + 2] * 4, stL[c + 1] * 4, stL[c] * 4 );
+#endif
+                for (int k=0; k<numCats; k++) {
+
+                        const double *tR = tiR + k * 16;
+                        const double *lL = lkL + k * 64;
+                        const double *cR = clR + p;
+#ifdef _TOM_AVX512
+                        __m512d
+                                r0 = _mm512_load_pd ( cR ),
+                                r1 = _mm512_load_pd ( cR + 8 ),
+                                r2 = _mm512_load_pd ( cR + 16 ),
+                                r3 = _mm512_load_pd ( cR + 24 );
+                        for (int i=0; i<4; i++) {
+                                __m512d
+                                        sr;
+                                sr = _mm512_mul_pd ( _mm512_set1_pd ( tR[i * 4 + 0] ), r0 );
+                                sr = _mm512_fmadd_pd ( _mm512_set1_pd ( tR[i * 4 + 1] ), r1, sr );
+                                sr = _mm512_fmadd_pd ( _mm512_set1_pd ( tR[i * 4 + 2] ), r2, sr );
+                                sr = _mm512_fmadd_pd ( _mm512_set1_pd ( tR[i * 4 + 3] ), r3, sr );
+                                _mm512_store_pd ( clP + p + i * SOA_WIDTH, _mm512_mul_pd ( _mm512_i32gather_pd ( idx, lL + i, 8 ), sr ) );
+                        }
+#elif _TOM_AVX2
+                        __m256d
+                                r0 = _mm256_load_pd ( cR ),
+                                r1 = _mm256_load_pd ( cR + 4 ),
+                                r2 = _mm256_load_pd ( cR + 8 ),
+                                r3 = _mm256_load_pd ( cR + 12 );
+                        for (int i=0; i<4; i++) {
+                                __m256d
+                                        sr;
+                                sr = _mm256_mul_pd ( _mm256_broadcast_sd ( tR + i * 4 + 0 ), r0 );
+                                sr = _mm256_fmadd_pd ( _mm256_broadcast_sd ( tR + i * 4 + 1 ), r1, sr );
+                                sr = _mm256_fmadd_pd ( _mm256_broadcast_sd ( tR + i * 4 + 2 ), r2, sr );
+                                sr = _mm256_fmadd_pd ( _mm256_broadcast_sd ( tR + i * 4 + 3 ), r3, sr );
+                                _mm256_store_pd ( clP + p + i * SOA_WIDTH, _mm256_mul_pd ( _mm256_i32gather_pd ( lL + i, idx, 8 ), sr ) );
+                        }
+#else
+                        for (int i=0; i<4; i++)
+                                for (int l=0; l<SOA_WIDTH; l++) {
+                                        double sr = tR[i * 4 + 0] * cR[l] + tR[i * 4 + 1] * cR[SOA_WIDTH + l] +
+                                                    tR[i * 4 + 2] * cR[2 * SOA_WIDTH + l] + tR[i * 4 + 3] * cR[3 * SOA_WIDTH + l];
+                                        clP[p + i * SOA_WIDTH + l] = lL[stL[c + l] * 4 + i] * sr;
+                                }
+#endif
+                        p += 4 * SOA_WIDTH;
+                }
+
+                for (int l=0; l<SOA_WIDTH; l++)
+                        scP[c + l] = scR[c + l];
+                rescaleBlock ( clP + b * blockStride, scP + c, numCats * 4 );
+        }
+}
+
+template<int NCAT>
+static void tipTipSoA(double *clP, int *scP, const unsigned char *stL, const double *lkL,
+                      const unsigned char *stR, const double *lkR, int, int begin, int end) {
+
+        const int numCats = NCAT;
+        const int blockStride = numCats * 4 * SOA_WIDTH;
+
+        for (int b=begin/SOA_WIDTH; b<end/SOA_WIDTH; b++) {
+                int p = b * blockStride;
+                int c = b * SOA_WIDTH;
+                for (int k=0; k<numCats; k++) {
+                        const double *lL = lkL + k * 64;
+                        const double *lR = lkR + k * 64;
+                        for (int i=0; i<4; i++)
+                                for (int l=0; l<SOA_WIDTH; l++)
+                                        clP[p + i * SOA_WIDTH + l] = lL[stL[c + l] * 4 + i] * lR[stR[c + l] * 4 + i];
+                        p += 4 * SOA_WIDTH;
+                }
+                for (int l=0; l<SOA_WIDTH; l++)
+                        scP[c + l] = 0;
+        }
+}
+
+template<int NCAT>
+static double rootLnLSoA(const double *clP, const int *scP, const double *f,
+                         const int *weights, const double *invProbs, double pInv, int, int begin, int end, double *siteLnL) {
+
+        const int numCats = NCAT;
+        const int blockStride = numCats * 4 * SOA_WIDTH;
+        double catProb = 1.0 / numCats;
+        double lnL = 0.0;
+
+        for (int b=begin/SOA_WIDTH; b<end/SOA_WIDTH; b++) {
+                int p = b * blockStride;
+                int c = b * SOA_WIDTH;
+                double siteProb[SOA_WIDTH];
+#ifdef _TOM_AVX512
+                __m512d
+                        v = _mm512_setzero_pd ( );
+                for (int k=0; k<numCats; k++)
+                        for (int i=0; i<4; i++)
+                                v = _mm512_fmadd_pd ( _mm512_set1_pd ( f[i] ), _mm512_load_pd ( clP + p + ( k * 4 + i ) * SOA_WIDTH ), v );
+                _mm512_storeu_pd ( siteProb, v );
+#elif _TOM_AVX2
+                __m256d
+                        v = _mm256_setzero_pd ( );
+                for (int k=0; k<numCats; k++)
+                        for (int i=0; i<4; i++)
+                                v = _mm256_fmadd_pd ( _mm256_broadcast_sd ( f + i ), _mm256_load_pd ( clP + p + ( k * 4 + i ) * SOA_WIDTH ), v );
+                _mm256_storeu_pd ( siteProb, v );
+#else
+                for (int l=0; l<SOA_WIDTH; l++)
+                        siteProb[l] = 0.0;
+                for (int k=0; k<numCats; k++)
+                        for (int i=0; i<4; i++)
+                                for (int l=0; l<SOA_WIDTH; l++)
+                                        siteProb[l] += clP[p + ( k * 4 + i ) * SOA_WIDTH + l] * f[i];
+#endif
+                for (int l=0; l<SOA_WIDTH; l++) {
+                        double pl = patternLnL ( siteProb[l] * catProb, scP[c + l] * LN_SCALE_FACTOR, invProbs, pInv, c + l );
+                        if ( siteLnL != NULL )
+                                siteLnL[c + l] = pl;
+                        lnL += weights[c + l] * pl;
+                }
+        }
+        return lnL;
+}
+
+/*
+ * Single- and mixed-precision kernels: the conditional likelihoods are stored as float, with
+ * per-pattern scaling by 2^32 to keep them in range. With single precision the P-matrices and
+ * tip tables are float too and the SIMD code below processes VF_CATS gamma categories (4*VF_CATS
+ * floats) per register, twice as many values as the double kernels. With mixed precision the
+ * arithmetic is done in double (vectorized for AVX and up). The root log-likelihood is summed
+ * in double in both cases.
+ */
+#if defined(_TOM_AVX512)
+#define VF_CATS 4
+typedef __m512 vecf;
+static inline vecf vfLoad(const float *a) { return _mm512_loadu_ps ( a ); }
+static inline void vfStore(float *a, vecf v) { _mm512_storeu_ps ( a, v ); }
+static inline vecf vfMul(vecf a, vecf b) { return _mm512_mul_ps ( a, b ); }
+static inline vecf vfMadd(vecf a, vecf b, vecf c) { return _mm512_fmadd_ps ( a, b, c ); }
+static inline vecf vfMax(vecf a, vecf b) { return _mm512_max_ps ( a, b ); }
+static inline float vfHmax(vecf a) { return _mm512_reduce_max_ps ( a ); }
+#define vfSplat(v, j) _mm512_permute_ps ( v, (j) * 0x55 )
+#elif defined(_TOM_AVX)
+#define VF_CATS 2
+typedef __m256 vecf;
+static inline vecf vfLoad(const float *a) { return _mm256_loadu_ps ( a ); }
+static inline void vfStore(float *a, vecf v) { _mm256_storeu_ps ( a, v ); }
+static inline vecf vfMul(vecf a, vecf b) { return _mm256_mul_ps ( a, b ); }
+#ifdef _TOM_AVX2
+static inline vecf vfMadd(vecf a, vecf b, vecf c) { return _mm256_fmadd_ps ( a, b, c ); }
+#else
+static inline vecf vfMadd(vecf a, vecf b, vecf c) { return _mm256_add_ps ( _mm256_mul_ps ( a, b ), c ); }
+#endif
+static inline vecf vfMax(vecf a, vecf b) { return _mm256_max_ps ( a, b ); }
+static inline float vfHmax(vecf a) {
+        __m128 m = _mm_max_ps ( _mm256_castps256_ps128 ( a ), _mm256_extractf128_ps ( a, 1 ) );
+        m = _mm_max_ps ( m, _mm_movehl_ps ( m, m ) );
+        return _mm_cvtss_f32 ( _mm_max_ss ( m, _mm_shuffle_ps ( m, m, 1 ) ) );
+}
+#define vfSplat(v, j) _mm256_permute_ps ( v, (j) * 0x55 )
+#elif defined(_TOM_SSE3)
+#define VF_CATS 1
+typedef __m128 vecf;
+static inline vecf vfLoad(const float *a) { return _mm_loadu_ps ( a ); }
+static inline void vfStore(float *a, vecf v) { _mm_storeu_ps ( a, v ); }
+static inline vecf vfMul(vecf a, vecf b) { return _mm_mul_ps ( a, b ); }
+static inline vecf vfMadd(vecf a, vecf b, vecf c) { return _mm_add_ps ( _mm_mul_ps ( a, b ), c ); }
+static inline vecf vfMax(vecf a, vecf b) { return _mm_max_ps ( a, b ); }
+static inline float vfHmax(vecf a) {
+        __m128 m = _mm_max_ps ( a, _mm_movehl_ps ( a, a ) );
+        return _mm_cvtss_f32 ( _mm_max_ss ( m, _mm_shuffle_ps ( m, m, 1 ) ) );
+}
+#define vfSplat(v, j) _mm_shuffle_ps ( v, v, (j) * 0x55 )
+#endif
+
+// gamma categories per group in the single-precision P-matrix and tip table layout
+#ifdef VF_CATS
+#define SP_GROUP VF_CATS
+#else
+#define SP_GROUP 1
+#endif
+
+static inline int rescalePatternF(float *cl, int n) {
+
+        int i = 0;
+        float mx = 0.0f;
+#ifdef VF_CATS
+        if ( n >= 4 * VF_CATS ) {
+                vecf
+                        vm = vfLoad ( cl );
+                for (i=4*VF_CATS; i+4*VF_CATS<=n; i+=4*VF_CATS)
+                        vm = vfMax ( vm, vfLoad ( cl + i ) );
+                mx = vfHmax ( vm );
+        }
+#endif
+        for (; i<n; i++)
+                if ( cl[i] > mx )
+                        mx = cl[i];
+
+        int sc = 0;
+        while ( mx < SCALE_THRESHOLD_SP && mx > 0.0f ) {
+                for (i=0; i<n; i++)
+                        cl[i] *= SCALE_FACTOR_SP;
+                mx *= SCALE_FACTOR_SP;
+                sc++;
+        }
+        return sc;
+}
+
+/* The SIMD part of the float kernels for one pattern: whole groups of VF_CATS categories are
+ * done here and the number of categories done is returned, the rest is left to the scalar
+ * code. They are always inlined, so the number of categories is known at compile time. */
+#ifdef VF_CATS
+static inline __attribute__((always_inline)) int innerInnerVF(float *clP, const float *clL, const float *clR,
+                                                              const float *tiL, const float *tiR, int numCats) {
+
+        int k = 0;
+        for (; k+VF_CATS<=numCats; k+=VF_CATS) {
+                const float *tL = tiL + k * 16;
+                const float *tR = tiR + k * 16;
+                vecf
+                        cll = vfLoad ( clL + k * 4 ),
+                        clr = vfLoad ( clR + k * 4 ),
+                        sl, sr;
+
+                sl = vfMul ( vfLoad ( tL ), vfSplat ( cll, 0 ) );
+                sl = vfMadd ( vfLoad ( tL + 4 * VF_CATS ), vfSplat ( cll, 1 ), sl );
+                sl = vfMadd ( vfLoad ( tL + 8 * VF_CATS ), vfSplat ( cll, 2 ), sl );
+                sl = vfMadd ( vfLoad ( tL + 12 * VF_CATS ), vfSplat ( cll, 3 ), sl );
+
+                sr = vfMul ( vfLoad ( tR ), vfSplat ( clr, 0 ) );
+                sr = vfMadd ( vfLoad ( tR + 4 * VF_CATS ), vfSplat ( clr, 1 ), sr );
+                sr = vfMadd ( vfLoad ( tR + 8 * VF_CATS ), vfSplat ( clr, 2 ), sr );
+                sr = vfMadd ( vfLoad ( tR + 12 * VF_CATS ), vfSplat ( clr, 3 ), sr );
+
+                vfStore ( clP + k * 4, vfMul ( sl, sr ) );
+        }
+        return k;
+}
+#else
+static inline int innerInnerVF(float *, const float *, const float *, const float *, const float *, int) { return 0; }
+#endif
+
+/* Mixed precision: one category per register, the float conditional likelihoods are
+ * converted to double and back. */
+#ifdef _TOM_AVX
+#ifdef _TOM_AVX2
+static inline __m256d vdMadd(__m256d a, __m256d b, __m256d c) { return _mm256_fmadd_pd ( a, b, c ); }
+#else
+static inline __m256d vdMadd(__m256d a, __m256d b, __m256d c) { return _mm256_add_pd ( _mm256_mul_pd ( a, b ), c ); }
+#endif
+
+static inline __m256d branchSumVD(const double *t, const float *cl) {
+
+        __m256d
+                s = _mm256_mul_pd ( _mm256_load_pd ( t ), _mm256_set1_pd ( cl[0] ) );
+        s = vdMadd ( _mm256_load_pd ( t + 4 ), _mm256_set1_pd ( cl[1] ), s );
+        s = vdMadd ( _mm256_load_pd ( t + 8 ), _mm256_set1_pd ( cl[2] ), s );
+        s = vdMadd ( _mm256_load_pd ( t + 12 ), _mm256_set1_pd ( cl[3] ), s );
+        return s;
+}
+#endif
+
+#ifdef _TOM_AVX
+static inline __attribute__((always_inline)) int innerInnerVF(float *clP, const float *clL, const float *clR,
+                                                              const double *tiL, const double *tiR, int numCats) {
+
+        int k = 0;
+        for (; k<numCats; k++)
+                _mm_storeu_ps ( clP + k * 4, _mm256_cvtpd_ps ( _mm256_mul_pd ( branchSumVD ( tiL + k * 16, clL + k * 4 ),
+                                                                               branchSumVD ( tiR + k * 16, clR + k * 4 ) ) ) );
+        return k;
+}
+#else
+static inline int innerInnerVF(float *, const float *, const float *, const double *, const double *, int) { return 0; }
+#endif
+
+#ifdef VF_CATS
+static inline __attribute__((always_inline)) int tipInnerVF(float *clP, unsigned char st, const float *lkL, const float *clR,
+                                                            const float *tiR, int numCats) {
+
+        int k = 0;
+        for (; k+VF_CATS<=numCats; k+=VF_CATS) {
+                const float *tR = tiR + k * 16;
+                vecf
+                        clr = vfLoad ( clR + k * 4 ),
+                        sr;
+
+                sr = vfMul ( vfLoad ( tR ), vfSplat ( clr, 0 ) );
+                sr = vfMadd ( vfLoad ( tR + 4 * VF_CATS ), vfSplat ( clr, 1 ), sr );
+                sr = vfMadd ( vfLoad ( tR + 8 * VF_CATS ), vfSplat ( clr, 2 ), sr );
+                sr = vfMadd ( vfLoad ( tR + 12 * VF_CATS ), vfSplat ( clr, 3 ), sr );
+
+                vfStore ( clP + k * 4, vfMul ( vfLoad ( lkL + k * 64 + st * 4 * VF_CATS ), sr ) );
+        }
+        return k;
+}
+#else
+static inline int tipInnerVF(float *, unsigned char, const float *, const float *, const float *, int) { return 0; }
+#endif
+
+#ifdef _TOM_AVX
+static inline __attribute__((always_inline)) int tipInnerVF(float *clP, unsigned char st, const double *lkL, const float *clR,
+                                                            const double *tiR, int numCats) {
+
+        int k = 0;
+        for (; k<numCats; k++)
+                _mm_storeu_ps ( clP + k * 4, _mm256_cvtpd_ps ( _mm256_mul_pd ( _mm256_load_pd ( lkL + k * 64 + st * 4 ),
+                                                                               branchSumVD ( tiR + k * 16, clR + k * 4 ) ) ) );
+        return k;
+}
+#else
+static inline int tipInnerVF(float *, unsigned char, const double *, const float *, const double *, int) { return 0; }
+#endif
+
+#ifdef VF_CATS
+static inline __attribute__((always_inline)) int tipTipVF(float *clP, unsigned char sL, const float *lkL,
+                                                          unsigned char sR, const float *lkR, int numCats) {
+
+        int k = 0;
+        for (; k+VF_CATS<=numCats; k+=VF_CATS)
+                vfStore ( clP + k * 4, vfMul ( vfLoad ( lkL + k * 64 + sL * 4 * VF_CATS ),
+                                               vfLoad ( lkR + k * 64 + sR * 4 * VF_CATS ) ) );
+        return k;
+}
+#else
+static inline int tipTipVF(float *, unsigned char, const float *, unsigned char, const float *, int) { return 0; }
+#endif
+
+#ifdef _TOM_AVX
+static inline __attribute__((always_inline)) int tipTipVF(float *clP, unsigned char sL, const double *lkL,
+                                                          unsigned char sR, const double *lkR, int numCats) {
+
+        int k = 0;
+        for (; k<numCats; k++)
+                _mm_storeu_ps ( clP + k * 4, _mm256_cvtpd_ps ( _mm256_mul_pd ( _mm256_load_pd ( lkL + k * 64 + sL * 4 ),
+                                                                               _mm256_load_pd ( lkR + k * 64 + sR * 4 ) ) ) );
+        return k;
+}
+#else
+static inline int tipTipVF(float *, unsigned char, const double *, unsigned char, const double *, int) { return 0; }
+#endif
+
+/* The scalar float kernels, G is the category group of the P-matrix and tip table layout
+ * (TI_COLUMNS). The sums are formed in TiReal, so in double with mixed precision. */
+template<typename TiReal, int G, int NCAT>
+static void innerInnerF(float *clP, int *scP, const float *clL, const int *scL,
+                        const float *clR, const int *scR, const TiReal *tiL, const TiReal *tiR,
+                        const int *ixL, const int *ixR, int, int begin, int end) {
+
+        const int numCats = NCAT;
+        const int clStride = numCats * 4;
+
+        for (int c=begin; c<end; c++) {
+                int p = c * clStride;
+                int iL = ( ixL == NULL ? c : ixL[c] );
+                int iR = ( ixR == NULL ? c : ixR[c] );
+                int k = innerInnerVF ( clP + p, clL + iL * clStride, clR + iR * clStride, tiL, tiR, numCats );
+                for (; k<numCats; k++) {
+                        const TiReal *tL = tiL + ( k / G ) * 16 * G + ( k % G ) * 4;
+                        const TiReal *tR = tiR + ( k / G ) * 16 * G + ( k % G ) * 4;
+                        const float *cL = clL + iL * clStride + k * 4;
+                        const float *cR = clR + iR * clStride + k * 4;
+                        for (int i=0; i<4; i++) {
+                                TiReal sl = tL[i] * cL[0] + tL[4 * G + i] * cL[1] + tL[8 * G + i] * cL[2] + tL[12 * G + i] * cL[3];
+                                TiReal sr = tR[i] * cR[0] + tR[4 * G + i] * cR[1] + tR[8 * G + i] * cR[2] + tR[12 * G + i] * cR[3];
+                                clP[p + k * 4 + i] = (float)( sl * sr );
+                        }
+                }
+                scP[c] = scL[iL] + scR[iR] + rescalePatternF ( clP + p, clStride );
+        }
+}
+
+template<typename TiReal, int G, int NCAT>
+static void tipInnerF(float *clP, int *scP, const unsigned char *stL, const TiReal *lkL,
+                      const float *clR, const int *scR, const TiReal *tiR,
+                      const int *ixR, int, int begin, int end) {
+
+        const int numCats = NCAT;
+        const int clStride = numCats * 4;
+
+        for (int c=begin; c<end; c++) {
+                int p = c * clStride;
+                int iR = ( ixR == NULL ? c : ixR[c] );
+                int k = tipInnerVF ( clP + p, stL[c], lkL, clR + iR * clStride, tiR, numCats );
+                for (; k<numCats; k++) {
+                        const TiReal *tR = tiR + ( k / G ) * 16 * G + ( k % G ) * 4;
+                        const TiReal *lL = lkL + ( k / G ) * 64 * G + stL[c] * 4 * G + ( k % G ) * 4;
+                        const float *cR = clR + iR * clStride + k * 4;
+                        for (int i=0; i<4; i++) {
+                                TiReal sr = tR[i] * cR[0] + tR[4 * G + i] * cR[1] + tR[8 * G + i] * cR[2] + tR[12 * G + i] * cR[3];
+                                clP[p + k * 4 + i] = (float)( lL[i] * sr );
+                        }
+                }
+                scP[c] = scR[iR] + rescalePatternF ( clP + p, clStride );
+        }
+}
+
+/* Unlike the double kernels, products of two tip entries can fall below the single-precision
+ * threshold for very short branches, so these patterns are checked too. */
+template<typename TiReal, int G, int NCAT>
+static void tipTipF(float *clP, int *scP, const unsigned char *stL, const TiReal *lkL,
+                    const unsigned char *stR, const TiReal *lkR, int, int begin, int end) {
+
+        const int numCats = NCAT;
+        const int clStride = numCats * 4;
+
+        for (int c=begin; c<end; c++) {
+                int p = c * clStride;
+                int k = tipTipVF ( clP + p, stL[c], lkL, stR[c], lkR, numCats );
+                for (; k<numCats; k++) {
+                        const TiReal *lL = lkL + ( k / G ) * 64 * G + stL[c] * 4 * G + ( k % G ) * 4;
+                        const TiReal *lR = lkR + ( k / G ) * 64 * G + stR[c] * 4 * G + ( k % G ) * 4;
+                        for (int i=0; i<4; i++)
+                                clP[p + k * 4 + i] = (float)( lL[i] * lR[i] );
+                }
+                scP[c] = rescalePatternF ( clP + p, clStride );
+        }
+}
+
+template<int NCAT>
+static double rootLnLF(const float *clP, const int *scP, const double *f,
+                       const int *weights, const double *invProbs, double pInv, int, int begin, int end, double *siteLnL) {
+
+        const int numCats = NCAT;
+        const int clStride = numCats * 4;
+        double catProb = 1.0 / numCats;
+        double lnL = 0.0;
+
+        for (int c=begin; c<end; c++) {
+                const float *cl = clP + c * clStride;
+                double siteProb = 0.0;
+                for (int k=0; k<numCats; k++)
+                        siteProb += cl[k * 4 + 0] * f[0] + cl[k * 4 + 1] * f[1] + cl[k * 4 + 2] * f[2] + cl[k * 4 + 3] * f[3];
+                double l = patternLnL ( siteProb * catProb, scP[c] * LN_SCALE_FACTOR_SP, invProbs, pInv, c );
+                if ( siteLnL != NULL )
+                        siteLnL[c] = l;
+                lnL += weights[c] * l;
+        }
+        return lnL;
+}
+
+/*
+ * Kernels for NS states (AA_STATES for protein data), templated on the number of states and
+ * gamma categories. The conditional likelihoods of a branch are a sum of P-matrix columns
+ * weighted by the child's conditional likelihoods: every child likelihood is broadcast and
+ * multiplied into a whole column, NS / VS_WIDTH registers at a time, as in the 4-state AVX2
+ * kernels. The columns and tip table rows are padded to PADDED_STATES(NS) and NS must be a
+ * multiple of the vector width, except with AVX-512 where the last vector is masked.
+ */
+#if defined(_TOM_AVX512)
+#define VS_WIDTH 8
+typedef __m512d vecs;
+static inline vecs vsLoad(const double *a) { return _mm512_loadu_pd ( a ); }
+static inline vecs vsSet1(double a) { return _mm512_set1_pd ( a ); }
+static inline vecs vsMul(vecs a, vecs b) { return _mm512_mul_pd ( a, b ); }
+static inline vecs vsMadd(vecs a, vecs b, vecs c) { return _mm512_fmadd_pd ( a, b, c ); }
+static inline void vsStore(double *a, vecs v, int n) { _mm512_mask_storeu_pd ( a, ( n >= 8 ? 0xFF : ( 1 << n ) - 1 ), v ); }
+#elif defined(_TOM_AVX)
+#define VS_WIDTH 4
+typedef __m256d vecs;
+static inline vecs vsLoad(const double *a) { return _mm256_loadu_pd ( a ); }
+static inline vecs vsSet1(double a) { return _mm256_set1_pd ( a ); }
+static inline vecs vsMul(vecs a, vecs b) { return _mm256_mul_pd ( a, b ); }
+#ifdef _TOM_AVX2
+static inline vecs vsMadd(vecs a, vecs b, vecs c) { return _mm256_fmadd_pd ( a, b, c ); }
+#else
+static inline vecs vsMadd(vecs a, vecs b, vecs c) { return _mm256_add_pd ( _mm256_mul_pd ( a, b ), c ); }
+#endif
+static inline void vsStore(double *a, vecs v, int) { _mm256_storeu_pd ( a, v ); }
+#elif defined(_TOM_SSE3)
+#define VS_WIDTH 2
+typedef __m128d vecs;
+static inline vecs vsLoad(const double *a) { return _mm_loadu_pd ( a ); }
+static inline vecs vsSet1(double a) { return _mm_set1_pd ( a ); }
+static inline vecs vsMul(vecs a, vecs b) { return _mm_mul_pd ( a, b ); }
+static inline vecs vsMadd(vecs a, vecs b, vecs c) { return _mm_add_pd ( _mm_mul_pd ( a, b ), c ); }
+static inline void vsStore(double *a, vecs v, int) { _mm_storeu_pd ( a, v ); }
+#else
+#define VS_WIDTH 1
+typedef double vecs;
+static inline vecs vsLoad(const double *a) { return *a; }
+static inline vecs vsSet1(double a) { return a; }
+static inline vecs vsMul(vecs a, vecs b) { return a * b; }
+static inline vecs vsMadd(vecs a, vecs b, vecs c) { return a * b + c; }
+static inline void vsStore(double *a, vecs v, int) { *a = v; }
+#endif
+
+/* The conditional likelihoods of one category at the parent end of a branch, t is the
+ * P-matrix of the category and cl the child's conditional likelihoods. */
+template<int NS>
+static inline __attribute__((always_inline)) void branchSumsS(vecs *s, const double *t, const double *cl) {
+
+        const int nv = ( NS + VS_WIDTH - 1 ) / VS_WIDTH;
+        const int np = PADDED_STATES ( NS );
+        vecs b = vsSet1 ( cl[0] );
+        for (int v=0; v<nv; v++)
+                s[v] = vsMul ( vsLoad ( t + v * VS_WIDTH ), b );
+        for (int j=1; j<NS; j++) {
+                b = vsSet1 ( cl[j] );
+                for (int v=0; v<nv; v++)
+                        s[v] = vsMadd ( vsLoad ( t + j * np + v * VS_WIDTH ), b, s[v] );
+        }
+}
+
+template<int NS, int NCAT>
+static void innerInnerS(double *clP, int *scP, const double *clL, const int *scL,
+                        const double *clR, const int *scR, const double *tiL, const double *tiR,
+                        const int *ixL, const int *ixR, int, int begin, int end) {
+
+        const int numCats = NCAT;
+        const int nv = ( NS + VS_WIDTH - 1 ) / VS_WIDTH;
+        const int np = PADDED_STATES ( NS );
+        const int clStride = numCats * NS;
+
+        for (int c=begin; c<end; c++) {
+                int iL = ( ixL == NULL ? c : ixL[c] );
+                int iR = ( ixR == NULL ? c : ixR[c] );
+                double *cP = clP + c * clStride;
+                const double *cL = clL + iL * clStride;
+                const double *cR = clR + iR * clStride;
+                for (int k=0; k<numCats; k++) {
+                        vecs sl[nv], sr[nv];
+                        branchSumsS<NS> ( sl, tiL + k * NS * np, cL + k * NS );
+                        branchSumsS<NS> ( sr, tiR + k * NS * np, cR + k * NS );
+                        for (int v=0; v<nv; v++)
+                                vsStore ( cP + k * NS + v * VS_WIDTH, vsMul ( sl[v], sr[v] ), NS - v * VS_WIDTH );
+                }
+                scP[c] = scL[iL] + scR[iR] + rescalePattern ( cP, clStride );
+        }
+}
+
+template<int NS, int NCAT>
+static void tipInnerS(double *clP, int *scP, const unsigned char *stL, const double *lkL,
+                      const double *clR, const int *scR, const double *tiR,
+                      const int *ixR, int, int begin, int end) {
+
+        const int numCats = NCAT;
+        const int nv = ( NS + VS_WIDTH - 1 ) / VS_WIDTH;
+        const int np = PADDED_STATES ( NS );
+        const int clStride = numCats * NS;
+
+        for (int c=begin; c<end; c++) {
+                int iR = ( ixR == NULL ? c : ixR[c] );
+                double *cP = clP + c * clStride;
+                const double *cR = clR + iR * clStride;
+                const double *lL = lkL + stL[c] * numCats * np;
+                for (int k=0; k<numCats; k++) {
+                        vecs sr[nv];
+                        branchSumsS<NS> ( sr, tiR + k * NS * np, cR + k * NS );
+                        for (int v=0; v<nv; v++)
+                                vsStore ( cP + k * NS + v * VS_WIDTH, vsMul ( vsLoad ( lL + k * np + v * VS_WIDTH ), sr[v] ),
+                                          NS - v * VS_WIDTH );
+                }
+                scP[c] = scR[iR] + rescalePattern ( cP, clStride );
+        }
+}
+
+template<int NS, int NCAT>
+static void tipTipS(double *clP, int *scP, const unsigned char *stL, const double *lkL,
+                    const unsigned char *stR, const double *lkR, int, int begin, int end) {
+
+        const int numCats = NCAT;
+        const int nv = ( NS + VS_WIDTH - 1 ) / VS_WIDTH;
+        const int np = PADDED_STATES ( NS );
+        const int clStride = numCats * NS;
+
+        for (int c=begin; c<end; c++) {
+                double *cP = clP + c * clStride;
+                const double *lL = lkL + stL[c] * numCats * np;
+                const double *lR = lkR + stR[c] * numCats * np;
+                for (int k=0; k<numCats; k++)
+                        for (int v=0; v<nv; v++)
+                                vsStore ( cP + k * NS + v * VS_WIDTH,
+                                          vsMul ( vsLoad ( lL + k * np + v * VS_WIDTH ), vsLoad ( lR + k * np + v * VS_WIDTH ) ),
+                                          NS - v * VS_WIDTH );
+                scP[c] = 0;
+        }
+}
+
+template<int NS, int NCAT>
+static double rootLnLS(const double *clP, const int *scP, const double *f,
+                       const int *weights, const double *invProbs, double pInv, int, int begin, int end, double *siteLnL) {
+
+        const int numCats = NCAT;
+        double catProb = 1.0 / numCats;
+        double lnL = 0.0;
+        for (int c=begin; c<end; c++) {
+                const double *cP = clP + c * numCats * NS;
+                double siteProb = 0.0;
+                for (int k=0; k<numCats; k++)
+                        for (int i=0; i<NS; i++)
+                                siteProb += cP[k * NS + i] * f[i];
+                siteProb *= catProb;
+                double l = patternLnL ( siteProb, scP[c] * LN_SCALE_FACTOR, invProbs, pInv, c );
+                if ( siteLnL != NULL )
+                        siteLnL[c] = l;
+                lnL += weights[c] * l;
+        }
+        return lnL;
+}
+
+template<typename ClReal, typename TiReal>
+static inline void runOp(const LikelihoodKernelsT<ClReal, TiReal> *k, const KernelOpT<ClReal, TiReal> *o,
+                         int numCats, int begin, int end) {
+
+        if ( o->type == OP_TIP_TIP )
+                k->tipTip ( o->clP, o->scP, o->stL, o->tiL, o->stR, o->tiR, numCats, begin, end );
+        else if ( o->type == OP_TIP_INNER )
+                k->tipInner ( o->clP, o->scP, o->stL, o->tiL, o->clR, o->scR, o->tiR, o->ixR, numCats, begin, end );
+        else
+                k->innerInner ( o->clP, o->scP, o->clL, o->scL, o->clR, o->scR, o->tiL, o->tiR,
+                                o->ixL, o->ixR, numCats, begin, end );
+}
+
+static void adviseWillNeed(const void *p, size_t bytes) {
+
+        uintptr_t pageSize = (uintptr_t)sysconf ( _SC_PAGESIZE );
+        uintptr_t start = (uintptr_t)p & ~( pageSize - 1 );
+        madvise ( (void *)start, (uintptr_t)p + bytes - start, MADV_WILLNEED );
+}
+
+/* Ask the OS to read the rows [begin, end) of the internal children of an update from a
+ * file-backed arena, while the update before it runs. */
+template<typename ClReal, typename TiReal>
+static void adviseChildren(const LikelihoodKernelsT<ClReal, TiReal> *k, const KernelOpT<ClReal, TiReal> *o,
+                           int numCats, int begin, int end) {
+
+        size_t rowValues = (size_t)numCats * k->numStates;
+        if ( o->clL != NULL ) {
+                adviseWillNeed ( o->clL + begin * rowValues, ( end - begin ) * rowValues * sizeof(ClReal) );
+                adviseWillNeed ( o->scL + begin, ( end - begin ) * sizeof(int) );
+        }
+        if ( o->clR != NULL ) {
+                adviseWillNeed ( o->clR + begin * rowValues, ( end - begin ) * rowValues * sizeof(ClReal) );
+                adviseWillNeed ( o->scR + begin, ( end - begin ) * sizeof(int) );
+        }
+}
+
+template<typename ClReal, typename TiReal>
+static void runOps(const LikelihoodKernelsT<ClReal, TiReal> *k, const KernelOpT<ClReal, TiReal> *ops,
+                   int numOps, int numCats, int begin, int end) {
+
+        for (int i=0; i<numOps; i++) {
+                if ( i + 1 < numOps && ops[i + 1].willNeed == true && end > begin )
+                        adviseChildren ( k, ops + i + 1, numCats, begin, end );
+                runOp ( k, ops + i, numCats, begin, end );
+        }
+}
+
+/* The root reduction of the patterns [begin, end) of the partition pt. With grainLnL the
+ * log-likelihood of every grain of PATTERN_SLICE_GRAIN patterns is stored at the position of
+ * the grain in the partition instead (begin is the start of a grain), for evaluate to sum them
+ * in pattern order. */
+template<typename ClReal, typename TiReal>
+static double rootSum(const LikelihoodKernelsT<ClReal, TiReal> *k, const KernelPartitionT<ClReal, TiReal> *pt,
+                      int numCats, int begin, int end, double *grainLnL) {
+
+        if ( grainLnL == NULL )
+                return k->rootLnL ( pt->clRoot, pt->scRoot, pt->freqs, pt->weights, pt->invProbs, pt->pInv, numCats,
+                                    begin, end, pt->siteLnL );
+        for (int g=begin; g<end; g+=PATTERN_SLICE_GRAIN) {
+                int e = ( g + PATTERN_SLICE_GRAIN < end ? g + PATTERN_SLICE_GRAIN : end );
+                grainLnL[( g - pt->begin ) / PATTERN_SLICE_GRAIN] = k->rootLnL ( pt->clRoot, pt->scRoot, pt->freqs, pt->weights,
+                                                                                pt->invProbs, pt->pInv, numCats, g, e,
+                                                                                pt->siteLnL );
+        }
+        return 0.0;
+}
+
+// the grains of partition p in the sums of evaluate, or NULL if they are not kept
+static inline double *partGrains(double *grains, const int *grainBase, int p) {
+
+        return ( grains == NULL ? NULL : grains + grainBase[p] );
+}
+
+/* Run the node updates and the root reduction of the partition pt on the patterns [begin, end),
+ * in blocks of blockPatterns patterns: the whole dirty path is walked over one block before the
+ * next one, so the conditional likelihoods a node writes are still in cache when its parent
+ * reads them. */
+template<typename ClReal, typename TiReal>
+static double runSlice(const LikelihoodKernelsT<ClReal, TiReal> *k, const KernelPartitionT<ClReal, TiReal> *pt,
+                       int numCats, int begin, int end, int blockPatterns, double *grainLnL) {
+
+        if ( blockPatterns <= 0 )
+                blockPatterns = end - begin;
+        double lnL = 0.0;
+        for (int b=begin; b<end; b+=blockPatterns) {
+                int e = ( b + blockPatterns < end ? b + blockPatterns : end );
+                runOps ( k, pt->ops, pt->numOps, numCats, b, e );
+                lnL += rootSum ( k, pt, numCats, b, e, grainLnL );
+        }
+        return lnL;
+}
+
+/* With site repeats every node has its own number of rows and reads rows of its children that
+ * another thread may have written, so the updates are run node by node, each one split over the
+ * t-th of nt threads, and the threads wait for each other between the nodes. */
+template<typename ClReal, typename TiReal>
+static double runRepeats(const LikelihoodKernelsT<ClReal, TiReal> *k, const KernelPartitionT<ClReal, TiReal> *pt,
+                         int numCats, int t, int nt, double *grainLnL) {
+
+        int begin, end;
+        for (int i=0; i<pt->numOps; i++) {
+                patternSlice ( pt->ops[i].numRows, t, nt, &begin, &end );
+                runOp ( k, pt->ops + i, numCats, begin, end );
+#ifdef _OPENMP
+                #pragma omp barrier
+#endif
+        }
+        patternSlice ( pt->end, t, nt, &begin, &end );
+        return rootSum ( k, pt, numCats, begin, end, grainLnL );
+}
+
+/* All updates and root reductions in the calling thread, the partitions one after the other. */
+template<typename ClReal, typename TiReal>
+static double runSerial(const LikelihoodKernelsT<ClReal, TiReal> *k, const KernelPartitionT<ClReal, TiReal> *parts,
+                        int numParts, int numCats, int blockPatterns, bool isRepeats, double *grains,
+                        const int *grainBase, double *partLnL) {
+
+        if ( isRepeats == true ) {
+                double lnL = runRepeats ( k, parts, numCats, 0, 1, grains );
+                if ( partLnL != NULL )
+                        partLnL[0] = lnL;
+                return lnL;
+        }
+        double lnL = 0.0;
+        for (int p=0; p<numParts; p++) {
+                double l = runSlice ( k, parts + p, numCats, parts[p].begin, parts[p].end, blockPatterns,
+                                      partGrains ( grains, grainBase, p ) );
+                lnL += l;
+                if ( partLnL != NULL )
+                        partLnL[p] = l;
+        }
+        return lnL;
+}
+
+#ifdef _OPENMP
+/* Run the node updates as a graph of tasks on nt threads. Every update is split into chunks of
+ * patterns, a slice per thread or a cache block if that is smaller, and the chunk of a node is
+ * ready as soon as the same chunk of its updated children is done, so sibling subtrees, and the
+ * partitions, run on different threads at the same time. The dependencies are on the
+ * conditional likelihoods that the updates read and write, which also orders the nodes that
+ * share a scratch buffer (-clmem). The chunks depend on the number of threads, so the root
+ * reductions store the log-likelihoods of their grains, which evaluate sums in pattern order:
+ * the result depends neither on the schedule nor on the number of threads. */
+template<typename ClReal, typename TiReal>
+static void runTasks(const LikelihoodKernelsT<ClReal, TiReal> *k, const KernelPartitionT<ClReal, TiReal> *parts,
+                     int numParts, int numCats, int blockPatterns, int nt, double *grains, const int *grainBase) {
+
+        int numPatterns = 0;
+        for (int p=0; p<numParts; p++)
+                numPatterns += parts[p].end - parts[p].begin;
+        int chunk = ( ( numPatterns + nt - 1 ) / nt + PATTERN_SLICE_GRAIN - 1 ) / PATTERN_SLICE_GRAIN * PATTERN_SLICE_GRAIN;
+        if ( blockPatterns > 0 && blockPatterns < chunk )
+                chunk = blockPatterns;
+        if ( chunk <= 0 )
+                chunk = PATTERN_SLICE_GRAIN;
+        size_t rowValues = (size_t)numCats * k->numStates;
+        // the tip children have no conditional likelihoods to wait for
+        ClReal none = 0;
+        #pragma omp parallel num_threads(nt)
+        #pragma omp single
+        {
+                for (int p=0; p<numParts; p++) {
+                        const KernelPartitionT<ClReal, TiReal> *pt = parts + p;
+                        double *grainLnL = partGrains ( grains, grainBase, p );
+                        for (int i=0; i<pt->numOps; i++) {
+                                const KernelOpT<ClReal, TiReal> *o = pt->ops + i;
+                                for (int b=pt->begin; b<pt->end; b+=chunk) {
+                                        int e = ( b + chunk < pt->end ? b + chunk : pt->end );
+                                        const ClReal *inL = ( o->clL != NULL ? o->clL + b * rowValues : &none );
+                                        const ClReal *inR = ( o->clR != NULL ? o->clR + b * rowValues : &none );
+                                        ClReal *out = o->clP + b * rowValues;
+                                        #pragma omp task firstprivate(o, b, e) depend(in: inL[0], inR[0]) depend(out: out[0])
+                                        runOp ( k, o, numCats, b, e );
+                                }
+                        }
+                        for (int b=pt->begin; b<pt->end; b+=chunk) {
+                                int e = ( b + chunk < pt->end ? b + chunk : pt->end );
+                                const ClReal *in = pt->clRoot + b * rowValues;
+                                #pragma omp task firstprivate(pt, b, e, grainLnL) depend(in: in[0])
+                                rootSum ( k, pt, numCats, b, e, grainLnL );
+                        }
+                }
+        }
+}
+
+#endif
+
+/* Run the node updates of one likelihood evaluation and the root reduction. In the OpenMP
+ * builds the threads enter one parallel region per evaluation and each thread runs all
+ * updates on its own slice of the patterns: a node only reads the slice of its children that
+ * the same thread has just written, so no barrier is needed between the nodes. With several
+ * parts the slices are cut across the parts by the cost of their updates (see partitionSlice).
+ * The partial log-likelihoods of the slices are summed in slice order after the region. The
+ * schedule may ask for the updates to be run by runTasks instead, on fewer threads, or in the
+ * calling thread (numThreads 1). The root reductions of the tasks, and with fixedOrder those of all
+ * schedules, are summed grain by grain in pattern order, so the log-likelihood does not depend
+ * on the schedule. */
+template<typename ClReal, typename TiReal>
+static double evaluate(const LikelihoodKernelsT<ClReal, TiReal> *k, const KernelPartitionT<ClReal, TiReal> *parts,
+                       int numParts, int numCats, int blockPatterns, const KernelSchedule *sched, double *partLnL) {
+
+        const KernelPartitionT<ClReal, TiReal> *pt = parts;
+        bool isRepeats = ( numParts == 1 && pt->numOps > 0 && pt->ops[0].numRows > 0 );
+        bool useTasks = false;
+#ifdef _OPENMP
+        useTasks = ( sched->numThreads != 1 && sched->taskGraph == true && isRepeats == false );
+#endif
+        double *grains = NULL;
+        int *grainBase = NULL;
+        if ( sched->fixedOrder == true || useTasks == true ) {
+                grainBase = (int *)malloc ( ( numParts + 1 ) * sizeof(int) );
+                grainBase[0] = 0;
+                for (int p=0; p<numParts; p++)
+                        grainBase[p + 1] = grainBase[p] + ( parts[p].end - parts[p].begin + PATTERN_SLICE_GRAIN - 1 ) / PATTERN_SLICE_GRAIN;
+                grains = (double *)calloc ( grainBase[numParts] > 0 ? grainBase[numParts] : 1, sizeof(double) );
+        }
+        double lnL = 0.0;
+#ifdef _OPENMP
+        int maxThreads = ( sched->numThreads > 0 ? sched->numThreads : omp_get_max_threads ( ) );
+        if ( sched->numThreads == 1 )
+                lnL = runSerial ( k, parts, numParts, numCats, blockPatterns, isRepeats, grains, grainBase, partLnL );
+        else if ( useTasks == true )
+                runTasks ( k, parts, numParts, numCats, blockPatterns, maxThreads, grains, grainBase );
+        else {
+                // one cache line per thread for the partial sums, and the sums of the partitions of
+                // every thread
+                double *partial = (double *)calloc ( maxThreads * 8, sizeof(double) );
+                double *partPartial = NULL;
+                if ( partLnL != NULL && numParts > 1 )
+                        partPartial = (double *)calloc ( maxThreads * numParts, sizeof(double) );
+                // the rows of every part and its cost per pattern, its updates and the root
+                int *partBegin = (int *)malloc ( 3 * numParts * sizeof(int) );
+                int *partEnd = partBegin + numParts;
+                int *partCost = partEnd + numParts;
+                for (int p=0; p<numParts; p++) {
+                        partBegin[p] = parts[p].begin;
+                        partEnd[p] = parts[p].end;
+                        partCost[p] = parts[p].numOps + 1;
+                }
+                int usedThreads = 1;
+                #pragma omp parallel num_threads(maxThreads)
+                {
+                        int t = omp_get_thread_num ( );
+                        int nt = omp_get_num_threads ( );
+                        int begin, end;
+                        if ( isRepeats == true )
+                                partial[t * 8] = runRepeats ( k, pt, numCats, t, nt, grains );
+                        else if ( numParts == 1 ) {
+                                patternSlice ( pt->end - pt->begin, t, nt, &begin, &end );
+                                partial[t * 8] = runSlice ( k, pt, numCats, pt->begin + begin, pt->begin + end, blockPatterns,
+                                                            grains );
+                        }
+                        else {
+                                double l = 0.0;
+                                for (int p=0; p<numParts; p++) {
+                                        partitionSlice ( partBegin, partEnd, partCost, numParts, p, t, nt, &begin, &end );
+                                        if ( begin < end ) {
+                                                double lp = runSlice ( k, parts + p, numCats, begin, end, blockPatterns,
+                                                                       partGrains ( grains, grainBase, p ) );
+                                                l += lp;
+                                                if ( partPartial != NULL )
+                                                        partPartial[t * numParts + p] = lp;
+                                        }
+                                }
+                                partial[t * 8] = l;
+                        }
+                        if ( t == 0 )
+                                usedThreads = nt;
+                }
+                for (int t=0; t<usedThreads; t++)
+                        lnL += partial[t * 8];
+                if ( partPartial != NULL ) {
+                        for (int p=0; p<numParts; p++) {
+                                partLnL[p] = 0.0;
+                                for (int t=0; t<usedThreads; t++)
+                                        partLnL[p] += partPartial[t * numParts + p];
+                        }
+                }
+                else if ( partLnL != NULL )
+                        partLnL[0] = lnL;
+                free ( partial );
+                free ( partPartial );
+                free ( partBegin );
+        }
+#else
+        lnL = runSerial ( k, parts, numParts, numCats, blockPatterns, isRepeats, grains, grainBase, partLnL );
+#endif
+        if ( grains != NULL ) {
+                lnL = 0.0;
+                for (int p=0; p<numParts; p++) {
+                        double l = 0.0;
+                        for (int g=grainBase[p]; g<grainBase[p + 1]; g++)
+                                l += grains[g];
+                        if ( partLnL != NULL )
+                                partLnL[p] = l;
+                        lnL += l;
+                }
+                free ( grains );
+                free ( grainBase );
+        }
+        return lnL;
+}
+
+#if defined(_TOM_AVX512)
+#define KERNEL_SET_NAME "avx512"
+#define KERNEL_TI_LAYOUT TI_COLUMNS
+#define KERNEL_CAT_GROUP 2
+#elif defined(_TOM_AVX2)
+#define KERNEL_SET_NAME "avx2"
+#define KERNEL_TI_LAYOUT TI_COLUMNS
+#define KERNEL_CAT_GROUP 1
+#elif defined(_TOM_AVX)
+#define KERNEL_SET_NAME "avx"
+#define KERNEL_TI_LAYOUT TI_ROWS
+#define KERNEL_CAT_GROUP 1
+#elif defined(_TOM_SSE3)
+#define KERNEL_SET_NAME "sse3"
+#define KERNEL_TI_LAYOUT TI_ROWS
+#define KERNEL_CAT_GROUP 1
+#else
+#define KERNEL_SET_NAME "seq"
+#define KERNEL_TI_LAYOUT TI_ROWS
+#define KERNEL_CAT_GROUP 1
+#endif
+
+/* The kernels of this instruction set, compiled for NCAT gamma categories so the loops over
+ * the categories are unrolled. Every instruction set has its own tables, so they must not be
+ * visible outside this file. */
+namespace {
+template<int NCAT>
+struct KernelTables {
+        static const LikelihoodKernels          kernels;
+        static const LikelihoodKernels          soaKernels;
+        static const SingleLikelihoodKernels    singleKernels;
+        static const MixedLikelihoodKernels     mixedKernels;
+        static const LikelihoodKernels          aminoAcidKernels;
+        static const KernelSet                  kernelSet;
+};
+
+template<int NCAT>
+const LikelihoodKernels KernelTables<NCAT>::kernels = { KERNEL_SET_NAME, KERNEL_TI_LAYOUT, KERNEL_CAT_GROUP, 1, 4,
+        innerInner<NCAT>, tipInner<NCAT>, tipTip<NCAT>, rootLnL<NCAT>, evaluate<double, double> };
+template<int NCAT>
+const LikelihoodKernels KernelTables<NCAT>::soaKernels = { KERNEL_SET_NAME "-soa", TI_ROWS, 1, SOA_WIDTH, 4,
+        innerInnerSoA<NCAT>, tipInnerSoA<NCAT>, tipTipSoA<NCAT>, rootLnLSoA<NCAT>, evaluate<double, double> };
+template<int NCAT>
+const SingleLikelihoodKernels KernelTables<NCAT>::singleKernels = { "single", TI_COLUMNS, SP_GROUP, 1, 4,
+        innerInnerF<float, SP_GROUP, NCAT>, tipInnerF<float, SP_GROUP, NCAT>, tipTipF<float, SP_GROUP, NCAT>,
+        rootLnLF<NCAT>, evaluate<float, float> };
+template<int NCAT>
+const MixedLikelihoodKernels KernelTables<NCAT>::mixedKernels = { "mixed", TI_COLUMNS, 1, 1, 4,
+        innerInnerF<double, 1, NCAT>, tipInnerF<double, 1, NCAT>, tipTipF<double, 1, NCAT>,
+        rootLnLF<NCAT>, evaluate<float, double> };
+template<int NCAT>
+const LikelihoodKernels KernelTables<NCAT>::aminoAcidKernels = { KERNEL_SET_NAME "-aa", TI_COLUMNS, 1, 1, AA_STATES,
+        innerInnerS<AA_STATES, NCAT>, tipInnerS<AA_STATES, NCAT>, tipTipS<AA_STATES, NCAT>, rootLnLS<AA_STATES, NCAT>,
+        evaluate<double, double> };
+template<int NCAT>
+const KernelSet KernelTables<NCAT>::kernelSet = { KERNEL_SET_NAME, &kernels, &soaKernels, &singleKernels, &mixedKernels,
+        &aminoAcidKernels };
+}
+
+static const KernelSet* kernelSetFor(int numCats) {
+
+        switch ( numCats ) {
+                case 1: return &KernelTables<1>::kernelSet;
+                case 2: return &KernelTables<2>::kernelSet;
+                case 4: return &KernelTables<4>::kernelSet;
+                case 8: return &KernelTables<8>::kernelSet;
+        }
+        return NULL;
+}
+
+#if defined(_TOM_AVX512)
+const KernelSet* getAVX512Kernels(int numCats) { return kernelSetFor ( numCats ); }
+#elif defined(_TOM_AVX2)
+const KernelSet* getAVX2Kernels(int numCats) { return kernelSetFor ( numCats ); }
+#elif defined(_TOM_AVX)
+const KernelSet* getAVXKernels(int numCats) { return kernelSetFor ( numCats ); }
+#elif defined(_TOM_SSE3)
+const KernelSet* getSSE3Kernels(int numCats) { return kernelSetFor ( numCats ); }
+#else
+const KernelSet* getSeqKernels(int numCats) { return kernelSetFor ( numCats ); }
+#endif
@@ -0,0 +1,247 @@
+/* 
+ * DPPDiv version 1.1b source code (https://github.com/trayc7/FDPPDIV)
+ * Copyright 2009-2013
+ * Tracy Heath(1,2,3) 
+ * Mark Holder(1)
+ * John Huelsenbeck(2)
+ *
+ * (1) Department of Ecology and Evolutionary Biology, University of Kansas, Lawrence, KS 66045
+ * (2) Integrative Biology, University of California, Berkeley, CA 94720-3140
+ * (3) email: tracyh@berkeley.edu
+ *
+ * Also: T Stadler, D Darriba, AJ Aberer, T Flouri, F Izquierdo-Carrasco, and A Stamatakis
+ *
+ * DPPDiv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License (the file gpl.txt included with this
+ * distribution or http://www.gnu.org/licenses/gpl.txt for more
+ * details.
+ *
+ * Some of this code is from publicly available source by John Huelsenbeck and Fredrik Ronquist
+ *
+ */
+
+
+#ifndef MODEL_KERNELS_H
+#define MODEL_KERNELS_H
+
+#include <string>
+
+// conditional likelihoods of a pattern are rescaled by 2^256 once they all fall below 2^-256
+#define SCALE_THRESHOLD 8.636168555094445e-78
+#define SCALE_FACTOR 1.157920892373162e+77
+#define LN_SCALE_FACTOR 177.445678223346
+
+// single-precision conditional likelihoods are rescaled by 2^32 while they all are below 2^-32
+#define SCALE_THRESHOLD_SP 2.3283064365386963e-10f
+#define SCALE_FACTOR_SP 4294967296.0f
+#define LN_SCALE_FACTOR_SP 22.18070977791825
+
+// the category groups of all kernels divide this, the P-matrix and tip table buffers are padded to it
+#define MAX_CAT_GROUP 4
+
+// patterns are handed to the threads in slices that are multiples of this (and of every patternBlock)
+#define PATTERN_SLICE_GRAIN 16
+
+// the state-count kernels pad every P-matrix column and tip table row of n states to this length
+#define PADDED_STATES(n) ((((n) + 7) / 8) * 8)
+
+// number of amino acid states, the kernels for them are compiled along with the nucleotide ones
+#define AA_STATES 20
+
+/*
+ * The pruning and root-reduction kernels used by Model::lnLikelihood. Every instruction set
+ * variant is built from Model_kernels.cpp in its own translation unit (see the Makefile) and
+ * exposes its kernels through a KernelSet; selectLikelihoodKernels picks the best variant
+ * supported by the CPU at startup.
+ *
+ * Conditional likelihoods are laid out as [pattern][category][state], or, for the
+ * pattern-interleaved kernels, in blocks of patternBlock patterns laid out as
+ * [category][state][pattern]. They are stored as ClReal and the P-matrices and tip lookup
+ * tables as TiReal: double/double, float/float (single) or float/double (mixed precision,
+ * the arithmetic is done in double). The root log-likelihood is always summed in double.
+ *
+ * The gamma categories are split into groups of catGroup categories, one group per SIMD
+ * register. The tip lookup tables are laid out as [group][code][category in group][state]
+ * and the P-matrices as [group][from][category in group][to] (TI_ROWS) or
+ * [group][to][category in group][from] (TI_COLUMNS).
+ *
+ * The kernels for other numbers of states than 4 (AA_STATES for protein data) keep the
+ * [pattern][category][state] layout, with one category per group. Their P-matrices are laid
+ * out as [category][to][from] and their tip lookup tables as [code][category][state], the
+ * columns and rows padded to PADDED_STATES(numStates); the codes are those of
+ * Model::tipCodeStates.
+ *
+ * The node kernels work on the patterns [begin, end). A likelihood evaluation is handed to
+ * the kernels as a list of KernelOps in post order, which evaluate runs, in the OpenMP
+ * builds, inside a single parallel region and over cache-sized blocks of patterns, or as a
+ * graph of tasks over the nodes and chunks of patterns. The partitions of an alignment share
+ * the buffers, each one has its own range of patterns, updates and root (KernelPartitionT).
+ */
+enum TiLayout {
+	TI_ROWS,
+	TI_COLUMNS
+};
+
+enum ClPrecision {
+	CL_DOUBLE,
+	CL_SINGLE,
+	CL_MIXED
+};
+
+enum KernelOpType {
+	OP_TIP_TIP,
+	OP_TIP_INNER,
+	OP_INNER_INNER
+};
+
+// the update of the conditional likelihoods of one node, a single tip child is always the left one
+template<typename ClReal, typename TiReal>
+struct KernelOpT {
+	KernelOpType		type;
+	ClReal				*clP;
+	int					*scP;
+	const unsigned char	*stL, *stR;		// tip states of tip children
+	const ClReal		*clL, *clR;		// conditional likelihoods of internal children
+	const int			*scL, *scR;
+	const TiReal		*tiL, *tiR;		// P-matrices, or tip lookup tables for tip children
+	int					numRows;		// with site repeats: the number of unique rows of this node, else 0
+	const int			*ixL, *ixR;		// with site repeats: the child row of each row, else NULL
+	bool				willNeed;		// ask the OS to read the children ahead (file-backed arena)
+};
+
+// how the OpenMP builds run an evaluation; the single-threaded build only uses fixedOrder
+struct KernelSchedule {
+	int					numThreads;		// 0 for all threads, 1 for the calling thread only
+	bool				taskGraph;		// schedule the updates as tasks (not with site repeats)
+	bool				fixedOrder;		// sum the root reduction in pattern order, independent of the threads
+};
+
+// the updates and the root reduction of one partition of the alignment, on its patterns
+// [begin, end) of the shared conditional likelihood buffers
+template<typename ClReal, typename TiReal>
+struct KernelPartitionT {
+	const KernelOpT<ClReal, TiReal>	*ops;
+	int					numOps;
+	const ClReal		*clRoot;
+	const int			*scRoot;
+	const double		*freqs;
+	const int			*weights;
+	const double		*invProbs;		// +I, as for rootLnL
+	double				pInv;
+	double				*siteLnL;		// log-likelihood of every pattern, as for rootLnL, or NULL
+	int					begin, end;
+};
+
+template<typename ClReal, typename TiReal>
+struct LikelihoodKernelsT {
+	const char	*name;
+	TiLayout	tiLayout;		// how the kernels want the P-matrices of a branch laid out
+	int			catGroup;		// gamma categories per group in the P-matrix and tip table layout
+	int			patternBlock;	// number of interleaved patterns per block, 1 if not interleaved
+	int			numStates;		// number of character states, 4 for nucleotides
+	void		(*innerInner)(ClReal *clP, int *scP, const ClReal *clL, const int *scL,
+							  const ClReal *clR, const int *scR, const TiReal *tiL, const TiReal *tiR,
+							  const int *ixL, const int *ixR, int numCats, int begin, int end);
+	void		(*tipInner)(ClReal *clP, int *scP, const unsigned char *stL, const TiReal *lkL,
+							const ClReal *clR, const int *scR, const TiReal *tiR,
+							const int *ixR, int numCats, int begin, int end);
+	void		(*tipTip)(ClReal *clP, int *scP, const unsigned char *stL, const TiReal *lkL,
+						  const unsigned char *stR, const TiReal *lkR, int numCats, int begin, int end);
+	// invProbs is the probability of each pattern under the invariant sites (+I) model, mixed
+	// in with the proportion pInv, or NULL without +I. siteLnL, if not NULL, receives the
+	// (unweighted) log-likelihood of every pattern
+	double		(*rootLnL)(const ClReal *clP, const int *scP, const double *freqs, const int *weights,
+						   const double *invProbs, double pInv, int numCats, int begin, int end, double *siteLnL);
+	// run the node updates of the partitions and return the summed log-likelihood at the root,
+	// blockPatterns patterns at a time (a multiple of PATTERN_SLICE_GRAIN, or 0 for all patterns
+	// of a thread at once); with site repeats there is one partition, and its patterns and
+	// weights are those of the unique rows of the root. The threads are used as sched says.
+	// partLnL, if not NULL, receives the log-likelihood of every partition
+	double		(*evaluate)(const LikelihoodKernelsT<ClReal, TiReal> *k, const KernelPartitionT<ClReal, TiReal> *parts,
+							int numParts, int numCats, int blockPatterns, const KernelSchedule *sched, double *partLnL);
+};
+
+typedef LikelihoodKernelsT<double, double>	LikelihoodKernels;
+typedef LikelihoodKernelsT<float, float>	SingleLikelihoodKernels;
+typedef LikelihoodKernelsT<float, double>	MixedLikelihoodKernels;
+typedef KernelOpT<double, double>			KernelOp;
+
+// all kernels of one instruction set variant
+struct KernelSet {
+	const char						*name;
+	const LikelihoodKernels			*patternMajor;
+	const LikelihoodKernels			*interleaved;
+	const SingleLikelihoodKernels	*single;
+	const MixedLikelihoodKernels	*mixed;
+	const LikelihoodKernels			*aminoAcid;		// AA_STATES states, pattern-major
+};
+
+// the kernels are compiled for these numbers of gamma categories, the getters return NULL for others
+#define IS_KERNEL_CAT_COUNT(n) ((n) == 1 || (n) == 2 || (n) == 4 || (n) == 8)
+
+const KernelSet*		getSeqKernels(int numCats);
+const KernelSet*		getSSE3Kernels(int numCats);
+const KernelSet*		getAVXKernels(int numCats);
+const KernelSet*		getAVX2Kernels(int numCats);
+const KernelSet*		getAVX512Kernels(int numCats);
+const KernelSet*		selectLikelihoodKernels(std::string kn, int numCats);
+
+/* The patterns [begin, end) of the t-th of nt slices. The slices depend only on the number
+ * of threads, so every thread works on the same conditional likelihoods in every call, and
+ * the likelihood arena places them on the NUMA node of that thread (see ModelArena). */
+static inline void patternSlice(int numPatterns, int t, int nt, int *begin, int *end) {
+
+	int nGrains = (numPatterns + PATTERN_SLICE_GRAIN - 1) / PATTERN_SLICE_GRAIN;
+	*begin = ((long)t * nGrains / nt) * PATTERN_SLICE_GRAIN;
+	*end = ((long)(t + 1) * nGrains / nt) * PATTERN_SLICE_GRAIN;
+	if (*begin > numPatterns)
+		*begin = numPatterns;
+	if (*end > numPatterns)
+		*end = numPatterns;
+}
+
+/* The patterns [begin, end) of part pt that the t-th of nt slices gets with several parts, part
+ * p covering the rows partBegin[p] to partEnd[p] at a cost of partCost[p] per pattern. The
+ * grains of PATTERN_SLICE_GRAIN patterns of all parts, weighted by their cost, are laid on one
+ * line that is cut into nt equal pieces, so a slice may hold the end of one part and the start
+ * of the next, and the cost, not the number of patterns, is balanced. The parts need not follow
+ * each other in the rows. If all parts cost the same, as the partitions of the arena (see
+ * ModelArena::firstTouch) and the evaluations that update the same nodes in all partitions, the
+ * cuts only depend on the rows and the number of threads. */
+static inline void partitionSlice(const int *partBegin, const int *partEnd, const int *partCost, int numParts,
+                                  int pt, int t, int nt, int *begin, int *end) {
+
+	long total = 0, first = 0;
+	for (int p=0; p<numParts; p++)
+		{
+		if (p == pt)
+			first = total;
+		total += (long)(partEnd[p] - partBegin[p] + PATTERN_SLICE_GRAIN - 1) / PATTERN_SLICE_GRAIN * partCost[p];
+		}
+	long cost = partCost[pt];
+	long grains = (partEnd[pt] - partBegin[pt] + PATTERN_SLICE_GRAIN - 1) / PATTERN_SLICE_GRAIN;
+	long cut[2] = { (long)t * total / nt, (long)(t + 1) * total / nt };
+	int pos[2];
+	for (int i=0; i<2; i++)
+		{
+		long g = (cut[i] - first + cost - 1) / cost;
+		if (g < 0)
+			g = 0;
+		if (g > grains)
+			g = grains;
+		pos[i] = partBegin[pt] + (int)g * PATTERN_SLICE_GRAIN;
+		if (pos[i] > partEnd[pt])
+			pos[i] = partEnd[pt];
+		}
+	*begin = pos[0];
+	*end = pos[1];
+}
+
+#endif
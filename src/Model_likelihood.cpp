@@ -27,17 +27,18 @@
  *
  */
 
-#include "cpuspec.h"
 #include "Alignment.h"
 #include "MbRandom.h"
 #include "MbTransitionMatrix.h"
 #include "Model.h"
+#include "Model_kernels.h"
 #include "Parameter.h"
 #include "Parameter_basefreq.h"
 #include "Parameter_exchangeability.h"
 #include "Parameter_expcalib.h"
 #include "Parameter_rate.h"
 #include "Parameter_shape.h"
+#include "Parameter_pinvar.h"
 #include "Parameter_speciaton.h"
 #include "Parameter_tree.h"
 #include "Parameter_cphyperp.h"
@@ -47,332 +48,885 @@
 #include <string>
 #include <vector>
 #include <fstream>
+#include <iomanip>
+#include <cmath>
+#include <algorithm>
+#include <time.h>
 
+using namespace std;
 
+/* The transition probabilities of the gamma categories of one branch are copied into a
+ * contiguous, aligned block in the layout and precision the kernels want (see TiLayout), so
+ * the kernels can load whole rows or columns of one or more categories at once. A partly
+ * filled last category group is padded with zeros. */
+template<typename TiReal>
+static void gatherTiProbs(TiReal *ti, MbMatrix<double> *t, int numCats, TiLayout layout, int group) {
+
+	for (int k=0; k<numCats; k++)
+		{
+		int g = (k / group) * 16 * group + (k % group) * 4;
+		for (int i=0; i<4; i++)
+			for (int j=0; j<4; j++)
+				{
+				if (layout == TI_COLUMNS)
+					ti[g + j * 4 * group + i] = (TiReal)t[k][i][j];
+				else
+					ti[g + i * 4 * group + j] = (TiReal)t[k][i][j];
+				}
+		}
+	for (int k=numCats; k%group!=0; k++)
+		{
+		int g = (k / group) * 16 * group + (k % group) * 4;
+		for (int i=0; i<4; i++)
+			for (int j=0; j<4; j++)
+				ti[g + i * 4 * group + j] = 0.0;
+		}
+}
+
+/* For a branch leading to a tip, P x e is precomputed for every nucleotide code (the bit
+ * pattern of Alignment::getPossibleNucs) and every gamma category, laid out as
+ * [group][code][category in group][state]. The tip kernels then only index this table by
+ * the tip's state. */
+template<typename TiReal>
+static void buildTipLookup(TiReal *lk, MbMatrix<double> *t, int numCats, int group) {
+
+	for (int k=0; k<numCats; k++)
+		{
+		TiReal *g = lk + (k / group) * 64 * group + (k % group) * 4;
+		for (int s=0; s<16; s++)
+			for (int i=0; i<4; i++)
+				{
+				double sum = 0.0;
+				for (int j=0; j<4; j++)
+					if (s & (1 << j))
+						sum += t[k][i][j];
+				g[s * 4 * group + i] = (TiReal)sum;
+				}
+		}
+	for (int k=numCats; k%group!=0; k++)
+		{
+		TiReal *g = lk + (k / group) * 64 * group + (k % group) * 4;
+		for (int s=0; s<16; s++)
+			for (int i=0; i<4; i++)
+				g[s * 4 * group + i] = 0.0;
+		}
+}
 
-#include <omp.h>
+/* The P-matrices of the kernels for other numbers of states than 4, laid out as
+ * [category][to][from] with every column padded to PADDED_STATES(numStates). */
+template<typename TiReal>
+static void gatherStateTiProbs(TiReal *ti, MbMatrix<double> *t, int numCats, int numStates) {
+
+	int np = PADDED_STATES(numStates);
+	for (int k=0; k<numCats; k++)
+		{
+		TiReal *g = ti + k * numStates * np;
+		for (int i=0; i<numStates; i++)
+			{
+			const double *row = t[k][i];
+			for (int j=0; j<numStates; j++)
+				g[j * np + i] = (TiReal)row[j];
+			}
+		for (int j=0; j<numStates; j++)
+			for (int i=numStates; i<np; i++)
+				g[j * np + i] = 0.0;
+		}
+}
 
+/* The tip lookup tables of the kernels for other numbers of states than 4: P x e for the
+ * states codeStates[s] of every tip code s, laid out as [code][category][state] with every row
+ * padded to PADDED_STATES(numStates). */
+template<typename TiReal>
+static void buildStateTipLookup(TiReal *lk, MbMatrix<double> *t, int numCats, int numStates,
+                                const vector<int> &codeStates) {
+
+	int np = PADDED_STATES(numStates);
+	for (unsigned s=0; s<codeStates.size(); s++)
+		for (int k=0; k<numCats; k++)
+			{
+			TiReal *row = lk + (s * numCats + k) * np;
+			for (int i=0; i<numStates; i++)
+				{
+				double sum = 0.0;
+				for (int j=0; j<numStates; j++)
+					if (codeStates[s] & (1 << j))
+						sum += t[k][i][j];
+				row[i] = (TiReal)sum;
+				}
+			for (int i=numStates; i<np; i++)
+				row[i] = 0.0;
+			}
+}
 
-using namespace std;
-double Model::lnLikelihood(void) {
-        
-        double * clP;
-        double * clL;
-        double * clR;
+/* Pick the fastest kernels supported by this CPU, or the variant requested with -kern, for
+ * numCats gamma categories. */
+const KernelSet* selectLikelihoodKernels(string kn, int numCats) {
+
+	__builtin_cpu_init();
+	bool hasSSE3 = __builtin_cpu_supports("sse3");
+	bool hasAVX  = __builtin_cpu_supports("avx");
+	bool hasAVX2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	bool hasAVX512 = hasAVX2 && __builtin_cpu_supports("avx512f");
+
+	if (kn.empty() == true || kn == "auto")
+		{
+		if (hasAVX512 == true)
+			return getAVX512Kernels(numCats);
+		else if (hasAVX2 == true)
+			return getAVX2Kernels(numCats);
+		else if (hasAVX == true)
+			return getAVXKernels(numCats);
+		else if (hasSSE3 == true)
+			return getSSE3Kernels(numCats);
+		return getSeqKernels(numCats);
+		}
 
+	bool isSupported = true;
+	const KernelSet *k = NULL;
+	if (kn == "seq")
+		k = getSeqKernels(numCats);
+	else if (kn == "sse3")
+		{
+		k = getSSE3Kernels(numCats);
+		isSupported = hasSSE3;
+		}
+	else if (kn == "avx")
+		{
+		k = getAVXKernels(numCats);
+		isSupported = hasAVX;
+		}
+	else if (kn == "avx2")
+		{
+		k = getAVX2Kernels(numCats);
+		isSupported = hasAVX2;
+		}
+	else if (kn == "avx512")
+		{
+		k = getAVX512Kernels(numCats);
+		isSupported = hasAVX512;
+		}
+	else
+		{
+		cerr << "ERROR: Unknown likelihood kernels \"" << kn << "\" (use auto, seq, sse3, avx, avx2 or avx512)" << endl;
+		exit(1);
+		}
+	if (isSupported == false)
+		{
+		cerr << "ERROR: The " << kn << " likelihood kernels are not supported by this CPU" << endl;
+		exit(1);
+		}
+	return k;
+}
 
-	if(runUnderPrior){
-		myCurLnL = 0.0;
-		return 0.0;
+/* Find the nodes of the active tree the next evaluation updates in every partition: the dirty
+ * ones, all of them in a partition whose parameters changed, and a node that does not keep its
+ * conditional likelihoods (-clmem) whenever its parent is updated. The stored ones take their
+ * slots for the proposal before any precision runs, so all of them write the same slots. */
+void Model::setClUpdates(void) {
+
+	Tree *t = getActiveTree();
+	int nNodes = t->getNumNodes();
+	clUpdate.resize(numPartitions * nNodes);
+	for (int q=0; q<numPartitions; q++) {
+		vector<bool>::iterator u = clUpdate.begin() + q * nNodes;
+		for (int n=nNodes-1; n>=0; n--) {
+			Node *p = t->getDownPassNode(n);
+			if (isClStored[p->getIdx()] == true || p->getAnc() == NULL)
+				u[p->getIdx()] = (p->getIsClDirty() == true || partClDirty[q] == true);
+			else
+				u[p->getIdx()] = u[p->getAnc()->getIdx()];
+			if (p->getLft() != NULL && p->getRht() != NULL && u[p->getIdx()] == true && isClStored[p->getIdx()] == true)
+				takeSlot(p, true, q);
+		}
+		partClDirty[q] = false;
 	}
+}
+
+/* One child of a node update: the tip codes st of a tip (the P-matrix t is then turned into
+ * a tip lookup table), or the conditional likelihoods and scalers in slot of cl and sc.
+ * The P-matrices go to buf in the layout of the kernels, and buf is advanced past them. */
+template<typename ClReal, typename TiReal>
+void Model::setOpBranch(const LikelihoodKernelsT<ClReal, TiReal> *k, KernelOpT<ClReal, TiReal> &o, bool isLeft,
+                        const unsigned char *st, ClReal **cl, int **sc, int slot, MbMatrix<double> *t, TiReal *&buf) {
+
+	TiReal *ti = buf;
+	ClReal *clC = NULL;
+	int *scC = NULL;
+	if (st != NULL)
+		{
+		if (k->numStates == 4)
+			buildTipLookup(buf, t, numGammaCats, k->catGroup);
+		else
+			buildStateTipLookup(buf, t, numGammaCats, numStates, tipCodeStates);
+		buf += numPaddedCats * tipTableSize;
+		}
+	else
+		{
+		clC = cl[slot];
+		scC = sc[slot];
+		if (k->numStates == 4)
+			gatherTiProbs(buf, t, numGammaCats, k->tiLayout, k->catGroup);
+		else
+			gatherStateTiProbs(buf, t, numGammaCats, numStates);
+		buf += numPaddedCats * tiMatrixSize;
+		}
+	if (isLeft == true)
+		{
+		o.stL = st;
+		o.clL = clC;
+		o.scL = scC;
+		o.tiL = ti;
+		}
+	else
+		{
+		o.stR = st;
+		o.clR = clC;
+		o.scR = scC;
+		o.tiR = ti;
+		}
+	// a single tip child is always the left one
+	if (o.stL != NULL && o.stR != NULL)
+		o.type = OP_TIP_TIP;
+	else if (o.stL != NULL)
+		o.type = OP_TIP_INNER;
+	else
+		o.type = OP_INNER_INNER;
+}
+
+/* An update writing to clP and scP, its children are set with setOpBranch. */
+template<typename ClReal, typename TiReal>
+static KernelOpT<ClReal, TiReal> newKernelOp(ClReal *clP, int *scP, bool willNeed) {
+
+	KernelOpT<ClReal, TiReal> o;
+	o.clP = clP;
+	o.scP = scP;
+	o.stL = o.stR = NULL;
+	o.clL = o.clR = NULL;
+	o.scL = o.scR = NULL;
+	o.tiL = o.tiR = NULL;
+	o.numRows = 0;
+	o.ixL = o.ixR = NULL;
+	o.willNeed = willNeed;
+	o.type = OP_INNER_INNER;
+	return o;
+}
+
+/* The update of the conditional likelihoods of the internal node p in partition q from its
+ * children. */
+template<typename ClReal, typename TiReal>
+KernelOpT<ClReal, TiReal> Model::newNodeOp(const LikelihoodKernelsT<ClReal, TiReal> *k, Node *p, int q, ClReal **cl, int **sc,
+                                           TiReal *&buf) {
+
+	int idx = p->getIdx();
+	Node *l = p->getLft();
+	Node *r = p->getRht();
+	// a single tip child is always handled as the left one
+	if (l->getIsLeaf() == false && r->getIsLeaf() == true)
+		{
+		Node *tmp = l;
+		l = r;
+		r = tmp;
+		}
+	KernelOpT<ClReal, TiReal> o = newKernelOp<ClReal, TiReal>(cl[p->getActiveCl(q)], sc[p->getActiveCl(q)],
+	                                                          clFileName.empty() == false);
+	const unsigned char *stL = NULL, *stR = NULL;
+	if (useSiteRepeats == true)
+		{
+		o.numRows = siteRepRows[idx];
+		if (l->getIsLeaf() == false)
+			o.ixL = &siteRepIx[0][idx][0];
+		else
+			stL = &siteRepStates[0][idx][0];
+		if (r->getIsLeaf() == false)
+			o.ixR = &siteRepIx[1][idx][0];
+		else
+			stR = &siteRepStates[1][idx][0];
+		}
+	else
+		{
+		if (l->getIsLeaf() == true)
+			stL = tipStates[l->getIdx()];
+		if (r->getIsLeaf() == true)
+			stR = tipStates[r->getIdx()];
+		}
+	setOpBranch(k, o, true, stL, cl, sc, l->getActiveCl(q), tis[l->getActiveTi(q)], buf);
+	setOpBranch(k, o, false, stR, cl, sc, r->getActiveCl(q), tis[r->getActiveTi(q)], buf);
+	return o;
+}
+
+/* The root reduction of partition q over the conditional likelihoods clRoot and scRoot, with
+ * the base frequencies of the partition copied to freqs. */
+template<typename ClReal, typename TiReal>
+void Model::setKernelPartition(KernelPartitionT<ClReal, TiReal> &pt, int q, const ClReal *clRoot, const int *scRoot,
+                               vector<double> &freqs) {
+
+	MbVector<double> f = getActiveBasefreq(q)->getFreq();
+	for (int i=0; i<numStates; i++)
+		freqs[i] = f[i];
+	pt.clRoot = clRoot;
+	pt.scRoot = scRoot;
+	pt.freqs = &freqs[0];
+	// with site repeats the root reduction runs over the unique rows of the root
+	pt.weights = patternWeights;
+	pt.begin = partBegin[q];
+	pt.end = partBegin[q + 1];
+	if (useSiteRepeats == true)
+		{
+		pt.weights = &siteRepWeights[0];
+		pt.end = siteRepRows[getActiveTree()->getRoot()->getIdx()];
+		}
+	// with invariant sites, the probability of every constant row of the root being invariant
+	pt.invProbs = NULL;
+	pt.pInv = 0.0;
+	pt.siteLnL = siteLnLOut;
+	if (useInvariantSites == true)
+		{
+		for (int c=pt.begin; c<pt.end; c++)
+			{
+			double sum = 0.0;
+			for (int i=0; i<numStates; i++)
+				if (invStates[c] & (1 << i))
+					sum += freqs[i];
+			invProbs[c] = sum;
+			}
+		pt.invProbs = &invProbs[0];
+		pt.pInv = getActivePinvar(q)->getPinv();
+		}
+}
+
+/* The pattern block size of the cache-blocked traversal: every update writes the conditional
+ * likelihoods of one node and reads at most two more, these should fit in half the L2 cache. */
+int Model::getCacheBlock(size_t numOps, size_t clValueBytes) {
+
+	int blk = cacheBlockPatterns;
+	if (blk < 0)
+		{
+		size_t perPattern = (numOps * 3 + 1) * (numGammaCats * numStates * clValueBytes + sizeof(int));
+		blk = (int)((l2CacheBytes / 2) / perPattern);
+		blk -= blk % PATTERN_SLICE_GRAIN;
+		if (blk < PATTERN_SLICE_GRAIN)
+			blk = PATTERN_SLICE_GRAIN;
+		}
+	return blk;
+}
+
+/* Let the kernels run the updates ops of all parts, the first parts[0].numOps of them for
+ * the first part and so on, and the root reductions. partLnL receives the log-likelihood of
+ * every part if not NULL. */
+template<typename ClReal, typename TiReal>
+double Model::evaluateOps(const LikelihoodKernelsT<ClReal, TiReal> *k, vector<KernelOpT<ClReal, TiReal> > &ops,
+                          vector<KernelPartitionT<ClReal, TiReal> > &parts, double *partLnL) {
+
+	size_t maxOps = 0;
+	for (unsigned q=0, first=0; q<parts.size(); q++)
+		{
+		parts[q].ops = (parts[q].numOps > 0 ? &ops[first] : NULL);
+		first += parts[q].numOps;
+		maxOps = max(maxOps, (size_t)parts[q].numOps);
+		}
+	int blk = getCacheBlock(maxOps, sizeof(ClReal));
+	if (adaptiveThreads < 0)
+		{
+		KernelSchedule sched = { 0, useTaskGraph, false };
+		return k->evaluate(k, &parts[0], (int)parts.size(), numGammaCats, blk, &sched, partLnL);
+		}
+	// the adaptive schedule is measured per pattern update, in buckets of the size of the evaluation
+	long work = 0;
+	for (unsigned q=0; q<parts.size(); q++)
+		work += (long)(parts[q].end - parts[q].begin) * (parts[q].numOps + 1);
+	int bucket = 0;
+	while ((work >> (bucket + 1)) > 0 && bucket < 62)
+		bucket++;
+	int c = pickSchedule(bucket);
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	double lnL = k->evaluate(k, &parts[0], (int)parts.size(), numGammaCats, blk, &scheduleChoices[c], partLnL);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	recordSchedule(bucket, c, ((t1.tv_sec - t0.tv_sec) + 1e-9 * (t1.tv_nsec - t0.tv_nsec)) / (work > 0 ? work : 1));
+	return lnL;
+}
+
+/* The schedule of the next evaluation in a bucket: every candidate is tried SCHEDULE_TRIALS
+ * times in turn, then the one with the fastest run per pattern update is kept. The fastest
+ * run rather than the mean, as a run may be slowed down by the rest of the machine. */
+int Model::pickSchedule(int bucket) {
+
+	if ((int)scheduleChosen.size() <= bucket)
+		{
+		scheduleChosen.resize(bucket + 1, -1);
+		scheduleBest.resize(bucket + 1, vector<double>(scheduleChoices.size(), 0.0));
+		scheduleTrials.resize(bucket + 1, vector<int>(scheduleChoices.size(), 0));
+		}
+	if (scheduleChosen[bucket] >= 0)
+		return scheduleChosen[bucket];
+	int c = 0;
+	for (unsigned i=1; i<scheduleChoices.size(); i++)
+		if (scheduleTrials[bucket][i] < scheduleTrials[bucket][c])
+			c = i;
+	return c;
+}
+
+void Model::recordSchedule(int bucket, int c, double seconds) {
+
+	if (scheduleChosen[bucket] >= 0)
+		return;
+	if (scheduleTrials[bucket][c] == 0 || seconds < scheduleBest[bucket][c])
+		scheduleBest[bucket][c] = seconds;
+	scheduleTrials[bucket][c]++;
+	for (unsigned i=0; i<scheduleChoices.size(); i++)
+		if (scheduleTrials[bucket][i] < SCHEDULE_TRIALS)
+			return;
+	int best = 0;
+	for (unsigned i=1; i<scheduleChoices.size(); i++)
+		if (scheduleBest[bucket][i] < scheduleBest[bucket][best])
+			best = i;
+	scheduleChosen[bucket] = best;
+}
+
+/* The schedules the adaptive controller picked, for every size of evaluation it has seen. */
+void Model::printScheduleChoice(void) {
+
+	if (adaptiveThreads < 0)
+		return;
+	for (unsigned b=0; b<scheduleChosen.size(); b++)
+		{
+		int c = scheduleChosen[b];
+		if (c < 0)
+			continue;
+		const KernelSchedule &s = scheduleChoices[c];
+		cout << "Parallel schedule for 2^" << b << " pattern updates: ";
+		if (s.numThreads == 1)
+			cout << "sequential";
+		else
+			cout << (s.taskGraph == true ? "tasks" : "pattern slices") << " on " << s.numThreads << " threads";
+		cout << " (" << fixed << setprecision(2) << scheduleBest[b][c] * 1e9 << " ns per pattern update)" << endl;
+		}
+}
+
+/* Collect the updates of the nodes found by setClUpdates in post order, with the P-matrices
+ * and tip lookup tables of their branches, for every partition, and let the kernels run them
+ * and the root reductions. cl and sc hold the slots of the pool. With clearDirty false the
+ * dirty flags are left set, so another set of conditional likelihoods can be updated after it. */
+template<typename ClReal, typename TiReal>
+double Model::lnLikelihoodWith(const LikelihoodKernelsT<ClReal, TiReal> *k, ClReal **cl, int **sc, bool clearDirty) {
+
 	Tree *t = getActiveTree();
-	MbMatrix<double> *tL = new MbMatrix<double>[numGammaCats];
-	MbMatrix<double> *tR = new MbMatrix<double>[numGammaCats];
+	int nNodes = t->getNumNodes();
+	Node *root = t->getRoot();
+	TiReal *buf = (TiReal *)tiBuf;
+	vector<KernelOpT<ClReal, TiReal> > ops;
+	ops.reserve(numPartitions * nNodes);
+	vector<KernelPartitionT<ClReal, TiReal> > parts(numPartitions);
+	vector<vector<double> > freqs(numPartitions, vector<double>(numStates));
+
+	for (int q=0; q<numPartitions; q++) {
+		size_t firstOp = ops.size();
+		for (int n=0; n<nNodes; n++) {
+			Node *p = t->getDownPassNode(n);
+			if (p->getLft() != NULL && p->getRht() != NULL && clUpdate[q * nNodes + p->getIdx()] == true)
+				ops.push_back(newNodeOp(k, p, q, cl, sc, buf));
+		}
+		parts[q].numOps = (int)(ops.size() - firstOp);
+		setKernelPartition(parts[q], q, cl[root->getActiveCl(q)], sc[root->getActiveCl(q)], freqs[q]);
+	}
+	if (clearDirty == true)
+		{
+		for (unsigned i=0; i<clUpdate.size(); i++)
+			if (clUpdate[i] == true)
+				t->getNodeByIndex(i % nNodes)->setIsClDirty(false);
+		}
+	return evaluateOps(k, ops, parts);
+}
 
-	for (int n=0; n<t->getNumNodes(); n++) {
-		Node *p = t->getDownPassNode(n);
-		if (p->getLft() != NULL && p->getRht() != NULL && p->getIsClDirty() == true) {
-			clL = clPtr[p->getLft()->getActiveCl()][p->getLft()->getIdx()];
-			clR = clPtr[p->getRht()->getActiveCl()][p->getRht()->getIdx()];
-			clP = clPtr[p->getActiveCl()          ][p->getIdx()          ];
-			for (int k=0; k<numGammaCats; k++) {
-				tL[k] = tis[p->getLft()->getActiveTi()][p->getLft()->getIdx()][k];
-				tR[k] = tis[p->getRht()->getActiveTi()][p->getRht()->getIdx()][k];
+/* Append the updates of lnLikelihoodAt in partition q to ops, in the order of steps: the
+ * conditional likelihoods of a node (false) or its outside partials (true). The outside
+ * partials of a node x are the probabilities of the data outside the subtree of x given each
+ * state of the parent a of x. They are computed as the update of a node with the children b,
+ * the sibling of x, and a over the branch of a with the outside partials of a; if a is the
+ * root, the second child is a buffer of ones over a branch of identity matrices. */
+template<typename ClReal, typename TiReal>
+void Model::addStepOps(const LikelihoodKernelsT<ClReal, TiReal> *k, const vector<pair<Node *, bool> > &steps, int q,
+                       ClReal **cl, int **sc, TiReal *&buf, vector<KernelOpT<ClReal, TiReal> > &ops) {
+
+	Node *root = getActiveTree()->getRoot();
+	int onesSlot = outsideBase + getActiveTree()->getNumNodes();
+	for (unsigned i=0; i<steps.size(); i++)
+		{
+		Node *x = steps[i].first;
+		if (steps[i].second == false)
+			{
+			ops.push_back(newNodeOp(k, x, q, cl, sc, buf));
+			continue;
+			}
+		Node *a = x->getAnc();
+		Node *b = (a->getLft() == x ? a->getRht() : a->getLft());
+		int s = outsideBase + x->getIdx();
+		KernelOpT<ClReal, TiReal> o = newKernelOp<ClReal, TiReal>(cl[s], sc[s], clFileName.empty() == false);
+		setOpBranch(k, o, true, (b->getIsLeaf() == true ? tipStates[b->getIdx()] : NULL), cl, sc, b->getActiveCl(q),
+		            tis[b->getActiveTi(q)], buf);
+		if (a == root)
+			setOpBranch(k, o, false, NULL, cl, sc, onesSlot, identityTis, buf);
+		else
+			setOpBranch(k, o, false, NULL, cl, sc, outsideBase + a->getIdx(), tis[a->getActiveTi(q)], buf);
+		ops.push_back(o);
+		}
+}
+
+/* As the model is reversible, the update of p over the branch with the P-matrices t with the
+ * outside partials of p over an identity branch gives the conditional likelihoods of the whole
+ * tree at the parent of p, in partition q. They are written to slot and reduced as those of
+ * the root. */
+template<typename ClReal, typename TiReal>
+KernelOpT<ClReal, TiReal> Model::newBranchOp(const LikelihoodKernelsT<ClReal, TiReal> *k, Node *p, int q, ClReal **cl,
+                                             int **sc, int slot, MbMatrix<double> *t, TiReal *&buf) {
+
+	KernelOpT<ClReal, TiReal> o = newKernelOp<ClReal, TiReal>(cl[slot], sc[slot], clFileName.empty() == false);
+	setOpBranch(k, o, true, (p->getIsLeaf() == true ? tipStates[p->getIdx()] : NULL), cl, sc, p->getActiveCl(q), t, buf);
+	setOpBranch(k, o, false, NULL, cl, sc, outsideBase + p->getIdx(), identityTis, buf);
+	return o;
+}
+
+template<typename ClReal, typename TiReal>
+double Model::lnLikelihoodAtWith(const LikelihoodKernelsT<ClReal, TiReal> *k, ClReal **cl, int **sc,
+                                 const vector<vector<pair<Node *, bool> > > &steps, Node *p) {
+
+	Tree *t = getActiveTree();
+	int nNodes = t->getNumNodes();
+	Node *root = t->getRoot();
+	int rootSlot = outsideBase + root->getIdx();
+	TiReal *buf = (TiReal *)tiBuf;
+	vector<KernelOpT<ClReal, TiReal> > ops;
+	ops.reserve(numPartitions * 2 * nNodes);
+	vector<KernelPartitionT<ClReal, TiReal> > parts(numPartitions);
+	vector<vector<double> > freqs(numPartitions, vector<double>(numStates));
+
+	for (int q=0; q<numPartitions; q++)
+		{
+		size_t firstOp = ops.size();
+		addStepOps(k, steps[q], q, cl, sc, buf, ops);
+		if (p == root)
+			setKernelPartition(parts[q], q, cl[root->getActiveCl(q)], sc[root->getActiveCl(q)], freqs[q]);
+		else
+			{
+			ops.push_back(newBranchOp(k, p, q, cl, sc, rootSlot, tis[p->getActiveTi(q)], buf));
+			setKernelPartition(parts[q], q, cl[rootSlot], sc[rootSlot], freqs[q]);
 			}
+		parts[q].numOps = (int)(ops.size() - firstOp);
+		}
+	return evaluateOps(k, ops, parts);
+}
 
-// parallelisation
-			#pragma omp parallel for
-			for (int c=0; c<numPatterns; c++) {
-// parallelisation                      
-                                int p = c * numGammaCats * 4;
-				for (int k=0; k<numGammaCats; k++) {
-
-					double sumL = 0.0, sumR = 0.0;
-#ifdef _TOM_SSE3
-                                        #ifdef _ASM_DEBUG
-                                        __asm__ ( "int $0x3" );
-                                        #endif
-                                        __m128d
-                                                cll0, clr0,
-                                                cll2, clr2,
-                                                p1, p2,
-                                                s1, s2,
-                                                sr, sl;
-
-                                        cll0 = _mm_load_pd ( clL + p );
-                                        clr0 = _mm_load_pd ( clR + p );
-                                        cll2 = _mm_load_pd ( clL + p + 2 );
-                                        clr2 = _mm_load_pd ( clR + p + 2 );
-
-                                        /* Compute clP[p + 0] and clP[p + 1] */
-                                        p1 = _mm_mul_pd ( _mm_load_pd ( tL[k][0] ), cll0 );       // tL[k][0][0] * clL[p + 0], tL[k][0][1] * clL[p + 1]
-                                        p2 = _mm_mul_pd ( _mm_load_pd ( tL[k][1] ), cll0 );       // tL[k][1][0] * clL[p + 0], tL[k][1][1] * clL[p + 1]
-                                        s1 = _mm_hadd_pd ( p1, p2 );                                                     // tL[k][0][0] * clL[p + 0] + tL[k][0][1] * clL[p + 1], tL[k][1][0] * clL[p + 0] + tL[k][1][1] * clL[p + 1]
-                                        
-                                        
-                                        p1 = _mm_mul_pd ( _mm_load_pd ( tL[k][0] + 2 ), cll2 );   // tL[k][0][2] * clL[p + 2], tL[k][0][3] * clL[p + 3]
-                                        p2 = _mm_mul_pd ( _mm_load_pd ( tL[k][1] + 2 ), cll2 );   // tL[k][1][2] * clL[p + 2], tL[k][1][3] * clL[p + 3]
-                                        s2 = _mm_hadd_pd ( p1, p2 );                                                     // tL[k][0][2] * clL[p + 2] + tL[k][0][3] * clL[p + 3], tL[k][1][2] * clL[p + 2] + tL[k][1][3] * clL[p + 3]
-                                        
-                                        /*  tL[k][0][0] * clL[p + 0] + tL[k][0][1] * clL[p + 1] + tL[k][0][2] * clL[p + 2] + tL[k][0][3] * clL[p + 3],
-                                         *  tL[k][1][0] * clL[p + 0] + tL[k][1][1] * clL[p + 1] + tL[k][1][2] * clL[p + 2] + tL[k][1][3] * clL[p + 3]
-                                         */
-                                        sl = _mm_add_pd ( s1, s2 );                                                  
-                                        
-                                        p1 = _mm_mul_pd ( _mm_load_pd ( tR[k][0] ), clr0 );
-                                        p2 = _mm_mul_pd ( _mm_load_pd ( tR[k][1] ), clr0 );
-                                        s1 = _mm_hadd_pd ( p1, p2 );
-                                        
-                                        p1 = _mm_mul_pd ( _mm_load_pd ( tR[k][0] + 2 ), clr2 );
-                                        p2 = _mm_mul_pd ( _mm_load_pd ( tR[k][1] + 2 ), clr2 );
-                                        s2 = _mm_hadd_pd ( p1, p2 );
-                                        
-                                        sr = _mm_add_pd ( s1, s2 );
-                                        
-                                        _mm_store_pd ( clP + p, _mm_mul_pd ( sl, sr ) );
-                                        
-                                        /* Compute clP[p + 2] and clP[p + 3] */
-                                        p1 = _mm_mul_pd ( _mm_load_pd ( tL[k][2] ), cll0 );       // tL[k][0][0] * clL[p + 0], tL[k][0][1] * clL[p + 1]
-                                        p2 = _mm_mul_pd ( _mm_load_pd ( tL[k][3] ), cll0 );       // tL[k][1][0] * clL[p + 0], tL[k][1][1] * clL[p + 1]
-                                        s1 = _mm_hadd_pd ( p1, p2 );
-                                        
-                                        p1 = _mm_mul_pd ( _mm_load_pd ( tL[k][2] + 2 ), cll2 );   // tL[k][0][2] * clL[p + 2], tL[k][0][3] * clL[p + 3]
-                                        p2 = _mm_mul_pd ( _mm_load_pd ( tL[k][3] + 2 ), cll2 );   // tL[k][1][2] * clL[p + 2], tL[k][1][3] * clL[p + 3]
-                                        s2 = _mm_hadd_pd ( p1, p2 );
-                                        
-                                        sl = _mm_add_pd ( s1, s2 );
-                                        
-                                        p1 = _mm_mul_pd ( _mm_load_pd ( tR[k][2] ), clr0 );
-                                        p2 = _mm_mul_pd ( _mm_load_pd ( tR[k][3] ), clr0 );
-                                        s1 = _mm_hadd_pd ( p1, p2 );
-                                        
-                                        p1 = _mm_mul_pd ( _mm_load_pd ( tR[k][2] + 2 ), clr2 );
-                                        p2 = _mm_mul_pd ( _mm_load_pd ( tR[k][3] + 2 ), clr2 );
-                                        s2 = _mm_hadd_pd ( p1, p2 );
-                                        
-                                        sr = _mm_add_pd ( s1, s2 );
-                                        
-                                        _mm_store_pd ( clP + p + 2, _mm_mul_pd ( sl, sr ) );
-                                        #ifdef _ASM_DEBUG
-                                        __asm__ ( "int $0x3" );
-                                        #endif
-
-#elif _TOM_AVX
-                                        #ifdef _ASM_DEBUG
-                                        __asm__ ( "int $0x3" );
-                                        #endif
-                                        __m256d
-                                                cll,
-                                                clr,
-                                                r1, r2, r3, r4, r12, r34, r1234,
-                                                l1, l2, l3, l4, l12, l34, l1234,
-                                                r, perm, blnd;
-
-
-                                       // __asm__ ("int $0x3");
-//                                        printf ( "OUT %d!!\n", BYTE_ALIGNMENT );
-                                        cll = _mm256_load_pd ( clL + p );
-                                        clr = _mm256_load_pd ( clR + p );
-
-                                        // Compute sumL rows
-
-                                        l1 = _mm256_mul_pd ( _mm256_load_pd ( tL[k][0] ), cll );
-                                        l2 = _mm256_mul_pd ( _mm256_load_pd ( tL[k][1] ), cll );
-                                        l3 = _mm256_mul_pd ( _mm256_load_pd ( tL[k][2] ), cll );
-                                        l4 = _mm256_mul_pd ( _mm256_load_pd ( tL[k][3] ), cll );
-
-                                        l12 = _mm256_hadd_pd ( l1, l2 );
-                                        l34 = _mm256_hadd_pd ( l3, l4 );
-
-                                        blnd = _mm256_blend_pd ( l12, l34, 0b1100 );
-                                        perm = _mm256_permute2f128_pd ( l12, l34, 0x21 );
-                                        l1234 = _mm256_add_pd ( perm, blnd ); 
-
-                                        // Compute sumR rows
-
-                                        r1 = _mm256_mul_pd ( _mm256_load_pd ( tR[k][0] ), clr );
-                                        r2 = _mm256_mul_pd ( _mm256_load_pd ( tR[k][1] ), clr );
-                                        r3 = _mm256_mul_pd ( _mm256_load_pd ( tR[k][2] ), clr );
-                                        r4 = _mm256_mul_pd ( _mm256_load_pd ( tR[k][3] ), clr );
-
-                                        r12 = _mm256_hadd_pd ( r1, r2 );
-                                        r34 = _mm256_hadd_pd ( r3, r4 );
-
-                                        blnd = _mm256_blend_pd ( r12, r34, 0b1100 );
-                                        perm = _mm256_permute2f128_pd ( r12, r34, 0x21 );
-                                        r1234 = _mm256_add_pd ( perm, blnd ); 
-
-                                        r = _mm256_mul_pd ( l1234, r1234 );
-
-
-                                        _mm256_store_pd ( clP + p, r );
-                                        #ifdef _ASM_DEBUG
-                                        __asm__ ( "int $0x3" );
-                                        #endif
-#else
-                                        #ifdef _ASM_DEBUG
-                                        __asm__ ( "int $0x3" );
-                                        #endif
-					sumL += tL[k][0][0] * clL[p + 0] + tL[k][0][1] * clL[p + 1] + tL[k][0][2] * clL[p + 2] +tL[k][0][3] * clL[p + 3];
-					sumR += tR[k][0][0] * clR[p + 0] + tR[k][0][1] * clR[p + 1] + tR[k][0][2] * clR[p + 2] +tR[k][0][3] * clR[p + 3];
-					clP[p + 0] = sumL * sumR;
-					
-					sumL = 0.0, sumR = 0.0;
-					sumL += tL[k][1][0] * clL[p + 0] + tL[k][1][1] * clL[p + 1] + tL[k][1][2] * clL[p + 2] + tL[k][1][3] * clL[p + 3];
-					sumR += tR[k][1][0] * clR[p + 0] + tR[k][1][1] * clR[p + 1] + tR[k][1][2] * clR[p + 2] + tR[k][1][3] * clR[p + 3];
-					clP[p + 1] = sumL * sumR;
-					
-					sumL = 0.0, sumR = 0.0;
-					sumL += tL[k][2][0] * clL[p + 0] + tL[k][2][1] * clL[p + 1] + tL[k][2][2] * clL[p + 2] +tL[k][2][3] * clL[p + 3];
-					sumR += tR[k][2][0] * clR[p + 0] + tR[k][2][1] * clR[p + 1] + tR[k][2][2] * clR[p + 2] +tR[k][2][3] * clR[p + 3];
-					clP[p + 2] = sumL * sumR;
-					
-					sumL = 0.0, sumR = 0.0;
-					sumL += tL[k][3][0] * clL[p + 0] + tL[k][3][1] * clL[p + 1] + tL[k][3][2] * clL[p + 2] +tL[k][3][3] * clL[p + 3];
-					sumR += tR[k][3][0] * clR[p + 0] + tR[k][3][1] * clR[p + 1] + tR[k][3][2] * clR[p + 2] +tR[k][3][3] * clR[p + 3];
-					clP[p + 3] = sumL * sumR;
-                                        #ifdef _ASM_DEBUG
-                                        __asm__ ( "int $0x3" );
-                                        #endif
-#endif
-/*
-#					endif
-*/
-// parallelisation
-                                        p += 4;
-					
+/* lnLikelihoodAt for every rate of the branch of p, up to RATE_BUFFERS of them per run of the
+ * kernels, the parts of a run are the rates times the partitions. The updates of steps run
+ * first, together with the first rate, as the other rates read their results. */
+template<typename ClReal, typename TiReal>
+void Model::lnLikelihoodsAtWith(const LikelihoodKernelsT<ClReal, TiReal> *k, ClReal **cl, int **sc,
+                                const vector<vector<pair<Node *, bool> > > &steps, Node *p, const vector<double> &rates,
+                                double *lnLs) {
+
+	int nNodes = getActiveTree()->getNumNodes();
+	int rateSlot = outsideBase + nNodes + 1;
+	bool hasSteps = false;
+	for (int q=0; q<numPartitions; q++)
+		hasSteps = (hasSteps == true || steps[q].empty() == false);
+	vector<KernelOpT<ClReal, TiReal> > ops;
+	ops.reserve(numPartitions * (2 * nNodes + RATE_BUFFERS));
+	vector<KernelPartitionT<ClReal, TiReal> > parts;
+	vector<vector<double> > freqs(RATE_BUFFERS * numPartitions, vector<double>(numStates));
+	vector<double> partLnL(RATE_BUFFERS * numPartitions);
+
+	for (int next=0; next<(int)rates.size(); )
+		{
+		int num = (next == 0 && hasSteps == true ? 1 : min(RATE_BUFFERS, (int)rates.size() - next));
+		setRateTiProbs(p, &rates[next], num);
+		TiReal *buf = (TiReal *)tiBuf;
+		ops.clear();
+		parts.assign(num * numPartitions, KernelPartitionT<ClReal, TiReal>());
+		for (int j=0; j<num; j++)
+			for (int q=0; q<numPartitions; q++)
+				{
+				size_t firstOp = ops.size();
+				if (next == 0 && hasSteps == true)
+					addStepOps(k, steps[q], q, cl, sc, buf, ops);
+				ops.push_back(newBranchOp(k, p, q, cl, sc, rateSlot + j, rateTis + (j * numPartitions + q) * numGammaCats, buf));
+				KernelPartitionT<ClReal, TiReal> &pt = parts[j * numPartitions + q];
+				setKernelPartition(pt, q, cl[rateSlot + j], sc[rateSlot + j], freqs[j * numPartitions + q]);
+				pt.numOps = (int)(ops.size() - firstOp);
 				}
+		evaluateOps(k, ops, parts, &partLnL[0]);
+		for (int j=0; j<num; j++)
+			{
+			lnLs[next + j] = 0.0;
+			for (int q=0; q<numPartitions; q++)
+				lnLs[next + j] += partLnL[j * numPartitions + q];
 			}
-			p->setIsClDirty(false);
+		next += num;
 		}
+}
+
+double Model::lnLikelihood(void) {
+
+	if(runUnderPrior){
+		myCurLnL = 0.0;
+		return 0.0;
 	}
-		
-	Node *r = t->getRoot();
-	MbVector<double> f = getActiveBasefreq()->getFreq();
-	//double *clP = clPtr[r->getActiveCl()][r->getIdx()];
-	clP = clPtr[r->getActiveCl()][r->getIdx()];
-	double catProb = 1.0 / numGammaCats;
-	double lnL = 0.0;
-        #pragma omp parallel for reduction ( + : lnL )
-	for (int c=0; c<numPatterns; c++){
-                int p = c * 16;
-		double siteProb = 0.0;
-                #ifdef _TOM_AVX
-                ALIGNED ( double siteProbTmp[4] );
-                #endif
-
-#ifdef _TOM_SSE3
-                                        #ifdef _ASM_DEBUG
-                                        __asm__ ( "int $0x3" );
-                                        #endif
-                __m128d
-                        p1,
-                        p2,
-                        v1,
-                        v2,
-                        v3,
-                        v4,
-                        m1,
-                        m2;
-
-                m1 = _mm_set_pd ( f[1], f[0] );
-                m2 = _mm_set_pd ( f[3], f[2] );
-
-
-                p1 = _mm_mul_pd ( _mm_load_pd ( clP + p + 0 ), m1 );           // clP[p+0] * f[0], clP[p+1] * f[1]
-                p2 = _mm_mul_pd ( _mm_load_pd ( clP + p + 2 ), m2 );           // clP[p+2] * f[2], clP[p+3] * f[3]
-                v1 = _mm_hadd_pd ( p1, p2 );                                                      // clP[p+0] * f[0] + clP[p+2] * f[2], clP[p+1] * f[1] + clP[p + 3] * f[3]
-
-                p += 4;
-
-                p1 = _mm_mul_pd ( _mm_load_pd ( clP + p + 0 ), m1 );
-                p2 = _mm_mul_pd ( _mm_load_pd ( clP + p + 2 ), m2 );           // clP[p+2] * f[2], clP[p+3] * f[3]
-                v2 = _mm_hadd_pd ( p1, p2 );                                                      // clP[p+0] * f[0] + clP[p+2] * f[2], clP[p+1] * f[1] + clP[p + 3] * f[3]
-
-                p += 4;
-
-                p1 = _mm_mul_pd ( _mm_load_pd ( clP + p + 0 ), m1 );
-                p2 = _mm_mul_pd ( _mm_load_pd ( clP + p + 2 ), m2 );           // clP[p+2] * f[2], clP[p+3] * f[3]
-                v3 = _mm_hadd_pd ( p1, p2 );                                                      // clP[p+0] * f[0] + clP[p+2] * f[2], clP[p+1] * f[1] + clP[p + 3] * f[3]
-
-                p += 4;
-
-                p1 = _mm_mul_pd ( _mm_load_pd ( clP + p + 0 ), m1 );
-                p2 = _mm_mul_pd ( _mm_load_pd ( clP + p + 2 ), m2 );           // clP[p+2] * f[2], clP[p+3] * f[3]
-                v4 = _mm_hadd_pd ( p1, p2 );                                                      // clP[p+0] * f[0] + clP[p+2] * f[2], clP[p+1] * f[1] + clP[p + 3] * f[3]
-
-                p += 4;
-
-                p1 = _mm_hadd_pd ( v1, v2 );
-                p2 = _mm_hadd_pd ( v3, v4 );
-
-                v1 = _mm_hadd_pd ( p1, p2 );
-                _mm_storel_pd ( &siteProb, _mm_hadd_pd ( v1, v1 ) );
-                                        #ifdef _ASM_DEBUG
-                                        __asm__ ( "int $0x3" );
-                                        #endif
-
-#elif _TOM_AVX
-                                        #ifdef _ASM_DEBUG
-                                        __asm__ ( "int $0x3" );
-                                        #endif
-                __m256d
-                        m,
-                        p1, p2, p3, p4;
-
-                m = _mm256_set_pd ( f[3], f[2], f[1], f[0] );
-                
-                p1 = _mm256_mul_pd ( _mm256_load_pd ( clP + p ), m );
-                p2 = _mm256_mul_pd ( _mm256_load_pd ( clP + p + 4 ), m );
-                p3 = _mm256_mul_pd ( _mm256_load_pd ( clP + p + 8 ), m );
-                p4 = _mm256_mul_pd ( _mm256_load_pd ( clP + p + 12 ), m );
-                p += 16;
-
-                p1 = _mm256_hadd_pd ( p1, p2 );
-                p2 = _mm256_hadd_pd ( p3, p4 );
-                
-                p1 = _mm256_hadd_pd ( p1, p2 );
-
-                p1 = _mm256_add_pd ( p1, _mm256_permute2f128_pd ( p1 , p1 , 1)  );
-
-                p1 = _mm256_hadd_pd ( p1, p1 );
-
-                //_mm_storel_pd ( &siteProb, _mm256_extractf128_pd ( p1, 0 ) );
-                _mm256_store_pd ( siteProbTmp, p1 );
-
-                siteProb = siteProbTmp[0];
-                                        #ifdef _ASM_DEBUG
-                                        __asm__ ( "int $0x3" );
-                                        #endif
-
-#else
-                                        #ifdef _ASM_DEBUG
-                                        __asm__ ( "int $0x3" );
-                                        #endif
-
-		siteProb += clP[p + 0] * f[0] + clP[p + 1] * f[1] + clP[p + 2] * f[2] + clP[p + 3] * f[3] ;
-                p += 4;
-		//clP += 4;
-		siteProb += clP[p + 0] * f[0] + clP[p + 1] * f[1] + clP[p + 2] * f[2] + clP[p + 3] * f[3] ;
-                p += 4;
-		//clP += 4;
-		siteProb += clP[p + 0] * f[0] + clP[p + 1] * f[1] + clP[p + 2] * f[2] + clP[p + 3] * f[3] ;
-		//clP += 4;
-		p += 4;
-                siteProb += clP[p + 0] * f[0] + clP[p + 1] * f[1] + clP[p + 2] * f[2] + clP[p + 3] * f[3] ;
-		//clP += 4;
-                p += 4;
-                                        #ifdef _ASM_DEBUG
-                                        __asm__ ( "int $0x3" );
-                                        #endif
-#endif
-//#		endif
-		siteProb *= catProb;
-		lnL += alignmentPtr->getNumSitesOfPattern(c) * log(siteProb);
-	}
+	// a rejected step inside a move only marks the branches it restores as dirty, their slots
+	// still hold the P-matrices it proposed
+	setTiProb();
+	setClUpdates();
+	if (clPrecision == CL_DOUBLE)
+		{
+		myCurLnL = lnLikelihoodWith(kernels, clPtr, scPtr, true);
+		return myCurLnL;
+		}
+
+	// the double reference has to run first, the float pass clears the dirty flags
+	double refLnL = 0.0;
+	if (validatePrecision == true)
+		refLnL = lnLikelihoodWith(kernels, clPtr, scPtr, false);
+	double lnL;
+	if (clPrecision == CL_SINGLE)
+		lnL = lnLikelihoodWith(singleKernels, clPtrSP, scPtrSP, true);
+	else
+		lnL = lnLikelihoodWith(mixedKernels, clPtrSP, scPtrSP, true);
+	if (validatePrecision == true)
+		checkPrecision(lnL, refLnL);
+	myCurLnL = lnL;
+	return lnL;
+}
 
-	delete [] tL;
-	delete [] tR;
+/* The log-likelihood of every site pattern of the alignment, in its order, in the current
+ * state. Between two proposals all nodes are up to date, so only the root reductions run. */
+void Model::siteLnLikelihoods(vector<double> &lnLs) {
+
+	lnLs.assign(numPatterns, 0.0);
+	if(runUnderPrior)
+		return;
+	int numRows = numPaddedPatterns;
+	if (useSiteRepeats == true)
+		numRows = siteRepRows[getActiveTree()->getRoot()->getIdx()];
+	vector<double> rowLnL(numRows, 0.0);
+	siteLnLOut = &rowLnL[0];
+	lnLikelihood();
+	siteLnLOut = NULL;
+	for (int r=0; r<numPaddedPatterns; r++)
+		if (patternOfRow[r] >= 0)
+			lnLs[patternOfRow[r]] = rowLnL[useSiteRepeats == true ? siteRepRootRows[r] : r];
+}
+
+/* The log-likelihood of the active tree evaluated at node p: the conditional
+ * likelihoods of p and the outside partials of p are brought up to date, each from the nodes
+ * next to it, and combined over the branch of p. A change of the branch of p invalidates the
+ * outside partials of every node but p and its ancestors (see invalidateOutside). Visiting the
+ * nodes in pre order, a node only needs the outside partials of its parent and the conditional
+ * likelihoods of its sibling, so a step costs a few updates instead of the path to the root.
+ * The nodes above a change are marked dirty but not updated until they are needed (see
+ * Tree::updateBranchClsTis). */
+double Model::lnLikelihoodAt(Node *p) {
+
+	if(runUnderPrior){
+		myCurLnL = 0.0;
+		return 0.0;
+	}
+	// all nodes of a partition whose parameters changed are updated anyway
+	for (int q=0; q<numPartitions; q++)
+		if (partClDirty[q] == true)
+			return lnLikelihood();
+	setTiProb();
+	vector<vector<pair<Node *, bool> > > steps(numPartitions);
+	collectUpdatesAt(p, steps);
+	if (clPrecision == CL_DOUBLE)
+		{
+		myCurLnL = lnLikelihoodAtWith(kernels, clPtr, scPtr, steps, p);
+		return myCurLnL;
+		}
+	double refLnL = 0.0;
+	if (validatePrecision == true)
+		refLnL = lnLikelihoodAtWith(kernels, clPtr, scPtr, steps, p);
+	double lnL;
+	if (clPrecision == CL_SINGLE)
+		lnL = lnLikelihoodAtWith(singleKernels, clPtrSP, scPtrSP, steps, p);
+	else
+		lnL = lnLikelihoodAtWith(mixedKernels, clPtrSP, scPtrSP, steps, p);
+	if (validatePrecision == true)
+		checkPrecision(lnL, refLnL);
 	myCurLnL = lnL;
 	return lnL;
 }
+
+/* The log-likelihoods of lnLikelihoodAt with the branch of p (not the root) at each of rates
+ * instead of the rate of its table, p need not be seated at a table. The P-matrices of all
+ * rates are computed at once, and the kernels evaluate up to RATE_BUFFERS rates together. */
+void Model::lnLikelihoodsAt(Node *p, const vector<double> &rates, vector<double> &lnLs) {
+
+	lnLs.assign(rates.size(), 0.0);
+	if(runUnderPrior || rates.empty() == true)
+		return;
+	for (int q=0; q<numPartitions; q++)
+		{
+		if (partClDirty[q] == true)
+			getActiveTree()->upDateAllCls();
+		partClDirty[q] = false;
+		}
+	p->setIsTiDirty(true);
+	setTiProbExcept(p);
+	vector<vector<pair<Node *, bool> > > steps(numPartitions);
+	collectUpdatesAt(p, steps);
+	if (clPrecision == CL_DOUBLE)
+		{
+		lnLikelihoodsAtWith(kernels, clPtr, scPtr, steps, p, rates, &lnLs[0]);
+		return;
+		}
+	vector<double> refLnLs(rates.size());
+	if (validatePrecision == true)
+		lnLikelihoodsAtWith(kernels, clPtr, scPtr, steps, p, rates, &refLnLs[0]);
+	if (clPrecision == CL_SINGLE)
+		lnLikelihoodsAtWith(singleKernels, clPtrSP, scPtrSP, steps, p, rates, &lnLs[0]);
+	else
+		lnLikelihoodsAtWith(mixedKernels, clPtrSP, scPtrSP, steps, p, rates, &lnLs[0]);
+	if (validatePrecision == true)
+		for (unsigned i=0; i<rates.size(); i++)
+			checkPrecision(lnLs[i], refLnLs[i]);
+}
+
+/* The P-matrices of the branch of p at num rates into rateTis, [rate][partition][category]. */
+void Model::setRateTiProbs(Node *p, const double *rates, int num) {
+
+	double v = getBranchTime(p);
+	for (int j=0; j<num; j++)
+		{
+		double vr = v * rates[j];
+		for (int q=0; q<numPartitions; q++)
+			{
+			Shape *s = getActiveShape(q);
+			MbMatrix<double> *t = rateTis + (j * numPartitions + q) * numGammaCats;
+			for (int c=0; c<numGammaCats; c++)
+				t[c] = tiCalculators[q]->tiProbs(vr * s->getRate(c), t[c]);
+			}
+		}
+}
+
+/* The updates lnLikelihoodAt(p) needs in every partition, the dirty flags of the nodes
+ * updated are cleared. */
+void Model::collectUpdatesAt(Node *p, vector<vector<pair<Node *, bool> > > &steps) {
+
+	Tree *t = getActiveTree();
+	int nNodes = t->getNumNodes();
+	vector<bool> updated(nNodes, false);
+	for (int q=0; q<numPartitions; q++)
+		{
+		vector<bool> done(nNodes, false);
+		collectLowerUpdates(p, q, steps[q], done);
+		if (p->getAnc() != NULL)
+			collectOutsideUpdates(p, q, steps[q], done);
+		for (int n=0; n<nNodes; n++)
+			if (done[n] == true)
+				updated[n] = true;
+		}
+	for (int n=0; n<nNodes; n++)
+		if (updated[n] == true)
+			t->getNodeByIndex(n)->setIsClDirty(false);
+}
+
+/* Append the updates of the dirty internal nodes of the subtree of p in partition part to steps,
+ * in post order, each of them in a slot of the proposal. done marks the nodes appended. */
+void Model::collectLowerUpdates(Node *p, int part, vector<pair<Node *, bool> > &steps, vector<bool> &done) {
+
+	if (p->getLft() == NULL || p->getRht() == NULL || p->getIsClDirty() == false || done[p->getIdx()] == true)
+		return;
+	collectLowerUpdates(p->getLft(), part, steps, done);
+	collectLowerUpdates(p->getRht(), part, steps, done);
+	takeSlot(p, true, part);
+	steps.push_back(make_pair(p, false));
+	done[p->getIdx()] = true;
+}
+
+/* Append the updates of the outside partials of p (not the root) in partition part that are out
+ * of date to steps, after those of its parent and of the conditional likelihoods of its
+ * sibling. */
+void Model::collectOutsideUpdates(Node *p, int part, vector<pair<Node *, bool> > &steps, vector<bool> &done) {
+
+	int i = part * getActiveTree()->getNumNodes() + p->getIdx();
+	if (outsideValid[i] == true)
+		return;
+	Node *a = p->getAnc();
+	if (a->getAnc() != NULL)
+		collectOutsideUpdates(a, part, steps, done);
+	collectLowerUpdates(a->getLft() == p ? a->getRht() : a->getLft(), part, steps, done);
+	steps.push_back(make_pair(p, true));
+	outsideValid[i] = true;
+}
+
+/* The outside partials of a node depend on all branches but those below it. After the
+ * P-matrices of the nodes marked in changed were recomputed in partition part, only the outside
+ * partials of the nodes above all of them are still valid. */
+void Model::invalidateOutside(int part, const vector<bool> &changed) {
+
+	Tree *t = getActiveTree();
+	int nNodes = t->getNumNodes();
+	vector<int> numChanged(nNodes, 0);
+	for (int n=0; n<nNodes; n++)
+		{
+		Node *p = t->getDownPassNode(n);
+		int idx = p->getIdx();
+		numChanged[idx] = (changed[idx] == true ? 1 : 0);
+		if (p->getLft() != NULL)
+			numChanged[idx] += numChanged[p->getLft()->getIdx()];
+		if (p->getRht() != NULL)
+			numChanged[idx] += numChanged[p->getRht()->getIdx()];
+		}
+	int total = numChanged[t->getRoot()->getIdx()];
+	if (total == 0)
+		return;
+	for (int n=0; n<nNodes; n++)
+		if (numChanged[n] != total)
+			outsideValid[part * nNodes + n] = false;
+}
+
+void Model::checkPrecision(double lnL, double refLnL) {
+
+	double d = fabs(lnL - refLnL);
+	if (numPrecisionChecks == 0)
+		{
+		streamsize oldPrec = cout.precision(10);
+		cout << "Precision check: lnL = " << lnL << " (double: " << refLnL << ", difference " << d << ")" << endl;
+		cout.precision(oldPrec);
+		}
+	if (d > maxPrecisionDiff)
+		maxPrecisionDiff = d;
+	numPrecisionChecks++;
+}
+
+/* batchLnL of a candidate table from lnLikelihoodsAt against lnL, the same table evaluated
+ * alone by lnLikelihoodAt (-vout). */
+void Model::checkOutside(double batchLnL, double lnL) {
+
+	double d = fabs(batchLnL - lnL);
+	if (d > maxOutsideDiff)
+		maxOutsideDiff = d;
+	numOutsideChecks++;
+}
+
+void Model::printOutsideCheck(void) {
+
+	if (validateOutside == false)
+		return;
+	ios_base::fmtflags oldFlags = cout.flags();
+	streamsize oldPrec = cout.precision(3);
+	cout << "   Candidate table check: max |lnL(batched) - lnL| = " << scientific << maxOutsideDiff
+	     << " over " << numOutsideChecks << " candidate tables" << endl;
+	cout.flags(oldFlags);
+	cout.precision(oldPrec);
+}
+
+void Model::printPrecisionCheck(void) {
+
+	if (validatePrecision == false)
+		return;
+	ios_base::fmtflags oldFlags = cout.flags();
+	streamsize oldPrec = cout.precision(3);
+	cout << "   Precision check: max |lnL - lnL(double)| = " << scientific << maxPrecisionDiff
+	     << " over " << numPrecisionChecks << " likelihood evaluations" << endl;
+	cout.flags(oldFlags);
+	cout.precision(oldPrec);
+}
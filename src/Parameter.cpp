@@ -33,6 +33,7 @@
 #include "Parameter_expcalib.h"
 #include "Parameter_rate.h"
 #include "Parameter_shape.h"
+#include "Parameter_pinvar.h"
 #include "Parameter_tree.h"
 #include "Parameter_cphyperp.h"
 #include "Parameter_treescale.h"
@@ -45,6 +46,7 @@ Parameter::Parameter(MbRandom *rp, Model *mp) {
 
 	ranPtr = rp;
 	modelPtr = mp;
+	partition = 0;
 }
 
 Parameter& Parameter::operator=(Parameter &p) {
@@ -52,6 +54,7 @@ Parameter& Parameter::operator=(Parameter &p) {
 	if (this != &p){
 		ranPtr = p.ranPtr;
 		name   = p.name;
+		partition = p.partition;
 		
 		{
 			Basefreq *thatDerivedPtr = dynamic_cast<Basefreq *>(&p);
@@ -134,6 +137,15 @@ Parameter& Parameter::operator=(Parameter &p) {
 			}
 		}
 		
+		{
+			Pinvar *thatDerivedPtr = dynamic_cast<Pinvar *>(&p);
+			Pinvar *thisDerivedPtr = dynamic_cast<Pinvar *>(this);
+			if ( thatDerivedPtr != 0 && thisDerivedPtr != 0 ){
+				thisDerivedPtr->clone( *thatDerivedPtr );
+				goto exitOperator;
+			}
+		}
+		
 		exitOperator:
 			;
 	}
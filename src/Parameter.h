@@ -44,6 +44,8 @@ class Parameter {
 		Parameter				&operator=(Parameter &p);
 		std::string				getName(void) { return name; }
 		void					setName(std::string s) { name = s; }
+		int						getPartition(void) { return partition; }
+		void					setPartition(int i) { partition = i; }
 		virtual double			update(double &oldLnL)=0;
 		virtual double			lnPrior(void)=0;
 		virtual void			print(std::ostream &) const = 0;
@@ -51,6 +53,7 @@ class Parameter {
 						
 	protected:
 		std::string				name;
+		int						partition;		// alignment partition of a substitution parameter
 		MbRandom				*ranPtr;
 		Model					*modelPtr;
 };
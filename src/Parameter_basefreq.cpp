@@ -50,7 +50,7 @@ Basefreq::Basefreq(MbRandom *rp, Model *mp, int ns, bool fx) : Parameter(rp, mp)
 	name = "BF";
 	if(fx){
 		for (int i=0; i<numStates; i++)
-			freqs[i] = 0.25;
+			freqs[i] = 1.0 / numStates;
 	}
 }
 
@@ -118,12 +118,8 @@ double Basefreq::update(double &oldLnL) {
 	
 	double lnProposalRatio = ranPtr->lnDirichletPdf(aReverse, oldFreqs) - ranPtr->lnDirichletPdf(aForward, newFreqs);
 		
-	Tree *t = modelPtr->getActiveTree();
-	t->flipAllCls();
-	t->flipAllTis();
-	t->upDateAllCls();
-	t->upDateAllTis();
-	modelPtr->upDateRateMatrix();
+	modelPtr->upDatePartition(partition);
+	modelPtr->upDateRateMatrix(partition);
 	modelPtr->setTiProb();
 	return lnProposalRatio;
 }
@@ -34,22 +34,68 @@
 #include "Parameter_tree.h"
 #include <iostream>
 #include <iomanip>
+#include <fstream>
+#include <cstdlib>
 
 using namespace std;
 
 
 
-Exchangeability::Exchangeability(MbRandom *rp, Model *mp) : Parameter(rp, mp) {
+/* The exchangeabilities of the ns(ns-1)/2 pairs of states. With fx they are not updated:
+ * they are read from the file rfn if one is given, else they are all equal. */
+Exchangeability::Exchangeability(MbRandom *rp, Model *mp, int ns, bool fx, string rfn) : Parameter(rp, mp) {
 
-	rates = MbVector<double>(6);
-	alpha = MbVector<double>(6);
-	for (int i=0; i<6; i++)
+	numStates = ns;
+	numRates = ns * (ns - 1) / 2;
+	isFixed = fx;
+	rates = MbVector<double>(numRates);
+	alpha = MbVector<double>(numRates);
+	for (int i=0; i<numRates; i++)
 		alpha[i] = 1.0;
-	ranPtr->dirichletRv(alpha, rates);
+	if (rfn.empty() == false)
+		readRateFile(rfn);
+	else if (isFixed == true)
+		{
+		for (int i=0; i<numRates; i++)
+			rates[i] = 1.0 / numRates;
+		}
+	else
+		ranPtr->dirichletRv(alpha, rates);
 	alpha0 = 800.0;
 	name = "RM";
 }
 
+/* Read the exchangeabilities from a PAML-style file: the lower triangle of the symmetric
+ * matrix, row by row, with the states in the order of the alignment (AA_STATE_ORDER for
+ * protein data). Anything after the triangle, such as the PAML frequencies, is ignored. */
+void Exchangeability::readRateFile(string rfn) {
+
+	ifstream rateStream(rfn.c_str());
+	if (!rateStream)
+		{
+		cerr << "ERROR: Cannot open the rate matrix file \"" << rfn << "\"" << endl;
+		exit(1);
+		}
+	double sum = 0.0;
+	for (int i=1; i<numStates; i++)
+		{
+		for (int j=0; j<i; j++)
+			{
+			double r;
+			if (!(rateStream >> r) || r <= 0.0)
+				{
+				cerr << "ERROR: Expected " << numRates << " positive rates in the rate matrix file \"" << rfn << "\"" << endl;
+				exit(1);
+				}
+			// the rates are stored as the upper triangle, row by row
+			rates[j * numStates - j * (j + 1) / 2 + i - j - 1] = r;
+			sum += r;
+			}
+		}
+	for (int i=0; i<numRates; i++)
+		rates[i] /= sum;
+}
+
 Exchangeability::~Exchangeability(void) {
 
 }
@@ -63,54 +109,50 @@ Exchangeability& Exchangeability::operator=(const Exchangeability &b) {
 
 void Exchangeability::clone(const Exchangeability &b) {
 
-	for (int i=0; i<6; i++)
+	for (int i=0; i<numRates; i++)
 		rates[i] = b.rates[i];
 }
 
 void Exchangeability::print(std::ostream & o) const {
 
 	o << "Substitution Rates: ";
-	for (int i=0; i<6; i++)
+	for (int i=0; i<numRates; i++)
 		o << fixed << setprecision(4) << rates[i] << " ";
 	o << endl;
 }
 
 double Exchangeability::update(double &oldLnL) {
 
-	MbVector<double> aForward(6);
-	MbVector<double> aReverse(6);
-	MbVector<double> oldRates(6);
-	MbVector<double> newRates(6);
+	MbVector<double> aForward(numRates);
+	MbVector<double> aReverse(numRates);
+	MbVector<double> oldRates(numRates);
+	MbVector<double> newRates(numRates);
 	
-	for (int i=0; i<6; i++){
+	for (int i=0; i<numRates; i++){
 		oldRates[i] = rates[i];
 		aForward[i] = rates[i] * alpha0;
 	}
 		
 	ranPtr->dirichletRv(aForward, newRates);
 	double sum = 0.0;
-	for(int i=0; i<6; i++){
+	for(int i=0; i<numRates; i++){
 		if(newRates[i] < 0.000001)
 			newRates[i] = 0.000001;
 		sum += newRates[i];
 	}
-	for(int i=0; i<6; i++)
+	for(int i=0; i<numRates; i++)
 		newRates[i] /= sum;	
 	
-	for (int i=0; i<6; i++)
+	for (int i=0; i<numRates; i++)
 		rates[i] = newRates[i];
 	
-	for (int i=0; i<6; i++)
+	for (int i=0; i<numRates; i++)
 		aReverse[i] = newRates[i] * alpha0;
 		
 	double lnProposalRatio = ranPtr->lnDirichletPdf(aReverse, oldRates) - ranPtr->lnDirichletPdf(aForward, newRates);
 	
-	Tree *t = modelPtr->getActiveTree();
-	t->flipAllCls();
-	t->flipAllTis();
-	t->upDateAllCls();
-	t->upDateAllTis();
-	modelPtr->upDateRateMatrix();
+	modelPtr->upDatePartition(partition);
+	modelPtr->upDateRateMatrix(partition);
 	modelPtr->setTiProb();
 
 	return lnProposalRatio;
@@ -125,7 +167,7 @@ string Exchangeability::writeParam(void){
 	
 	stringstream ss;
 	ss << "Substitution Rates: ";
-	for (int i=0; i<6; i++)
+	for (int i=0; i<numRates; i++)
 		ss << fixed << setprecision(4) << rates[i] << " ";
 	ss << endl;
 	string outp = ss.str();
@@ -31,6 +31,7 @@
 #define PARAMETER_EXCHANGEABILITY_H
 
 #include "MbVector.h"
+#include <string>
 
 
 
@@ -39,18 +40,24 @@ class Model;
 class Exchangeability : public Parameter {
 
 	public:
-									Exchangeability(MbRandom *rp, Model *mp);
+									Exchangeability(MbRandom *rp, Model *mp, int ns, bool fx, std::string rfn);
 									~Exchangeability(void); 
 		Exchangeability				&operator=(const Exchangeability &b);
 		void						clone(const Exchangeability &b);
 		double						getRate(int i) { return rates[i]; }
 		MbVector<double>&			getRate(void) { return rates; }
+		int							getNumRates(void) { return numRates; }
+		bool						getIsFixed(void) { return isFixed; }
 		double						update(double &oldLnL);
 		double						lnPrior(void);
 		void						print(std::ostream & o) const;
 		std::string					writeParam(void);
 							
 	private:
+		void						readRateFile(std::string rfn);
+		int							numStates;
+		int							numRates;
+		bool						isFixed;
 		MbVector<double>			rates;
 		MbVector<double>			alpha;
 		double						alpha0;
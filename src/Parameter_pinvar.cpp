@@ -0,0 +1,105 @@
+/* 
+ * DPPDiv version 1.1b source code (https://github.com/trayc7/FDPPDIV)
+ * Copyright 2009-2013
+ * Tracy Heath(1,2,3) 
+ * Mark Holder(1)
+ * John Huelsenbeck(2)
+ *
+ * (1) Department of Ecology and Evolutionary Biology, University of Kansas, Lawrence, KS 66045
+ * (2) Integrative Biology, University of California, Berkeley, CA 94720-3140
+ * (3) email: tracyh@berkeley.edu
+ *
+ * Also: T Stadler, D Darriba, AJ Aberer, T Flouri, F Izquierdo-Carrasco, and A Stamatakis
+ *
+ * DPPDiv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License (the file gpl.txt included with this
+ * distribution or http://www.gnu.org/licenses/gpl.txt for more
+ * details.
+ *
+ * Some of this code is from publicly available source by John Huelsenbeck and Fredrik Ronquist
+ *
+ */
+
+#include "Parameter.h"
+#include "Parameter_pinvar.h"
+#include "MbRandom.h"
+#include "Model.h"
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+
+using namespace std;
+
+/* The proportion of invariant sites (+I), with a uniform prior on [0, 1]. It only enters the
+ * likelihood at the root, so an update does not touch the conditional likelihoods. */
+Pinvar::Pinvar(MbRandom *rp, Model *mp, double pi, bool fx) : Parameter(rp, mp) {
+
+	pInv   = pi;
+	window = 0.1;
+	name = "PI";
+	if(fx){
+		pInv = 0.0;
+	}
+}
+
+Pinvar::~Pinvar(void) {
+
+}
+
+Pinvar& Pinvar::operator=(const Pinvar &p) {
+
+	if (this != &p)
+		clone(p);
+	return *this;
+}
+
+void Pinvar::clone(const Pinvar &p) {
+
+	pInv   = p.pInv;
+	window = p.window;
+}
+
+void Pinvar::print(std::ostream & o) const {
+
+	o << "Proportion of invariant sites: " << fixed << setprecision(4) << pInv << endl;
+}
+
+double Pinvar::update(double &oldLnL) {
+
+	// sliding window, reflected back into [0, 1]
+	double newPInv = pInv + window * (ranPtr->uniformRv() - 0.5);
+	bool validPInv = false;
+	do{
+		if(newPInv < 0.0)
+			newPInv = -newPInv;
+		else if(newPInv > 1.0)
+			newPInv = 2.0 - newPInv;
+		else
+			validPInv = true;
+	} while(!validPInv);
+	pInv = newPInv;
+	
+	// the proposal is symmetric and the prior uniform
+	return 0.0;
+}
+
+double Pinvar::lnPrior(void) {
+
+	return 0.0;
+}
+
+string Pinvar::writeParam(void){
+	
+	stringstream ss;
+	ss << "Proportion of invariant sites: " << fixed << setprecision(4) << pInv << endl;
+	string outp = ss.str();
+	return outp;
+}
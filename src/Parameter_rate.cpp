@@ -207,7 +207,11 @@ double NodeRate::updateDPM(double &oldLnL) {
 	const double lnConcOverNumAux = log(concentrationParm/numAuxiliary);
 	RateGroup **auxiliaryRateGroups = new RateGroup*[numAuxiliary];
 	
-	for (int i=0; i<numNodes; i++){
+	// with outside partials the nodes are seated in pre order, and a candidate table only
+	// changes the branch of the node (see Model::lnLikelihoodAt)
+	bool useOutside = modelPtr->getUseOutsidePartials();
+	for (int n=0; n<numNodes; n++){
+		int i = (useOutside ? t->getDownPassNode(numNodes-1-n)->getIdx() : n);
 		if(i != rootID) {
 			RateGroup *origGroup = findRateGroupWithElementIndexed( i );
 			origGroup->removeRateElement( i );
@@ -216,29 +220,61 @@ double NodeRate::updateDPM(double &oldLnL) {
 			
 			vector<double> lnProb;
 			lnProb.reserve(rateGroups.size() + numAuxiliary);
-			for (vector<RateGroup *>::iterator p=rateGroups.begin(); p != rateGroups.end(); p++){
-				const int numSeatedElements = (*p)->getNumRateElements();
-				(*p)->addRateElement(i);
-				t->updateToRootClsTis(i);
-				modelPtr->setTiProb();
-				double rglnl = modelPtr->lnLikelihood();
-				lnProb.push_back( log(numSeatedElements) + rglnl );
-				(*p)->removeRateElement(i);
+			if(useOutside){
+				// all tables at once, they only differ in the rate of the branch of i
+				vector<double> tableRates, lnLs;
+				for (vector<RateGroup *>::iterator p=rateGroups.begin(); p != rateGroups.end(); p++)
+					tableRates.push_back( (*p)->getRate() );
+				for (int j=0; j<numAuxiliary; j++){
+					auxiliaryRateGroups[j] = new RateGroup(ranPtr->gammaRv(alpha, beta));
+					tableRates.push_back( auxiliaryRateGroups[j]->getRate() );
+				}
+				modelPtr->lnLikelihoodsAt(t->getNodeByIndex(i), tableRates, lnLs);
+				if(modelPtr->getValidateOutside()){
+					// seat the node at every table in turn and evaluate it there alone
+					for (unsigned g=0; g<tableRates.size(); g++){
+						bool isAux = (g >= rateGroups.size());
+						RateGroup *grp = (isAux ? auxiliaryRateGroups[g - rateGroups.size()] : rateGroups[g]);
+						if(isAux)
+							rateGroups.push_back( grp );
+						grp->addRateElement(i);
+						t->updateBranchClsTis(i);
+						modelPtr->checkOutside(lnLs[g], modelPtr->lnLikelihoodAt(t->getNodeByIndex(i)));
+						grp->removeRateElement(i);
+						if(isAux)
+							removeRateGroup(grp);
+					}
+				}
+				for (unsigned g=0; g<rateGroups.size(); g++)
+					lnProb.push_back( log(rateGroups[g]->getNumRateElements()) + lnLs[g] );
+				for (int j=0; j<numAuxiliary; j++)
+					lnProb.push_back( lnConcOverNumAux + lnLs[rateGroups.size() + j] );
 			}
+			else{
+				for (vector<RateGroup *>::iterator p=rateGroups.begin(); p != rateGroups.end(); p++){
+					const int numSeatedElements = (*p)->getNumRateElements();
+					(*p)->addRateElement(i);
+					t->updateToRootClsTis(i);
+					modelPtr->setTiProb();
+					double rglnl = modelPtr->lnLikelihood();
+					lnProb.push_back( log(numSeatedElements) + rglnl );
+					(*p)->removeRateElement(i);
+				}
 
-			for (int j=0; j<numAuxiliary; j++)
-				auxiliaryRateGroups[j] = new RateGroup(ranPtr->gammaRv(alpha, beta));
-			for (int j=0; j<numAuxiliary; j++){
-				RateGroup *tempGrp = NULL;  
-				tempGrp = auxiliaryRateGroups[j]; 
-				rateGroups.push_back( tempGrp ); 
-				auxiliaryRateGroups[j]->addRateElement(i);
-				t->updateToRootClsTis(i);
-				modelPtr->setTiProb(); 
-				double rglnl = modelPtr->lnLikelihood();
-				lnProb.push_back( lnConcOverNumAux + rglnl );
-				auxiliaryRateGroups[j]->removeRateElement(i);
-				removeRateGroup(tempGrp); 
+				for (int j=0; j<numAuxiliary; j++)
+					auxiliaryRateGroups[j] = new RateGroup(ranPtr->gammaRv(alpha, beta));
+				for (int j=0; j<numAuxiliary; j++){
+					RateGroup *tempGrp = NULL;  
+					tempGrp = auxiliaryRateGroups[j]; 
+					rateGroups.push_back( tempGrp ); 
+					auxiliaryRateGroups[j]->addRateElement(i);
+					t->updateToRootClsTis(i);
+					modelPtr->setTiProb(); 
+					double rglnl = modelPtr->lnLikelihood();
+					lnProb.push_back( lnConcOverNumAux + rglnl );
+					auxiliaryRateGroups[j]->removeRateElement(i);
+					removeRateGroup(tempGrp); 
+				}
 			}
 						
 			normalizeVector(lnProb);
@@ -259,14 +295,15 @@ double NodeRate::updateDPM(double &oldLnL) {
 				if (auxiliaryRateGroups[j] != newGroup)
 					delete auxiliaryRateGroups[j];
 			}
-			t->updateToRootClsTis(i);
+			if(useOutside)
+				t->updateBranchClsTis(i);
+			else
+				t->updateToRootClsTis(i);
 		}
 	}
 	
 	delete [] auxiliaryRateGroups;
 	
-	t->flipAllCls();
-	t->flipAllTis();
 	t->upDateAllCls();
 	t->upDateAllTis();
 	modelPtr->setTiProb();
@@ -304,8 +341,6 @@ double NodeRate::updateCLOCK(double &oldLnL) {
 			(*p)->updateRelevantNodesinTre(t);
 		}
 	}
-	t->flipAllCls();
-	t->flipAllTis();
 	t->upDateAllCls();
 	t->upDateAllTis();
 	modelPtr->setTiProb();
@@ -346,8 +381,6 @@ double NodeRate::updateUnCorrGamma(double &oldLnL) {
 		}
 	}
 			
-	t->flipAllCls();
-	t->flipAllTis();
 	t->upDateAllCls();
 	t->upDateAllTis();
 	modelPtr->setTiProb();
@@ -111,11 +111,7 @@ double Shape::update(double &oldLnL) {
 	double lnProposalRatio = log(newAlpha) - log(oldAlpha);
 	double lnPriorRatio = lambda * (oldAlpha - newAlpha); 
 
-	Tree *t = modelPtr->getActiveTree();
-	t->flipAllCls();
-	t->flipAllTis();
-	t->upDateAllCls();
-	t->upDateAllTis();
+	modelPtr->upDatePartition(partition);
 	modelPtr->setTiProb();
 	
 	return lnPriorRatio + lnProposalRatio;  
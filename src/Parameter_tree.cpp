@@ -54,8 +54,8 @@ Node::Node(void) {
 	anc = NULL;
 	idx = 0;
 	name = "";
-	activeCl = 0;
-	activeTi = 0;
+	activeCl.assign(1, 0);
+	activeTi.assign(1, 0);
 	isClDirty = true;
 	isTiDirty = true;
 	nodeDepth = 0.0;
@@ -280,8 +280,7 @@ void Tree::clone(const Tree &t) {
 		Node *pFrom = &t.nodes[i];
 				
 		pTo->setName( pFrom->getName() );
-		pTo->setActiveCl( pFrom->getActiveCl() );
-		pTo->setActiveTi( pFrom->getActiveTi() );
+		pTo->copySlots( pFrom );
 		pTo->setIsClDirty( pFrom->getIsClDirty() );
 		pTo->setIsTiDirty( pFrom->getIsTiDirty() );
 		pTo->setNodeDepth( pFrom->getNodeDepth() );
@@ -1046,7 +1045,6 @@ double Tree::updateOneNode() {
 
 		p->setNodeDepth(newNodeDepth);
 		
-		flipToRootClsTis(p);
 		updateToRootClsTis(p);
 		modelPtr->setTiProb();
 		if(p->getIsCalibratedDepth()){
@@ -1075,9 +1073,13 @@ double Tree::updateAllNodes(double &oldLnL) {
 	double oldLike = oldLnL;
 	Node *p = NULL;
 	vector<int> rndNodeIDs;
+	// with outside partials the nodes are visited in pre order, each one then only needs the
+	// outside partials of its parent
+	bool useOutside = modelPtr->getUseOutsidePartials();
 	for(int i=0; i<numNodes; i++)
-		rndNodeIDs.push_back(i);
-	random_shuffle(rndNodeIDs.begin(), rndNodeIDs.end());
+		rndNodeIDs.push_back(useOutside ? numNodes-1-i : i);
+	if(!useOutside)
+		random_shuffle(rndNodeIDs.begin(), rndNodeIDs.end());
 	for(vector<int>::iterator it=rndNodeIDs.begin(); it!=rndNodeIDs.end(); it++){
 		p = downPassSequence[(*it)];
 		if(p != root && !p->getIsLeaf()){
@@ -1105,11 +1107,18 @@ double Tree::updateAllNodes(double &oldLnL) {
 				double lnPrRatio = lnPriorRatio(newNodeDepth/treeScale, currDepth/treeScale);
 				p->setNodeDepth(newNodeDepth/treeScale);
 				
-				flipToRootClsTis(p);
-				updateToRootClsTis(p);
-				modelPtr->setTiProb();
-				
-				double newLnl = modelPtr->lnLikelihood();
+				double newLnl;
+				if(useOutside){
+					updateBranchClsTis(p->getLft());
+					updateBranchClsTis(p->getRht());
+					updateBranchClsTis(p);
+					newLnl = modelPtr->lnLikelihoodAt(p);
+				}
+				else{
+					updateToRootClsTis(p);
+					modelPtr->setTiProb();
+					newLnl = modelPtr->lnLikelihood();
+				}
 				double lnLRatio = newLnl - oldLike;
 				if(p->getIsCalibratedDepth()){					
 					if(softBounds && p->getNodeCalibPrDist() == 1){
@@ -1131,8 +1140,13 @@ double Tree::updateAllNodes(double &oldLnL) {
 				}
 				else{
 					p->setNodeDepth(currDepth/treeScale);
-					flipToRootClsTis(p);
-					updateToRootClsTis(p);
+					if(useOutside){
+						updateBranchClsTis(p->getLft());
+						updateBranchClsTis(p->getRht());
+						updateBranchClsTis(p);
+					}
+					else
+						updateToRootClsTis(p);
 				}
 			}
 		}
@@ -1178,7 +1192,6 @@ double Tree::updateAllTGSNodes(double &oldLnL) {
 				double lnPrRatio = lnPriorRatioTGS(newNodeDepth, currDepth, p);
 				p->setNodeDepth(newNodeDepth/treeScale);
 	
-				flipToRootClsTis(p);
 				updateToRootClsTis(p);
 				modelPtr->setTiProb();
 				double newLnl = modelPtr->lnLikelihood();
@@ -1192,7 +1205,6 @@ double Tree::updateAllTGSNodes(double &oldLnL) {
 				}
 				else{
 					p->setNodeDepth(currDepth/treeScale);
-					flipToRootClsTis(p);
 					updateToRootClsTis(p);
 				}
 			}
@@ -1261,7 +1273,6 @@ double Tree::updateAllNodesRnd(double &oldLnL) {
 
 				p->setNodeDepth(newNodeDepth);
 				
-				flipToRootClsTis(p);
 				updateToRootClsTis(p);
 				modelPtr->setTiProb();
 				
@@ -1288,7 +1299,6 @@ double Tree::updateAllNodesRnd(double &oldLnL) {
 				}
 				else{
 					p->setNodeDepth(currDepth);
-					flipToRootClsTis(p);
 					updateToRootClsTis(p);
 				}
 			}
@@ -1481,18 +1491,6 @@ double Tree::lnExpCalibPriorRatio(double nh, double oh, double offSt, double exp
 
 
 
-void Tree::flipAllCls(void) {
-
-	for (int n=0; n<numNodes; n++)
-		nodes[n].flipCl();
-}
-
-void Tree::flipAllTis(void) {
-
-	for (int n=0; n<numNodes; n++)
-		nodes[n].flipTi();
-}
-
 void Tree::upDateAllCls(void) {
 
 	for (int n=0; n<numNodes; n++)
@@ -1505,22 +1503,6 @@ void Tree::upDateAllTis(void) {
 		nodes[n].setIsTiDirty(true);
 }
 
-void Tree::flipToRootClsTis(Node *p){
-	
-	Node *q = p;
-	if(!q->getIsLeaf()){
-		q->getLft()->flipCl();
-		q->getRht()->flipCl();
-		q->getLft()->flipTi();
-		q->getRht()->flipTi();
-	}
-	while(q != NULL){
-		q->flipCl();
-		q->flipTi();
-		q = q->getAnc();
-	}
-}
-
 void Tree::updateToRootClsTis(Node *p){
 	
 	Node *q = p;
@@ -1538,24 +1520,23 @@ void Tree::updateToRootClsTis(Node *p){
 }
 
 // overloaded function when passing in just the node ID, then this is called by the DPP rate move.
-void Tree::flipToRootClsTis(int ndID){
+void Tree::updateToRootClsTis(int ndID){
 
 	Node *q = &nodes[ndID];
 	while(q != NULL){
-		q->flipCl();
-		q->flipTi();
+		q->setIsClDirty(true);
+		q->setIsTiDirty(true);
 		q = q->getAnc();
 	}
 }
 
-void Tree::updateToRootClsTis(int ndID){
+// only the branch of p changed: with outside partials (Model::lnLikelihoodAt) the conditional
+// likelihoods of p stay valid, and the P-matrices of the branches above it do not change
+void Tree::updateBranchClsTis(Node *p){
 
-	Node *q = &nodes[ndID];
-	while(q != NULL){
+	p->setIsTiDirty(true);
+	for(Node *q=p->getAnc(); q!=NULL; q=q->getAnc())
 		q->setIsClDirty(true);
-		q->setIsTiDirty(true);
-		q = q->getAnc();
-	}
 }
 
 
@@ -39,15 +39,13 @@ class Node {
 
 	public:
 						Node(void);
-		void			flipCl(void) { (activeCl == 0 ? activeCl = 1 : activeCl = 0); }
-		void			flipTi(void) { (activeTi == 0 ? activeTi = 1 : activeTi = 0); }
 		Node*			getLft(void) { return lft; }
 		Node*			getRht(void) { return rht; }
 		Node*			getAnc(void) { return anc; }
 		int				getIdx(void) const { return idx; }
 		std::string		getName(void) { return name; }
-		int				getActiveCl(void) { return activeCl; }
-		int				getActiveTi(void) { return activeTi; }
+		int				getActiveCl(int part) { return activeCl[part]; }
+		int				getActiveTi(int part) { return activeTi[part]; }
 		bool			getIsClDirty(void) { return isClDirty; }
 		bool			getIsTiDirty(void) { return isTiDirty; }
 		double			getNodeDepth(void) { return nodeDepth; }
@@ -58,8 +56,10 @@ class Node {
 		void			setAnc(Node *p) { anc = p; }
 		void			setIdx(int x) { idx = x; }
 		void			setName(std::string s) { name = s; }
-		void			setActiveCl(int x) { activeCl = x; }
-		void			setActiveTi(int x) { activeTi = x; }
+		void			setActiveCl(int part, int x) { activeCl[part] = x; }
+		void			setActiveTi(int part, int x) { activeTi[part] = x; }
+		void			setNumPartitions(int n) { activeCl.resize(n, 0); activeTi.resize(n, 0); }
+		void			copySlots(const Node *p) { activeCl = p->activeCl; activeTi = p->activeTi; }
 		void			setIsClDirty(bool x) { isClDirty = x; }
 		void			setIsTiDirty(bool x) { isTiDirty = x; }
 		void			setNodeDepth(double x) { nodeDepth = x; }
@@ -109,8 +109,8 @@ class Node {
 		Node			*anc;
 		int				idx;
 		std::string		name;
-		int				activeCl;
-		int				activeTi;
+		std::vector<int>	activeCl;	// slot of the conditional likelihoods of every partition in the Model's pools
+		std::vector<int>	activeTi;	// slot of the transition probabilities of every partition
 		bool			isClDirty;
 		bool			isTiDirty;
 		double			nodeDepth;
@@ -207,14 +207,12 @@ class Tree : public Parameter {
 		double							lnCalibPriorRatio(double nh, double oh, double lb, double ub);
 		double							lnExpCalibPriorRatio(double nh, double oh, double offSt, double expRate);
 		void							print(std::ostream & o) const;
-		void							flipAllCls(void);
-		void							flipAllTis(void);
 		void							upDateAllCls(void);
 		void							upDateAllTis(void);
-		void							flipToRootClsTis(Node *p);
 		void							updateToRootClsTis(Node *p);
-		void							flipToRootClsTis(int ndID);
 		void							updateToRootClsTis(int ndID);
+		void							updateBranchClsTis(Node *p);
+		void							updateBranchClsTis(int ndID) { updateBranchClsTis(&nodes[ndID]); }
 		std::string						getTreeDescription(void);
 		std::string						getFigTreeDescription(void);
 		std::string						getCalibInitialTree(void);
@@ -237,8 +237,6 @@ double Treescale::updateTreeScale(double &oldLnL) {
 		jacobian = (log(oldRH) - log(newRH)) * (t->getNumTaxa() - 2);
 
 
-	t->flipAllCls();
-	t->flipAllTis();
 	t->upDateAllCls();
 	t->upDateAllTis();
 	modelPtr->setTiProb();
@@ -323,8 +321,6 @@ double Treescale::updateTreeScalePropSE(double &oldLnL) {
 	if(treeTimePrior < 2)
 		jacobian = (log(oldRH) - log(newRH)) * (t->getNumTaxa() - 2);
 	
-	t->flipAllCls();
-	t->flipAllTis();
 	t->upDateAllCls();
 	t->upDateAllTis();
 	modelPtr->setTiProb();
@@ -0,0 +1,265 @@
+/* 
+ * DPPDiv version 1.1b source code (https://github.com/trayc7/FDPPDIV)
+ * Copyright 2009-2013
+ * Tracy Heath(1,2,3) 
+ * Mark Holder(1)
+ * John Huelsenbeck(2)
+ *
+ * (1) Department of Ecology and Evolutionary Biology, University of Kansas, Lawrence, KS 66045
+ * (2) Integrative Biology, University of California, Berkeley, CA 94720-3140
+ * (3) email: tracyh@berkeley.edu
+ *
+ * Also: T Stadler, D Darriba, AJ Aberer, T Flouri, F Izquierdo-Carrasco, and A Stamatakis
+ *
+ * DPPDiv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License (the file gpl.txt included with this
+ * distribution or http://www.gnu.org/licenses/gpl.txt for more
+ * details.
+ *
+ * Some of this code is from publicly available source by John Huelsenbeck and Fredrik Ronquist
+ *
+ */
+
+#include "SiteLikelihoods.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <limits>
+
+using namespace std;
+
+SiteLikelihoods::SiteLikelihoods(const vector<int> &weights, int expectedSamples) {
+
+	siteWeights = weights;
+	numSamples = 0;
+	// as in the loo package, min(S/5, 3 sqrt(S)) of the S ratios
+	tailLength = 0;
+	if (expectedSamples > 0)
+		tailLength = (int)ceil(min(0.2 * expectedSamples, 3.0 * sqrt((double)expectedSamples)));
+	int n = (int)weights.size();
+	meanLnL.assign(n, 0.0);
+	m2LnL.assign(n, 0.0);
+	maxLnL.assign(n, 0.0);
+	sumLik.assign(n, 0.0);
+	maxLnR.assign(n, 0.0);
+	sumRatio.assign(n, 0.0);
+	tail.assign(n, vector<double>());
+	for (int i=0; i<n; i++)
+		tail[i].reserve(tailLength + 1);
+}
+
+// add exp(x) to the sum exp(mx) * sum, rescaled to the larger of the two
+void SiteLikelihoods::addLogTerm(double x, double &mx, double &sum) {
+
+	if (sum == 0.0)
+		{
+		mx = x;
+		sum = 1.0;
+		}
+	else if (x <= mx)
+		sum += exp(x - mx);
+	else
+		{
+		sum = sum * exp(mx - x) + 1.0;
+		mx = x;
+		}
+}
+
+void SiteLikelihoods::addSample(const vector<double> &lnLs) {
+
+	numSamples++;
+	for (unsigned i=0; i<siteWeights.size(); i++)
+		{
+		double l = lnLs[i];
+		double d = l - meanLnL[i];
+		meanLnL[i] += d / numSamples;
+		m2LnL[i] += d * (l - meanLnL[i]);
+		addLogTerm(l, maxLnL[i], sumLik[i]);
+		addLogTerm(-l, maxLnR[i], sumRatio[i]);
+		vector<double> &h = tail[i];
+		if ((int)h.size() < tailLength + 1)
+			{
+			h.push_back(-l);
+			push_heap(h.begin(), h.end(), greater<double>());
+			}
+		else if (-l > h.front())
+			{
+			pop_heap(h.begin(), h.end(), greater<double>());
+			h.back() = -l;
+			push_heap(h.begin(), h.end(), greater<double>());
+			}
+		}
+}
+
+/* The generalized Pareto fit of Zhang and Stephens (2009) to the exceedances x (ascending), with
+ * the weakly informative prior on k of the loo package. k is NaN if it cannot be fit. */
+void SiteLikelihoods::fitGeneralizedPareto(const vector<double> &x, double &k, double &sigma) {
+
+	int n = (int)x.size();
+	int m = 30 + (int)sqrt((double)n);
+	int q = (int)floor(n / 4.0 + 0.5) - 1;
+	double xStar = x[q < 0 ? 0 : q];
+	k = numeric_limits<double>::quiet_NaN();
+	sigma = 0.0;
+	if (xStar <= 0.0 || x[n - 1] <= 0.0)
+		return;
+	vector<double> theta(m), lnLik(m);
+	double mx = -numeric_limits<double>::infinity();
+	for (int j=0; j<m; j++)
+		{
+		theta[j] = 1.0 / x[n - 1] + (1.0 - sqrt(m / (j + 0.5))) / 3.0 / xStar;
+		double kj = 0.0;
+		for (int i=0; i<n; i++)
+			kj += log1p(-theta[j] * x[i]);
+		kj /= n;
+		lnLik[j] = n * (log(-theta[j] / kj) - kj - 1.0);
+		if (lnLik[j] != lnLik[j])
+			lnLik[j] = -numeric_limits<double>::infinity();
+		mx = max(mx, lnLik[j]);
+		}
+	if (mx == -numeric_limits<double>::infinity())
+		return;
+	double sumW = 0.0, thetaHat = 0.0;
+	for (int j=0; j<m; j++)
+		{
+		double w = exp(lnLik[j] - mx);
+		sumW += w;
+		thetaHat += theta[j] * w;
+		}
+	thetaHat /= sumW;
+	k = 0.0;
+	for (int i=0; i<n; i++)
+		k += log1p(-thetaHat * x[i]);
+	k /= n;
+	sigma = -k / thetaHat;
+	k = (k * n + 10 * 0.5) / (n + 10);
+}
+
+/* The PSIS-LOO estimate of the log predictive density of pattern i and its Pareto k. The
+ * log ratios are scaled by the largest one; those of the tail are replaced by the quantiles of
+ * the generalized Pareto fit to their exceedances of the cutoff, the largest ratio kept below
+ * the tail, and capped at the largest raw ratio. A sample below the tail contributes the same,
+ * 1 / largest ratio, to the weighted likelihood, and the sum of their ratios is the total less
+ * the tail. Without a fit (fewer than 5 in the tail) this is plain importance sampling. */
+void SiteLikelihoods::psisLoo(int i, double &elpd, double &k) {
+
+	vector<double> h = tail[i];
+	sort(h.begin(), h.end());
+	int m = (int)h.size() - 1;
+	double rMax = h.back();
+	vector<double> lw(m), sw(m);
+	for (int j=0; j<m; j++)
+		{
+		lw[j] = h[j + 1] - rMax;
+		sw[j] = lw[j];
+		}
+	k = numeric_limits<double>::quiet_NaN();
+	if (m >= 5 && h.back() - h[1] > numeric_limits<double>::epsilon() / 100.0)
+		{
+		double eCut = exp(h[0] - rMax);
+		vector<double> x(m);
+		for (int j=0; j<m; j++)
+			x[j] = exp(lw[j]) - eCut;
+		double sigma;
+		fitGeneralizedPareto(x, k, sigma);
+		if (k == k && fabs(k) != numeric_limits<double>::infinity())
+			{
+			for (int j=0; j<m; j++)
+				{
+				double p = (j + 0.5) / m;
+				double qq = (fabs(k) < 1e-12 ? -sigma * log1p(-p) : sigma * expm1(-k * log1p(-p)) / k);
+				sw[j] = min(log(qq + eCut), 0.0);
+				}
+			}
+		}
+	double num = numSamples - m, rawTail = 0.0, smoothTail = 0.0;
+	for (int j=0; j<m; j++)
+		{
+		num += exp(sw[j] - lw[j]);
+		rawTail += exp(lw[j]);
+		smoothTail += exp(sw[j]);
+		}
+	double below = max(sumRatio[i] * exp(maxLnR[i] - rMax) - rawTail, 0.0);
+	elpd = log(num) - rMax - log(below + smoothTail);
+}
+
+/* The estimates summed over the sites, with their standard errors from the variance over the
+ * sites, and with pointwise the values of every pattern. */
+void SiteLikelihoods::print(ostream &o, bool pointwise) {
+
+	int n = (int)siteWeights.size();
+	if (numSamples == 0)
+		{
+		o << "WAIC and PSIS-LOO: no samples after the burn-in" << endl;
+		return;
+		}
+	vector<double> lppd(n), pWaic(n), elpdLoo(n), kHat(n);
+	long numSites = 0, numBadK = 0;
+	double maxK = -numeric_limits<double>::infinity();
+	for (int i=0; i<n; i++)
+		{
+		lppd[i] = maxLnL[i] + log(sumLik[i]) - log((double)numSamples);
+		pWaic[i] = (numSamples > 1 ? m2LnL[i] / (numSamples - 1) : 0.0);
+		psisLoo(i, elpdLoo[i], kHat[i]);
+		numSites += siteWeights[i];
+		if (kHat[i] == kHat[i])
+			{
+			maxK = max(maxK, kHat[i]);
+			if (kHat[i] > 0.7)
+				numBadK += siteWeights[i];
+			}
+		}
+
+	const int numEst = 4;
+	const char *names[numEst] = { "elpd_waic", "p_waic", "elpd_loo", "p_loo" };
+	double sum[numEst], se[numEst];
+	for (int e=0; e<numEst; e++)
+		{
+		vector<double> v(n);
+		for (int i=0; i<n; i++)
+			v[i] = (e == 0 ? lppd[i] - pWaic[i] : (e == 1 ? pWaic[i] : (e == 2 ? elpdLoo[i] : lppd[i] - elpdLoo[i])));
+		double s = 0.0, ss = 0.0;
+		for (int i=0; i<n; i++)
+			s += siteWeights[i] * v[i];
+		double mean = s / numSites;
+		for (int i=0; i<n; i++)
+			ss += siteWeights[i] * (v[i] - mean) * (v[i] - mean);
+		sum[e] = s;
+		se[e] = (numSites > 1 ? sqrt(numSites * ss / (numSites - 1)) : 0.0);
+		}
+
+	o << fixed << setprecision(3);
+	o << "WAIC and PSIS-LOO from " << numSamples << " samples of " << numSites << " sites" << endl;
+	o << "\tEstimate\tSE" << endl;
+	for (int e=0; e<numEst; e++)
+		{
+		o << names[e] << "\t" << sum[e] << "\t" << se[e] << endl;
+		if (e == 1)
+			o << "waic\t" << -2.0 * sum[0] << "\t" << 2.0 * se[0] << endl;
+		}
+	o << "looic\t" << -2.0 * sum[2] << "\t" << 2.0 * se[2] << endl;
+	if (maxK == -numeric_limits<double>::infinity())
+		o << "Pareto k: not estimated (too few samples), elpd_loo is plain importance sampling" << endl;
+	else
+		o << "Pareto k: largest " << maxK << ", " << numBadK << " sites above 0.7 (unreliable elpd_loo)" << endl;
+	if (pointwise == false)
+		return;
+	o << "Pattern\tSites\tlppd\tp_waic\telpd_loo\tk" << endl;
+	for (int i=0; i<n; i++)
+		{
+		o << i + 1 << "\t" << siteWeights[i] << "\t" << setprecision(6) << lppd[i] << "\t" << pWaic[i] << "\t" << elpdLoo[i] << "\t";
+		if (kHat[i] == kHat[i])
+			o << setprecision(3) << kHat[i] << endl;
+		else
+			o << "NA" << endl;
+		}
+}
@@ -0,0 +1,66 @@
+/* 
+ * DPPDiv version 1.1b source code (https://github.com/trayc7/FDPPDIV)
+ * Copyright 2009-2013
+ * Tracy Heath(1,2,3) 
+ * Mark Holder(1)
+ * John Huelsenbeck(2)
+ *
+ * (1) Department of Ecology and Evolutionary Biology, University of Kansas, Lawrence, KS 66045
+ * (2) Integrative Biology, University of California, Berkeley, CA 94720-3140
+ * (3) email: tracyh@berkeley.edu
+ *
+ * Also: T Stadler, D Darriba, AJ Aberer, T Flouri, F Izquierdo-Carrasco, and A Stamatakis
+ *
+ * DPPDiv is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License (the file gpl.txt included with this
+ * distribution or http://www.gnu.org/licenses/gpl.txt for more
+ * details.
+ *
+ * Some of this code is from publicly available source by John Huelsenbeck and Fredrik Ronquist
+ *
+ */
+
+
+#ifndef SITELIKELIHOODS_H
+#define SITELIKELIHOODS_H
+
+#include <ostream>
+#include <vector>
+
+/*
+ * Streaming WAIC and PSIS-LOO from the log-likelihoods of the site patterns of the samples of
+ * a chain, so the samples need not be kept or evaluated again. For every pattern it keeps the
+ * log of the summed likelihoods (lppd), the mean and variance of the log-likelihood (the WAIC
+ * penalty), the log of the summed importance ratios 1/likelihood, and the largest ratios of
+ * the tail that PSIS smooths with a generalized Pareto fit. The sizes follow the number of
+ * samples expected. The patterns are weighted by their numbers of sites.
+ */
+class SiteLikelihoods {
+
+	public:
+								SiteLikelihoods(const std::vector<int> &weights, int expectedSamples);
+		void					addSample(const std::vector<double> &lnLs);
+		int						getNumSamples(void) { return numSamples; }
+		void					print(std::ostream &o, bool pointwise);
+
+	private:
+		void					psisLoo(int i, double &elpd, double &k);
+		static void				addLogTerm(double x, double &mx, double &sum);
+		static void				fitGeneralizedPareto(const std::vector<double> &x, double &k, double &sigma);
+		std::vector<int>		siteWeights;
+		int						numSamples;
+		int						tailLength;		// tail of the importance ratios smoothed by PSIS
+		std::vector<double>		meanLnL, m2LnL;
+		std::vector<double>		maxLnL, sumLik;			// log sum of the likelihoods = maxLnL + log(sumLik)
+		std::vector<double>		maxLnR, sumRatio;		// the same for the ratios
+		std::vector<std::vector<double> >	tail;	// min-heaps of the tailLength + 1 largest log ratios
+};
+
+#endif
@@ -5,9 +5,13 @@
 #include <xmmintrin.h>
 #include <emmintrin.h>
 #include <pmmintrin.h>
-//#include <immintrin.h>
+#ifdef _TOM_AVX
+#include <immintrin.h>
+#endif
 
-#ifdef __AVX__
+#if defined (__AVX512F__)
+#define BYTE_ALIGNMENT 64
+#elif defined (__AVX__)
 #define BYTE_ALIGNMENT 32
 #else
 #define BYTE_ALIGNMENT 16
@@ -105,6 +105,29 @@ void printHelp(bool files)
 		cout << "\t\t-mup  : modify update probabilities mid run\n";
 		cout << "\t\t-fxm  : fix some model params\n";
 		cout << "\t\t-ihp  : run under independent hyperprior on exp cals\n";
+		cout << "\t\t-kern : likelihood kernels, auto|seq|sse3|avx|avx2|avx512 [= auto, best supported by the CPU]\n";
+		cout << "\t\t-soa  : store the conditional likelihoods pattern-interleaved, one pattern per SIMD lane\n";
+		cout << "\t\t-prec : precision of the conditional likelihoods, double|single|mixed [= double]\n";
+		cout << "\t\t-vprec: also compute the likelihoods in double and report the difference (with -prec single|mixed)\n";
+		cout << "\t\t-cblk : site patterns per block of the cache-blocked likelihood traversal, 0 = no blocking [= from L2 size]\n";
+		cout << "\t\t-srep : compute the site patterns that are identical within a subtree only once per node\n";
+		cout << "\t\t-ncat : number of gamma rate categories, 1|2|4|8 [= 4]\n";
+		cout << "\t\t-inv  : estimate a proportion of invariant sites (+I) along with the gamma rates\n";
+		cout << "\t\t-aa   : the data are amino acids (the exchangeabilities are fixed, equal unless given with -rmf)\n";
+		cout << "\t\t-rmf  : file with fixed exchangeabilities, lower triangle as in the PAML .dat files\n";
+		cout << "\t\t-nohp : do not use huge pages for the conditional likelihoods and transition probabilities\n";
+		cout << "\t\t-pin  : pin the t-th thread to the t-th processor available to the process\n";
+		cout << "\t\t-clmem: memory cap in MB of the likelihood arena, the conditional likelihoods that do not fit are recomputed [= no cap]\n";
+		cout << "\t\t-clfile: keep the likelihood arena in this (temporary) file instead of the memory, e.g. on a local SSD\n";
+		cout << "\t\t-clscratch: conditional likelihood slots a proposal can update besides the committed ones [= tree height + 2]\n";
+		cout << "\t\t-ptask: run the independent subtrees of the likelihood traversal in parallel as tasks (dppdiv-par)\n";
+		cout << "\t\t-outside: keep outside partials, so a node age or node rate move only updates the nodes next to it\n";
+		cout << "\t\t-vout : also evaluate every candidate table of the node rate move alone and report the difference (with -outside)\n";
+		cout << "\t\t-adapt: time the sequential, pattern-parallel and task schedules and use the fastest, up to this many threads (0 = all)\n";
+		cout << "\t\t-part : partition file (RAxML style, name = 1-500, 501-900), each partition gets its own substitution model\n";
+		cout << "\t\t-waic : estimate WAIC and PSIS-LOO from the site log-likelihoods of the samples after the burn-in (.waic.out)\n";
+		cout << "\t\t-bi   : burn-in of -waic in generations [= 10000]\n";
+		cout << "\t\t-sitelnl: write the site log-likelihoods of every sample to a binary file (.sitelnl)\n";
 		cout << "\t\t** required\n\n";
 	}
 }
@@ -120,6 +143,7 @@ int main (int argc, char * const argv[]) {
 	string calibFN		= "";
 	string tipDateFN	= "";
 	string outName		= "out";
+	string kernelName	= "auto";	// likelihood kernels, picked from the CPU features by default
 	double priorMean    = 3.0;		// prior mean number of rate cats
 	double rateSh       = 2.0;		// shape param for gamma dist on rates
 	double rateSc       = 4.0;		// scale param for gamma dist on rates
@@ -133,7 +157,7 @@ int main (int argc, char * const argv[]) {
 	int printFreq		= 100;
 	int sampleFreq		= 100;
 	int numCycles		= 1000000;
-	int burn			= 10000;	// not used
+	int burn			= 10000;	// generations left out of the WAIC and PSIS-LOO (-waic)
 	int treeNodePrior	= 1;
 	bool userBLs		= false;	// initialize tree with user branch lenghts
 	bool writeDataFile	= false;	// write moves to info.out file
@@ -156,6 +180,27 @@ int main (int argc, char * const argv[]) {
 	bool indHP			= false;
 	bool doAbsRts		= false;
 	bool fixTest		= false;
+	bool interleaveCls	= false;	// pattern-interleaved (SoA) conditional likelihoods
+	string clPrec		= "double";	// precision of the conditional likelihoods
+	bool checkPrec		= false;	// compare the float likelihoods with the double ones
+	int cacheBlock		= -1;		// patterns per block of the likelihood traversal, -1 = auto
+	bool siteRepeats	= false;	// compute the patterns that repeat within a subtree only once
+	int numGammaCats	= 4;		// discrete gamma categories of the rate variation across sites
+	bool invSites		= false;	// proportion of invariant sites (+I)
+	bool aminoAcids		= false;	// protein data
+	string rateMatrixFN	= "";		// fixed exchangeabilities
+	bool hugePages		= true;		// advise huge pages for the likelihood arena
+	bool pinThreads		= false;	// pin every thread to one processor
+	double clMemory		= 0.0;		// MB for the likelihood arena, 0 = no cap
+	string clFile		= "";		// file backing the likelihood arena
+	int clScratch		= -1;		// scratch slots of the conditional likelihoods, -1 = from the tree
+	bool taskGraph		= false;	// schedule the node updates as tasks
+	bool outsidePartials = false;	// evaluate node moves at the node from outside partials
+	bool checkOutside = false;		// compare the batched candidate tables with one evaluation per table
+	int adaptThreads	= -1;		// thread cap of the adaptive parallel schedule, 0 = all, -1 = off
+	string partFileName	= "";		// partitions of the sites
+	bool waic			= false;	// estimate WAIC and PSIS-LOO from the site log-likelihoods
+	bool siteLnLFile	= false;	// write the site log-likelihoods of the samples
 	
 	if(argc > 1){  
 		for (int i = 1; i < argc; i++){
@@ -261,6 +306,50 @@ int main (int argc, char * const argv[]) {
 				else if(!strcmp(curArg, "-fxtr")){
 					fixTest = true;
 				}
+				else if(!strcmp(curArg, "-kern"))
+					kernelName = argv[i+1];
+				else if(!strcmp(curArg, "-soa"))
+					interleaveCls = true;
+				else if(!strcmp(curArg, "-prec"))
+					clPrec = argv[i+1];
+				else if(!strcmp(curArg, "-vprec"))
+					checkPrec = true;
+				else if(!strcmp(curArg, "-cblk"))
+					cacheBlock = atoi(argv[i+1]);
+				else if(!strcmp(curArg, "-srep"))
+					siteRepeats = true;
+				else if(!strcmp(curArg, "-ncat"))
+					numGammaCats = atoi(argv[i+1]);
+				else if(!strcmp(curArg, "-inv"))
+					invSites = true;
+				else if(!strcmp(curArg, "-aa"))
+					aminoAcids = true;
+				else if(!strcmp(curArg, "-rmf"))
+					rateMatrixFN = argv[i+1];
+				else if(!strcmp(curArg, "-nohp"))
+					hugePages = false;
+				else if(!strcmp(curArg, "-pin"))
+					pinThreads = true;
+				else if(!strcmp(curArg, "-clmem"))
+					clMemory = atof(argv[i+1]);
+				else if(!strcmp(curArg, "-clfile"))
+					clFile = argv[i+1];
+				else if(!strcmp(curArg, "-clscratch"))
+					clScratch = atoi(argv[i+1]);
+				else if(!strcmp(curArg, "-ptask"))
+					taskGraph = true;
+				else if(!strcmp(curArg, "-outside"))
+					outsidePartials = true;
+				else if(!strcmp(curArg, "-vout"))
+					checkOutside = true;
+				else if(!strcmp(curArg, "-adapt"))
+					adaptThreads = atoi(argv[i+1]);
+				else if(!strcmp(curArg, "-part"))
+					partFileName = argv[i+1];
+				else if(!strcmp(curArg, "-waic"))
+					waic = true;
+				else if(!strcmp(curArg, "-sitelnl"))
+					siteLnLFile = true;
 				else if(!strcmp(curArg, "-h")){
 					printHelp(false);
 					return 0;
@@ -298,7 +387,9 @@ int main (int argc, char * const argv[]) {
 	
 		
 	cout << "Reading data from file -- " << dataFileName << endl;
-	Alignment myAlignment( dataFileName );
+	Alignment myAlignment( dataFileName, aminoAcids );
+	if(partFileName.empty() == false)
+		myAlignment.readPartitions(partFileName);
 	myAlignment.compress();
 	if(printalign)
 		myAlignment.print(std::cout);
@@ -313,16 +404,18 @@ int main (int argc, char * const argv[]) {
 	Model myModel(&myRandom, &myAlignment, treeStr, priorMean, rateSh, rateSc, 
 				  hyperSh, hyperSc, userBLs, moveAllN, offmove, rndNdMv, calibFN, 
 				  treeNodePrior, netDiv, relDeath, ssbdPrS, fixclokrt, rootfix, softbnd, calibHyP,
-				  dpmExpHyp, dpmEHPPrM, gammaExpHP, modelType, fixModelPs, indHP, tipDateFN, fixTest);
+				  dpmExpHyp, dpmEHPPrM, gammaExpHP, modelType, fixModelPs, indHP, tipDateFN, fixTest,
+				  kernelName, interleaveCls, clPrec, checkPrec, cacheBlock, siteRepeats, numGammaCats, invSites,
+				  rateMatrixFN, hugePages, pinThreads, clMemory, clFile, clScratch,
+				  taskGraph, outsidePartials, adaptThreads, runPrior, checkOutside);
 	if(doAbsRts)
 		myModel.setEstAbsRates(true);
-	if(runPrior)
-		myModel.setRunUnderPrior(true);
 	if(justTree){
 		myModel.writeUnifTreetoFile();
 		return 0;
 	}
-	Mcmc mcmc(&myRandom, &myModel, numCycles, printFreq, sampleFreq, outName, writeDataFile, modUpdatePs);
+	Mcmc mcmc(&myRandom, &myModel, numCycles, printFreq, sampleFreq, outName, writeDataFile, modUpdatePs, burn,
+			  waic, siteLnLFile);
 	
     return 0;
 }